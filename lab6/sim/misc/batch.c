@@ -0,0 +1,122 @@
+/*
+ * batch.c - Run many object files in one invocation (see batch.h)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "isa.h"
+#include "ptsuite.h"
+#include "batch.h"
+
+/* One object file of the batch */
+typedef struct {
+    char *fname;
+    bool_t loaded;
+    batch_rec run;
+    check_rec check;
+} bfile_rec, *bfile_ptr;
+
+/* Shared state of the worker pool */
+typedef struct {
+    bfile_ptr files;
+    int count;
+    int next;           /* Next file to be run */
+    word_t max_instr;
+    bool_t check;
+    FILE *trace;
+    pthread_mutex_t lock;
+} bpool_rec, *bpool_ptr;
+
+/* Take files from the pool until there are none left */
+static void *batch_worker(void *arg)
+{
+    bpool_ptr pool = (bpool_ptr) arg;
+    mem_t image = init_mem(MEM_SIZE);
+    bfile_ptr f;
+    FILE *in;
+    int i;
+
+    sim_init();
+    sim_set_dumpfile(pool->trace);
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	i = pool->next++;
+	pthread_mutex_unlock(&pool->lock);
+	if (i >= pool->count)
+	    break;
+	f = &pool->files[i];
+	clear_mem(image);
+	in = open_object(f->fname);
+	if (!in) {
+	    fprintf(stderr, "Couldn't open object file %s\n", f->fname);
+	    continue;
+	}
+	f->loaded = load_mem(image, in, 1) > 0;
+	fclose(in);
+	if (!f->loaded) {
+	    fprintf(stderr, "No code loaded from %s\n", f->fname);
+	    continue;
+	}
+	if (pool->trace)
+	    fprintf(pool->trace, "\n%s\n", f->fname);
+	sim_batch_prog(image, pool->max_instr, &f->run,
+		       pool->check ? &f->check : NULL);
+    }
+    sim_free();
+    free_mem(image);
+    return NULL;
+}
+
+int batch_run(char **files, int nfiles, int nthreads, word_t max_instr,
+	      bool_t check, FILE *trace)
+{
+    bpool_rec pool;
+    pthread_t tid[nthreads];
+    int i, errors = 0;
+
+    pool.files = (bfile_ptr) calloc(nfiles, sizeof(bfile_rec));
+    for (i = 0; i < nfiles; i++)
+	pool.files[i].fname = files[i];
+    pool.count = nfiles;
+    pool.next = 0;
+    pool.max_instr = max_instr;
+    pool.check = check;
+    pool.trace = trace;
+    pthread_mutex_init(&pool.lock, NULL);
+    /* The calling thread is one of the workers */
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&tid[i], NULL, batch_worker, &pool) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+    batch_worker(&pool);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+
+    printf("file,status,instructions,cycles,cpi%s\n", check ? ",check" : "");
+    for (i = 0; i < nfiles; i++) {
+	bfile_ptr f = &pool.files[i];
+	if (!f->loaded) {
+	    printf("%s,,,,%s\n", f->fname, check ? "," : "");
+	    errors++;
+	    continue;
+	}
+	printf("%s,%s,%lld,%lld,%.2f", f->fname, stat_name(f->run.stat),
+	       f->run.instr, f->run.cycles,
+	       f->run.instr > 0 ? (double) f->run.cycles / f->run.instr : 1.0);
+	if (check && f->check.ok) {
+	    printf(",ok");
+	} else if (check) {
+	    printf(",\"cycle %lld, instruction %lld, PC 0x%llx: %s\"",
+		   f->check.cycle, f->check.instr, f->check.pc, f->check.what);
+	    errors++;
+	}
+	printf("\n");
+    }
+    free(pool.files);
+    return errors;
+}
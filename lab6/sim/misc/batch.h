@@ -0,0 +1,41 @@
+/*
+ * batch.h - Run many object files in one invocation of a simulator
+ *
+ * The files are loaded and run on a pool of threads, each optionally
+ * checked against the ISA simulator as with -t, and one line of CSV is
+ * printed per file, in the order given.  Nothing is formatted per
+ * cycle unless a trace is asked for.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+/* Outcome of running one program */
+typedef struct {
+    byte_t stat;      /* Status when the simulator stopped */
+    word_t cycles;    /* Cycles and instructions, as counted by the */
+    word_t instr;     /* CPI line of the TTY report */
+} batch_rec, *batch_ptr;
+
+/*
+ * Supplied by the simulator, along with sim_init, sim_free and
+ * sim_set_dumpfile, for the calling thread.  sim_batch_prog runs the
+ * program in image from address 0 for at most max_instr instructions
+ * and records the outcome in b.  If c is not NULL, the run is checked
+ * against the ISA simulator as by sim_check_prog, with the result in c.
+ */
+void sim_batch_prog(mem_t image, word_t max_instr, batch_ptr b,
+		    check_ptr c);
+void sim_set_dumpfile(FILE *file);
+
+/*
+ * Run the nfiles object files in files on nthreads threads, checking
+ * them if check is set, and print the CSV summary to stdout.  If trace
+ * is not NULL, the cycle by cycle trace of every run is written to it.
+ * Return the number of files that could not be loaded or failed the
+ * check.
+ */
+int batch_run(char **files, int nfiles, int nthreads, word_t max_instr,
+	      bool_t check, FILE *trace);
+
+#endif /* BATCH_H */
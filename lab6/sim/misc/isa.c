@@ -2,6 +2,9 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "isa.h"
 
 
@@ -132,6 +135,34 @@ instr_ptr bad_instr()
 }
 
 
+/*
+ * The hash of a memory is the XOR of a hash of each nonzero aligned
+ * 8-byte word and its address.  It depends only on the contents, and
+ * a write only changes the hashes of the one or two words it touches,
+ * so simulators can compare memories after every instruction without
+ * scanning them.
+ */
+static word_t word_hash(mem_t m, word_t pos)
+{
+    uword_t x;
+    memcpy(&x, &m->contents[pos], 8);
+    if (x == 0)
+	return 0;
+    x ^= (uword_t) pos * 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* Toggle the hashes of the words holding bytes pos to pos+len-1 in the
+   hash of m.  Called before and after writing them */
+static void hash_words(mem_t m, word_t pos, int len)
+{
+    word_t w;
+    for (w = pos & ~0x7; w < pos + len; w += 8)
+	m->hash ^= word_hash(m, w);
+}
+
 mem_t init_mem(int len)
 {
 
@@ -139,12 +170,14 @@ mem_t init_mem(int len)
     len = ((len+BPL-1)/BPL)*BPL;
     result->len = len;
     result->contents = (byte_t *) calloc(len, 1);
+    result->hash = 0;
     return result;
 }
 
 void clear_mem(mem_t m)
 {
     memset(m->contents, 0, m->len);
+    m->hash = 0;
 }
 
 void free_mem(mem_t m)
@@ -156,10 +189,16 @@ void free_mem(mem_t m)
 mem_t copy_mem(mem_t oldm)
 {
     mem_t newm = init_mem(oldm->len);
-    memcpy(newm->contents, oldm->contents, oldm->len);
+    set_mem(newm, oldm);
     return newm;
 }
 
+void set_mem(mem_t m, mem_t src)
+{
+    memcpy(m->contents, src->contents, m->len);
+    m->hash = src->hash;
+}
+
 bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile)
 {
     word_t pos;
@@ -190,6 +229,92 @@ int hex2dig(char c)
 	return c - 'a' + 10;
 }
 
+/* Read an 8-byte little-endian word */
+static word_t get_le_word(byte_t *p)
+{
+    word_t val = 0;
+    int i;
+    for (i = 7; i >= 0; i--)
+	val = (val << 8) | p[i];
+    return val;
+}
+
+/* Map the binary image in file fd and copy its segments into m */
+static int load_image(mem_t m, int fd, int report_error)
+{
+    struct stat st;
+    byte_t *img;
+    word_t pos = IMG_HEADER_LEN;
+    word_t seg = pos, addr, len;
+    int byte_cnt = 0;
+
+    if (fstat(fd, &st) < 0)
+	return 0;
+    if (st.st_size < IMG_HEADER_LEN) {
+	if (report_error)
+	    fprintf(stderr, "Error reading image. Header is cut short\n");
+	return 0;
+    }
+    img = (byte_t *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (img == MAP_FAILED) {
+	if (report_error)
+	    perror("Error mapping image");
+	return 0;
+    }
+    while (pos < st.st_size) {
+	seg = pos;
+	if (pos + 16 > st.st_size)
+	    break;
+	addr = get_le_word(img + pos);
+	len = get_le_word(img + pos + 8);
+	pos += 16;
+	if (len < 0 || len > st.st_size - pos || addr < 0 || addr > m->len - len)
+	    break;
+	hash_words(m, addr, len);
+	memcpy(m->contents + addr, img + pos, len);
+	hash_words(m, addr, len);
+	pos += len;
+	byte_cnt += len;
+    }
+    munmap(img, st.st_size);
+    if (pos < st.st_size) {
+	if (report_error)
+	    fprintf(stderr, "Error reading image. Invalid segment at 0x%llx\n",
+		    seg);
+	return 0;
+    }
+    return byte_cnt;
+}
+
+FILE *open_object(char *fname)
+{
+    int len = strlen(fname);
+    char *imgname = (char *) malloc(len + 2);
+    byte_t header[IMG_HEADER_LEN];
+    struct stat yo;
+    FILE *f = NULL;
+
+    strcpy(imgname, fname);
+    if (len > 3 && strcmp(fname + len - 3, ".yo") == 0) {
+	strcpy(imgname + len - 3, ".ybo");
+	if (stat(fname, &yo) == 0 && (f = fopen(imgname, "r")) != NULL) {
+	    /* The image stands for the .yo only if that hasn't changed
+	       since yas wrote both */
+	    if (fread(header, 1, IMG_HEADER_LEN, f) != IMG_HEADER_LEN ||
+		memcmp(header, IMG_MAGIC, IMG_MAGIC_LEN) != 0 ||
+		get_le_word(header + IMG_MAGIC_LEN) != yo.st_size ||
+		get_le_word(header + IMG_MAGIC_LEN + 8) != yo.st_mtim.tv_sec ||
+		get_le_word(header + IMG_MAGIC_LEN + 16) != yo.st_mtim.tv_nsec) {
+		fclose(f);
+		f = NULL;
+	    } else
+		rewind(f);
+	}
+    }
+    free(imgname);
+    return f ? f : fopen(fname, "r");
+}
+
 #define LINELEN 4096
 int load_mem(mem_t m, FILE *infile, int report_error)
 {
@@ -208,6 +333,14 @@ int load_mem(mem_t m, FILE *infile, int report_error)
     char line[LINELEN];
     int index = 0;
 #endif /* HAS_GUI */   
+    byte_t magic[IMG_MAGIC_LEN];
+
+    /* Binary images are recognized by their magic number.  Pipes
+       can't be mapped, and are always read as text */
+    if (pread(fileno(infile), magic, IMG_MAGIC_LEN, 0) == IMG_MAGIC_LEN &&
+	memcmp(magic, IMG_MAGIC, IMG_MAGIC_LEN) == 0)
+	return load_image(m, fileno(infile), report_error);
+
     while (fgets(buf, LINELEN, infile)) {
 	int cpos = 0;
 #ifdef HAS_GUI
@@ -265,7 +398,9 @@ int load_mem(mem_t m, FILE *infile, int report_error)
 		return 0;
 	    }
 	    byte = hex2dig(ch)*16+hex2dig(cl);
-	    m->contents[bytepos++] = byte;
+	    hash_words(m, bytepos, 1);
+	    m->contents[bytepos] = byte;
+	    hash_words(m, bytepos++, 1);
 	    byte_cnt++;
 #ifdef HAS_GUI
 	    empty_line = 0;
@@ -326,7 +461,9 @@ bool_t set_byte_val(mem_t m, word_t pos, byte_t val)
 {
     if (pos < 0 || pos >= m->len)
 	return FALSE;
+    hash_words(m, pos, 1);
     m->contents[pos] = val;
+    hash_words(m, pos, 1);
     return TRUE;
 }
 
@@ -335,10 +472,12 @@ bool_t set_word_val(mem_t m, word_t pos, word_t val)
     int i;
     if (pos < 0 || pos + 8 > m->len)
 	return FALSE;
+    hash_words(m, pos, 8);
     for (i = 0; i < 8; i++) {
 	m->contents[pos+i] = (byte_t) val & 0xFF;
 	val >>= 8;
     }
+    hash_words(m, pos, 8);
     return TRUE;
 }
 
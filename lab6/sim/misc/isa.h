@@ -93,6 +93,7 @@ typedef struct {
   int len;
   word_t maxaddr;
   byte_t *contents;
+  word_t hash;     /* Hash of the contents, kept up to date as they change */
 } mem_rec, *mem_t;
 
 /* Create a memory with len bytes */
@@ -104,6 +105,8 @@ void clear_mem(mem_t m);
 
 /* Make a copy of a memory */
 mem_t copy_mem(mem_t oldm);
+/* Overwrite the contents of memory m with those of src, of the same size */
+void set_mem(mem_t m, mem_t src);
 /* Print the differences between two memories */
 bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile);
 
@@ -116,9 +119,24 @@ bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile);
 
 /*** In the following functions, a return value of 1 means success ***/
 
-/* Load memory from .yo file.  Return number of bytes read */
+/*
+ * Binary images.  Along with file.yo, yas -b writes file.ybo: the magic
+ * number, the size and modification time (seconds, nanoseconds) of
+ * file.yo, then for each run of consecutive bytes of code, its address
+ * and length, all as 8-byte little-endian words, followed by the bytes.
+ */
+#define IMG_MAGIC "YBO\2"
+#define IMG_MAGIC_LEN 4
+#define IMG_HEADER_LEN (IMG_MAGIC_LEN + 24)
+
+/* Load memory from .yo file or binary image.  Return number of bytes read */
 int load_mem(mem_t m, FILE *infile, int report_error);
 
+/* Open object file fname, or the binary image next to it if that was
+   written along with fname as it is now.  Return NULL if neither can be
+   opened */
+FILE *open_object(char *fname);
+
 /* Get byte from memory */
 bool_t get_byte_val(mem_t m, word_t pos, byte_t *dest);
 
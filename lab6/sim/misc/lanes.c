@@ -0,0 +1,677 @@
+/*
+ * lanes.c - Many copies of one Y86-64 program run side by side
+ *
+ * Lanes at the same PC form a group.  Choosing the group with the
+ * lowest PC at every step lets lanes that split at a branch come back
+ * together where the paths meet, e.g. just after the jle around the
+ * count increment of ncopy, or at the exit of a loop that some lanes
+ * leave early.
+ *
+ * The instruction of a group is normally decoded once, from the image
+ * all lanes started with.  That is only right if none of them has
+ * changed its bytes, so every byte written by any lane is remembered,
+ * and an instruction overlapping one is decoded by each lane from its
+ * own memory.  Once a byte has been decoded from the image, a lane
+ * that overwrites it fetches from its own memory from then on.
+ *
+ * Register-only instructions are applied to the whole group with the
+ * vector extensions of gcc, LANE_VEC lanes at a time, under a mask of
+ * the lanes in the group.  This turns into SSE2 instructions on any
+ * x86-64, or AVX2 ones when compiled with -mavx2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "lanes.h"
+
+/* Lanes stepped by one vector operation: one SSE2 or AVX2 register */
+#ifdef __AVX2__
+#define LANE_VEC 4
+#else
+#define LANE_VEC 2
+#endif
+
+/* Groups smaller than 1/VEC_FRAC of the lanes are stepped lane by lane */
+#define VEC_FRAC 4
+
+/* Instructions run by a lane on its own once it has diverged */
+#define BURST 256
+
+typedef word_t lane_vec __attribute__ ((vector_size (LANE_VEC*sizeof(word_t))));
+typedef uword_t lane_uvec __attribute__ ((vector_size (LANE_VEC*sizeof(word_t))));
+
+/* Instruction decoded for a group */
+typedef struct {
+    itype_t icode;
+    int ifun;
+    reg_id_t ra;
+    reg_id_t rb;
+    word_t valc;
+    word_t valp;    /* Address of the next instruction */
+    stat_t err;     /* Status the instruction raises in every lane */
+} linstr_rec, *linstr_ptr;
+
+/**************** Lane state ************************/
+
+lanes_t lanes_init(int n, mem_t image)
+{
+    lanes_t l = (lanes_t) calloc(1, sizeof(lanes_rec));
+    int npad = (n + LANE_VEC - 1) / LANE_VEC * LANE_VEC;
+    int i;
+
+    l->n = n;
+    l->npad = npad;
+    l->pc = (word_t *) calloc(npad, sizeof(word_t));
+    l->reg = (word_t *) calloc((REG_NONE+1) * npad, sizeof(word_t));
+    l->cc = (word_t *) calloc(npad, sizeof(word_t));
+    l->stat = (byte_t *) calloc(npad, sizeof(byte_t));
+    l->steps = (word_t *) calloc(npad, sizeof(word_t));
+    l->mem = (mem_t *) calloc(n, sizeof(mem_t));
+    l->image = copy_mem(image);
+    l->code = (byte_t *) calloc(image->len, sizeof(byte_t));
+    l->written = (byte_t *) calloc(image->len, sizeof(byte_t));
+    l->own = (byte_t *) calloc(n, sizeof(byte_t));
+    l->mask = (word_t *) calloc(npad, sizeof(word_t));
+    l->idx = (int *) calloc(n, sizeof(int));
+    l->act = (int *) calloc(n, sizeof(int));
+    for (i = 0; i < npad; i++) {
+	l->cc[i] = DEFAULT_CC;
+	/* Padding lanes never run */
+	l->stat[i] = i < n ? STAT_AOK : STAT_BUB;
+    }
+    for (i = 0; i < n; i++)
+	l->mem[i] = copy_mem(image);
+    return l;
+}
+
+void lanes_free(lanes_t l)
+{
+    int i;
+    for (i = 0; i < l->n; i++)
+	free_mem(l->mem[i]);
+    free_mem(l->image);
+    free(l->pc);
+    free(l->reg);
+    free(l->cc);
+    free(l->stat);
+    free(l->steps);
+    free(l->mem);
+    free(l->code);
+    free(l->written);
+    free(l->own);
+    free(l->mask);
+    free(l->idx);
+    free(l->act);
+    free(l);
+}
+
+/* Note that lane i changed bytes pos..pos+len-1 */
+static void lane_wrote(lanes_t l, int i, word_t pos, int len)
+{
+    word_t p;
+    for (p = pos; p < pos + len; p++) {
+	l->written[p] = 1;
+	if (l->code[p])
+	    l->own[i] = 1;
+    }
+}
+
+void lanes_set_mem(lanes_t l, int i, mem_t m)
+{
+    byte_t *a = m->contents;
+    byte_t *b = l->image->contents;
+    word_t p, q;
+    int len;
+    for (p = 0; p < m->len; p += len) {
+	len = m->len - p < 64 ? m->len - p : 64;
+	if (memcmp(a + p, b + p, len) == 0)
+	    continue;
+	for (q = p; q < p + len; q++)
+	    if (a[q] != b[q])
+		lane_wrote(l, i, q, 1);
+    }
+    set_mem(l->mem[i], m);
+}
+
+/**************** Decoding ************************/
+
+/*
+ * Decode the instruction at pc in m, finding the faults that don't
+ * depend on the state of a lane in the order step_state does
+ */
+static void decode(mem_t m, word_t pc, linstr_ptr d)
+{
+    byte_t byte0 = 0;
+    byte_t byte1 = 0;
+    bool_t ok1 = TRUE;
+    bool_t okc = TRUE;
+    word_t ftpc = pc;
+
+    d->ra = d->rb = REG_NONE;
+    d->valc = 0;
+    d->err = STAT_AOK;
+    if (!get_byte_val(m, ftpc, &byte0)) {
+	d->icode = I_HALT;
+	d->ifun = F_NONE;
+	d->valp = pc;
+	d->err = STAT_ADR;
+	return;
+    }
+    ftpc++;
+    d->icode = HI4(byte0);
+    d->ifun = LO4(byte0);
+
+    switch (d->icode) {
+    case I_RRMOVQ: case I_ALU: case I_PUSHQ: case I_POPQ:
+    case I_IRMOVQ: case I_RMMOVQ: case I_MRMOVQ: case I_IADDQ:
+	ok1 = get_byte_val(m, ftpc, &byte1);
+	ftpc++;
+	d->ra = HI4(byte1);
+	d->rb = LO4(byte1);
+	break;
+    default:
+	break;
+    }
+    switch (d->icode) {
+    case I_IRMOVQ: case I_RMMOVQ: case I_MRMOVQ:
+    case I_JMP: case I_CALL: case I_IADDQ:
+	okc = get_word_val(m, ftpc, &d->valc);
+	ftpc += 8;
+	break;
+    default:
+	break;
+    }
+    d->valp = ftpc;
+
+    switch (d->icode) {
+    case I_NOP: case I_HALT: case I_RET:
+	break;
+    case I_RRMOVQ:
+	if (!ok1)
+	    d->err = STAT_ADR;
+	else if (d->ra >= REG_NONE || d->rb >= REG_NONE)
+	    d->err = STAT_INS;
+	break;
+    case I_IRMOVQ: case I_IADDQ:
+	if (!ok1)
+	    d->err = STAT_ADR;
+	else if (!okc || d->rb >= REG_NONE)
+	    d->err = STAT_INS;
+	break;
+    case I_RMMOVQ: case I_MRMOVQ:
+	if (!ok1)
+	    d->err = STAT_ADR;
+	else if (!okc || d->ra >= REG_NONE)
+	    d->err = STAT_INS;
+	break;
+    case I_ALU:
+	if (!ok1)
+	    d->err = STAT_ADR;
+	break;
+    case I_JMP: case I_CALL:
+	if (!okc)
+	    d->err = STAT_ADR;
+	break;
+    case I_PUSHQ: case I_POPQ:
+	if (!ok1)
+	    d->err = STAT_ADR;
+	else if (d->ra >= REG_NONE)
+	    d->err = STAT_INS;
+	break;
+    default:
+	d->err = STAT_INS;
+	break;
+    }
+}
+
+/*
+ * Decode the instruction at pc from the image, if no lane has changed
+ * any of its bytes.  Return FALSE if it must be decoded lane by lane.
+ */
+static bool_t decode_shared(lanes_t l, word_t pc, linstr_ptr d)
+{
+    word_t p, end;
+
+    decode(l->image, pc, d);
+    /* Every lane faults on a PC outside memory */
+    if (pc < 0 || pc >= l->image->len)
+	return TRUE;
+    end = d->valp > pc ? d->valp : pc + 1;
+    if (end > l->image->len)
+	end = l->image->len;
+    for (p = pc; p < end; p++)
+	if (l->written[p])
+	    return FALSE;
+    for (p = pc; p < end; p++)
+	l->code[p] = 1;
+    return TRUE;
+}
+
+/**************** Execution, one lane at a time ****************/
+
+#define REG(r) LANE_REG(l, r, i)
+
+static void set_reg(lanes_t l, int i, reg_id_t r, word_t val)
+{
+    if (r < REG_NONE)
+	REG(r) = val;
+}
+
+static bool_t store(lanes_t l, int i, word_t pos, word_t val)
+{
+    if (!set_word_val(l->mem[i], pos, val))
+	return FALSE;
+    lane_wrote(l, i, pos, 8);
+    return TRUE;
+}
+
+/* Same effect on lane i as step_state */
+static void exec_lane(lanes_t l, int i, linstr_ptr d)
+{
+    word_t val, dval;
+    stat_t stat = STAT_AOK;
+    word_t pc = d->valp;
+
+    l->steps[i]++;
+    if (d->err != STAT_AOK) {
+	l->stat[i] = d->err;
+	return;
+    }
+    switch (d->icode) {
+    case I_NOP:
+	break;
+    case I_HALT:
+	stat = STAT_HLT;
+	break;
+    case I_RRMOVQ:
+	if (cond_holds(l->cc[i], d->ifun))
+	    set_reg(l, i, d->rb, REG(d->ra));
+	break;
+    case I_IRMOVQ:
+	set_reg(l, i, d->rb, d->valc);
+	break;
+    case I_RMMOVQ:
+	if (!store(l, i, d->valc + REG(d->rb), REG(d->ra)))
+	    stat = STAT_ADR;
+	break;
+    case I_MRMOVQ:
+	if (!get_word_val(l->mem[i], d->valc + REG(d->rb), &val))
+	    stat = STAT_ADR;
+	else
+	    set_reg(l, i, d->ra, val);
+	break;
+    case I_ALU:
+	val = compute_alu(d->ifun, REG(d->ra), REG(d->rb));
+	l->cc[i] = compute_cc(d->ifun, REG(d->ra), REG(d->rb));
+	set_reg(l, i, d->rb, val);
+	break;
+    case I_JMP:
+	if (cond_holds(l->cc[i], d->ifun))
+	    pc = d->valc;
+	break;
+    case I_CALL:
+	val = REG(REG_RSP) - 8;
+	REG(REG_RSP) = val;
+	if (!store(l, i, val, d->valp))
+	    stat = STAT_ADR;
+	pc = d->valc;
+	break;
+    case I_RET:
+	dval = REG(REG_RSP);
+	if (!get_word_val(l->mem[i], dval, &val))
+	    stat = STAT_ADR;
+	else {
+	    REG(REG_RSP) = dval + 8;
+	    pc = val;
+	}
+	break;
+    case I_PUSHQ:
+	val = REG(d->ra);
+	dval = REG(REG_RSP) - 8;
+	REG(REG_RSP) = dval;
+	if (!store(l, i, dval, val))
+	    stat = STAT_ADR;
+	break;
+    case I_POPQ:
+	dval = REG(REG_RSP);
+	REG(REG_RSP) = dval + 8;
+	if (!get_word_val(l->mem[i], dval, &val))
+	    stat = STAT_ADR;
+	else
+	    set_reg(l, i, d->ra, val);
+	break;
+    case I_IADDQ:
+	val = REG(d->rb) + d->valc;
+	l->cc[i] = compute_cc(A_ADD, d->valc, REG(d->rb));
+	set_reg(l, i, d->rb, val);
+	break;
+    default:
+	stat = STAT_INS;
+	break;
+    }
+    /* step_state leaves the PC alone when an instruction faults */
+    if (stat == STAT_AOK)
+	l->pc[i] = pc;
+    else
+	l->stat[i] = stat;
+}
+
+/**************** Execution, LANE_VEC lanes at a time ****************/
+
+static inline lane_vec vload(word_t *p)
+{
+    lane_vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vstore(word_t *p, lane_vec v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline lane_vec vsplat(word_t x)
+{
+    lane_vec v;
+    int j;
+    for (j = 0; j < LANE_VEC; j++)
+	v[j] = x;
+    return v;
+}
+
+/* Lanes of m set to all ones take a, the others b */
+static inline lane_vec vselect(lane_vec m, lane_vec a, lane_vec b)
+{
+    return (a & m) | (b & ~m);
+}
+
+/* All ones in the lanes whose condition codes satisfy cond, as cond_holds */
+static inline lane_vec vcond(lane_vec cc, int cond)
+{
+    lane_vec zf = (cc >> 2) & 1;
+    lane_vec sf = (cc >> 1) & 1;
+    lane_vec of = cc & 1;
+    lane_vec t;
+
+    switch (cond) {
+    case C_YES:
+	t = vsplat(1);
+	break;
+    case C_LE:
+	t = (sf ^ of) | zf;
+	break;
+    case C_L:
+	t = sf ^ of;
+	break;
+    case C_E:
+	t = zf;
+	break;
+    case C_NE:
+	t = zf ^ 1;
+	break;
+    case C_GE:
+	t = sf ^ of ^ 1;
+	break;
+    case C_G:
+	t = (sf ^ of ^ 1) & (zf ^ 1);
+	break;
+    default:
+	t = vsplat(0);
+	break;
+    }
+    return -t;
+}
+
+/* Result and condition codes of ALU operation op, as compute_cc */
+static inline lane_vec valu(int op, lane_vec a, lane_vec b, lane_vec *ccp)
+{
+    lane_vec zero = vsplat(0);
+    lane_vec val, ovf;
+
+    switch (op) {
+    case A_ADD:
+	val = (lane_vec) ((lane_uvec) a + (lane_uvec) b);
+	ovf = ((a < zero) == (b < zero)) & ((val < zero) != (a < zero));
+	break;
+    case A_SUB:
+	val = (lane_vec) ((lane_uvec) b - (lane_uvec) a);
+	ovf = ((a > zero) == (b < zero)) & ((val < zero) != (b < zero));
+	break;
+    case A_AND:
+	val = a & b;
+	ovf = zero;
+	break;
+    case A_XOR:
+	val = a ^ b;
+	ovf = zero;
+	break;
+    default:
+	val = zero;
+	ovf = zero;
+	break;
+    }
+    *ccp = ((val == zero) & 4) | ((val < zero) & 2) | (ovf & 1);
+    return val;
+}
+
+/* Can d be applied to a group with exec_vec? */
+static bool_t vec_ok(linstr_ptr d)
+{
+    if (d->err != STAT_AOK)
+	return FALSE;
+    switch (d->icode) {
+    case I_NOP: case I_RRMOVQ: case I_IRMOVQ:
+    case I_ALU: case I_JMP: case I_IADDQ:
+	return TRUE;
+    default:
+	return FALSE;
+    }
+}
+
+/* Apply d to every lane whose mask is set, where vec_ok(d) */
+static void exec_vec(lanes_t l, linstr_ptr d)
+{
+    int npad = l->npad;
+    word_t *ra = &LANE_REG(l, d->ra, 0);
+    word_t *rb = &LANE_REG(l, d->rb, 0);
+    lane_vec valc = vsplat(d->valc);
+    lane_vec valp = vsplat(d->valp);
+    lane_vec m, b, c, cc, val;
+    int i;
+
+    switch (d->icode) {
+    case I_RRMOVQ:
+	for (i = 0; i < npad; i += LANE_VEC) {
+	    c = vload(l->mask + i) & vcond(vload(l->cc + i), d->ifun);
+	    vstore(rb + i, vselect(c, vload(ra + i), vload(rb + i)));
+	}
+	break;
+    case I_IRMOVQ:
+	for (i = 0; i < npad; i += LANE_VEC) {
+	    m = vload(l->mask + i);
+	    vstore(rb + i, vselect(m, valc, vload(rb + i)));
+	}
+	break;
+    case I_ALU:
+	for (i = 0; i < npad; i += LANE_VEC) {
+	    m = vload(l->mask + i);
+	    b = vload(rb + i);
+	    val = valu(d->ifun, vload(ra + i), b, &cc);
+	    vstore(l->cc + i, vselect(m, cc, vload(l->cc + i)));
+	    if (d->rb < REG_NONE)
+		vstore(rb + i, vselect(m, val, b));
+	}
+	break;
+    case I_IADDQ:
+	for (i = 0; i < npad; i += LANE_VEC) {
+	    m = vload(l->mask + i);
+	    b = vload(rb + i);
+	    val = valu(A_ADD, valc, b, &cc);
+	    vstore(l->cc + i, vselect(m, cc, vload(l->cc + i)));
+	    vstore(rb + i, vselect(m, val, b));
+	}
+	break;
+    case I_JMP:
+	for (i = 0; i < npad; i += LANE_VEC) {
+	    m = vload(l->mask + i);
+	    c = vcond(vload(l->cc + i), d->ifun);
+	    vstore(l->pc + i, vselect(m, vselect(c, valc, valp),
+				      vload(l->pc + i)));
+	    vstore(l->steps + i, vload(l->steps + i) - m);
+	}
+	return;
+    default:
+	break;
+    }
+    for (i = 0; i < npad; i += LANE_VEC) {
+	m = vload(l->mask + i);
+	vstore(l->pc + i, vselect(m, valp, vload(l->pc + i)));
+	vstore(l->steps + i, vload(l->steps + i) - m);
+    }
+}
+
+/*
+ * Apply a load or store d to the cnt lanes listed in idx.  Same effect
+ * as exec_lane, without going through its switch for every lane
+ */
+static void exec_mem(lanes_t l, linstr_ptr d, int cnt)
+{
+    word_t *ra = &LANE_REG(l, d->ra, 0);
+    word_t *rb = &LANE_REG(l, d->rb, 0);
+    word_t val;
+    int i, k;
+
+    for (k = 0; k < cnt; k++) {
+	i = l->idx[k];
+	l->steps[i]++;
+	if (d->icode == I_MRMOVQ) {
+	    if (!get_word_val(l->mem[i], d->valc + rb[i], &val)) {
+		l->stat[i] = STAT_ADR;
+		continue;
+	    }
+	    ra[i] = val;
+	} else if (!store(l, i, d->valc + rb[i], ra[i])) {
+	    l->stat[i] = STAT_ADR;
+	    continue;
+	}
+	l->pc[i] = d->valp;
+    }
+}
+
+/**************** Stepping ************************/
+
+/*
+ * Step the cnt lanes of the group at pc, listed in idx and masked in
+ * mask.  Return TRUE if they all went on to the same next instruction.
+ */
+static bool_t step_group(lanes_t l, word_t pc, int cnt)
+{
+    linstr_rec d, own;
+    int i, k, nshared = 0;
+
+    if (!decode_shared(l, pc, &d)) {
+	for (k = 0; k < cnt; k++) {
+	    i = l->idx[k];
+	    decode(l->mem[i], pc, &own);
+	    exec_lane(l, i, &own);
+	}
+	return FALSE;
+    }
+
+    /* Lanes that changed code they have run fetch on their own */
+    for (k = 0; k < cnt; k++) {
+	i = l->idx[k];
+	if (l->own[i]) {
+	    l->mask[i] = 0;
+	    decode(l->mem[i], pc, &own);
+	    exec_lane(l, i, &own);
+	} else
+	    l->idx[nshared++] = i;
+    }
+
+    if (vec_ok(&d) && nshared * VEC_FRAC >= l->n) {
+	exec_vec(l, &d);
+	return nshared == cnt && d.icode != I_JMP;
+    }
+    if (d.err == STAT_AOK && (d.icode == I_MRMOVQ || d.icode == I_RMMOVQ))
+	exec_mem(l, &d, nshared);
+    else
+	for (k = 0; k < nshared; k++)
+	    exec_lane(l, l->idx[k], &d);
+    return FALSE;
+}
+
+/* Step lane i on its own for up to burst instructions */
+static void run_lane(lanes_t l, int i, word_t max_steps, int burst)
+{
+    linstr_rec d;
+    for (; burst > 0; burst--) {
+	if (l->stat[i] != STAT_AOK || l->steps[i] >= max_steps)
+	    return;
+	if (l->own[i] || !decode_shared(l, l->pc[i], &d))
+	    decode(l->mem[i], l->pc[i], &d);
+	exec_lane(l, i, &d);
+    }
+}
+
+void lanes_run(lanes_t l, word_t max_steps)
+{
+    word_t target = 0;
+    word_t top = 0;
+    bool_t together = FALSE;
+    int nact = 0;
+    int i, j, k, cnt = 0;
+
+    for (i = 0; i < l->n; i++)
+	l->act[nact++] = i;
+    for (;;) {
+	/* After a straight-line instruction run by every lane, they are
+	   still together and need not be looked at again */
+	if (!together) {
+	    /* Drop the lanes that have stopped, and gather those at the
+	       lowest PC */
+	    cnt = 0;
+	    top = 0;
+	    for (k = 0, i = 0; k < nact; k++) {
+		j = l->act[k];
+		if (l->stat[j] != STAT_AOK || l->steps[j] >= max_steps)
+		    continue;
+		l->act[i++] = j;
+		if (l->steps[j] > top)
+		    top = l->steps[j];
+		if (cnt > 0 && l->pc[j] > target)
+		    continue;
+		if (cnt == 0 || l->pc[j] < target) {
+		    target = l->pc[j];
+		    cnt = 0;
+		}
+		l->idx[cnt++] = j;
+	    }
+	    nact = i;
+	    if (cnt == 0)
+		break;
+
+	    if (cnt * VEC_FRAC < nact) {
+		/* The lanes have drifted apart.  Rather than paying for
+		   the scan above at every instruction, run these a while
+		   alone */
+		for (k = 0; k < cnt; k++)
+		    run_lane(l, l->idx[k], max_steps, BURST);
+		continue;
+	    }
+	    for (k = 0; k < cnt; k++)
+		l->mask[l->idx[k]] = -1;
+	}
+
+	together = step_group(l, target, cnt) && cnt == nact &&
+	    ++top < max_steps;
+	if (together)
+	    target = l->pc[l->idx[0]];
+	else
+	    for (k = 0; k < cnt; k++)
+		l->mask[l->idx[k]] = 0;
+    }
+}
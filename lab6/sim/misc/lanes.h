@@ -0,0 +1,57 @@
+/*
+ * lanes.h - Many copies of one Y86-64 program run side by side
+ *
+ * Each lane is an independent ISA-level machine with its own PC,
+ * registers, condition codes, status and memory, and all of them
+ * start from the same program image.  The state is kept as a structure
+ * of arrays, one entry per lane, and the lanes are stepped together:
+ * each step takes the lanes at the lowest PC, decodes the instruction
+ * there once and applies it to all of them.  Register-only
+ * instructions run as straight loops over the lanes that the compiler
+ * can vectorize; memory instructions, and groups too small to be worth
+ * it, are done lane by lane.  The result is the same as running
+ * step_state on each lane in turn.
+ */
+
+#ifndef LANES_H
+#define LANES_H
+
+typedef struct {
+    int n;             /* Number of lanes */
+    word_t *pc;        /* PC of each lane */
+    word_t *reg;       /* Registers: LANE_REG(l, r, i) for lane i */
+    word_t *cc;        /* Condition codes of each lane */
+    byte_t *stat;      /* Status of each lane */
+    word_t *steps;     /* Instructions executed by each lane, as by yis */
+    mem_t *mem;        /* Memory of each lane */
+    /* Private to lanes.c */
+    int npad;          /* n rounded up to a whole number of vectors */
+    mem_t image;       /* Program the lanes started from */
+    byte_t *code;      /* Bytes of image decoded as instructions */
+    byte_t *written;   /* Bytes some lane has changed */
+    byte_t *own;       /* Lanes that fetch from their own memory */
+    word_t *mask;      /* All ones for the lanes in the current group */
+    int *idx;          /* The same lanes, as a list */
+    int *act;          /* Lanes still running */
+} lanes_rec, *lanes_t;
+
+/* Register r of lane i.  Row REG_NONE reads as zero */
+#define LANE_REG(l, r, i) ((l)->reg[(r)*(l)->npad + (i)])
+
+/*
+ * Create n lanes, each with a copy of image as its memory, zero
+ * registers, PC 0, status AOK and the default condition codes.
+ */
+lanes_t lanes_init(int n, mem_t image);
+void lanes_free(lanes_t l);
+
+/* Replace the memory of lane i with m, which has the size of the image */
+void lanes_set_mem(lanes_t l, int i, mem_t m);
+
+/*
+ * Step every lane until it stops with a status other than AOK or has
+ * executed max_steps instructions
+ */
+void lanes_run(lanes_t l, word_t max_steps);
+
+#endif /* LANES_H */
@@ -0,0 +1,353 @@
+/*
+ * memasm.c - Y86-64 assembler that works directly on simulator memory
+ *
+ * This follows yas closely: each line is broken into tokens and then
+ * processed in two passes, the first to collect label addresses and the
+ * second to generate code using the instruction table in isa.c.  All
+ * state lives in an asm_rec, so several threads can assemble at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "isa.h"
+#include "memasm.h"
+
+#define TOK_PER_LINE 12
+#define NAMELEN 64
+#define STAB 1000
+
+/* Token types */
+typedef enum { TOK_IDENT, TOK_NUM, TOK_REG, TOK_INSTR, TOK_PUNCT, TOK_ERR }
+  token_t;
+
+/* Token representation */
+typedef struct {
+    char sval[NAMELEN]; /* String    */
+    word_t ival;        /* Integer   */
+    char cval;          /* Character */
+    token_t type;       /* Type      */
+} token_rec, *token_ptr;
+
+typedef struct {
+    char name[NAMELEN];
+    word_t pos;
+} symbol_rec;
+
+/* State of one assembly */
+typedef struct {
+    mem_t m;
+    int pass;         /* Am I in pass 1 or 2? */
+    int lineno;       /* What line number am I processing? */
+    word_t bytepos;   /* What byte address is the current instruction */
+    int bytes;        /* How many bytes have been generated? */
+    bool_t hit_error; /* Have I hit any errors? */
+    char *errbuf;
+    int errlen;
+    /* Information about current input line */
+    token_rec tokens[TOK_PER_LINE];
+    int tcount;       /* How many tokens are there in this line? */
+    int tpos;         /* What token am I currently processing */
+    /* Byte encoding of current instruction */
+    byte_t code[10];
+    symbol_rec *symbols;
+    int symbol_cnt;
+} asm_rec, *asm_ptr;
+
+static void fail(asm_ptr a, char *message)
+{
+    if (!a->hit_error && a->errbuf)
+	snprintf(a->errbuf, a->errlen, "Error on line %d: %s",
+		 a->lineno, message);
+    a->hit_error = TRUE;
+}
+
+static void add_symbol(asm_ptr a, char *name, word_t pos)
+{
+    if (a->symbol_cnt >= STAB) {
+	fail(a, "Too many labels");
+	return;
+    }
+    strcpy(a->symbols[a->symbol_cnt].name, name);
+    a->symbols[a->symbol_cnt].pos = pos;
+    a->symbol_cnt++;
+}
+
+static word_t find_symbol(asm_ptr a, char *name)
+{
+    int i;
+    for (i = 0; i < a->symbol_cnt; i++)
+	if (strcmp(name, a->symbols[i].name) == 0)
+	    return a->symbols[i].pos;
+    fail(a, "Can't find label");
+    return -1;
+}
+
+/* Break line into tokens, the same ones yas-grammar.lex produces */
+static void tokenize(asm_ptr a, char *s)
+{
+    a->tcount = 0;
+    a->tpos = 0;
+    while (*s && !a->hit_error) {
+	token_ptr t = &a->tokens[a->tcount];
+	int len = 0;
+	if (isspace((int)*s) || *s == '$') {
+	    s++;
+	    continue;
+	}
+	/* Rest of line is a comment */
+	if (*s == '#' || (*s == '/' && (s[1] == '/' || s[1] == '*')))
+	    break;
+	if (a->tcount >= TOK_PER_LINE-1) {
+	    fail(a, "Line too long");
+	    break;
+	}
+	if (*s == '%') {
+	    while (isalnum((int)s[len+1]))
+		len++;
+	    len++;
+	} else if (*s == '.' || isalpha((int)*s)) {
+	    while (isalnum((int)s[len+1]) || s[len+1] == '_')
+		len++;
+	    len++;
+	} else if (isdigit((int)*s) || (*s == '-' && isdigit((int)s[1]))) {
+	    char *end;
+	    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+		t->ival = (word_t) strtoull(s, &end, 16);
+	    else
+		t->ival = strtoll(s, &end, 10);
+	    t->type = TOK_NUM;
+	    a->tcount++;
+	    s = end;
+	    continue;
+	} else if (strchr("():,", *s)) {
+	    t->type = TOK_PUNCT;
+	    t->cval = *s++;
+	    a->tcount++;
+	    continue;
+	} else {
+	    fail(a, "Invalid line");
+	    break;
+	}
+	if (len >= NAMELEN) {
+	    fail(a, "Name too long");
+	    break;
+	}
+	strncpy(t->sval, s, len);
+	t->sval[len] = '\0';
+	s += len;
+	if (t->sval[0] == '%') {
+	    if (find_register(t->sval) == REG_ERR) {
+		fail(a, "Invalid register");
+		break;
+	    }
+	    t->type = TOK_REG;
+	} else if (t->sval[0] == '.' ||
+		   (find_instr(t->sval) && strcmp(t->sval, "pop2") != 0)) {
+	    t->type = TOK_INSTR;
+	} else {
+	    t->type = TOK_IDENT;
+	}
+	a->tcount++;
+    }
+    /* Mark end of line */
+    a->tokens[a->tcount].type = TOK_ERR;
+}
+
+/* Parse register into high or low 4 bits of code[codepos] */
+static void get_reg(asm_ptr a, int codepos, int hi)
+{
+    token_ptr t = &a->tokens[a->tpos];
+    int rval;
+    if (t->type != TOK_REG) {
+	fail(a, "Expecting Register ID");
+	return;
+    }
+    rval = find_register(t->sval);
+    if (hi)
+	a->code[codepos] = (a->code[codepos] & 0x0F) | (rval << 4);
+    else
+	a->code[codepos] = (a->code[codepos] & 0xF0) | rval;
+    a->tpos++;
+}
+
+/* Get numeric value of given number of bytes */
+static void get_num(asm_ptr a, int codepos, int bytes)
+{
+    token_ptr t = &a->tokens[a->tpos];
+    word_t val;
+    int i;
+    if (t->type == TOK_NUM) {
+	val = t->ival;
+    } else if (t->type == TOK_IDENT) {
+	val = find_symbol(a, t->sval);
+    } else {
+	fail(a, "Number Expected");
+	return;
+    }
+    for (i = 0; i < bytes; i++)
+	a->code[codepos+i] = (val >> (i * 8)) & 0xFF;
+    a->tpos++;
+}
+
+/* Get memory reference of form Num(Reg), (Reg), Num, Ident or Ident(Reg) */
+static void get_mem(asm_ptr a, int codepos)
+{
+    token_ptr t = &a->tokens[a->tpos];
+    int rval = REG_NONE;
+    word_t val = 0;
+    int i;
+    /* Deal with optional displacement */
+    if (t->type == TOK_NUM) {
+	val = t->ival;
+	t = &a->tokens[++a->tpos];
+    } else if (t->type == TOK_IDENT) {
+	val = find_symbol(a, t->sval);
+	t = &a->tokens[++a->tpos];
+    }
+    /* Check for optional register */
+    if (t->type == TOK_PUNCT && t->cval == '(') {
+	t = &a->tokens[++a->tpos];
+	if (t->type != TOK_REG) {
+	    fail(a, "Expecting Register Id");
+	    return;
+	}
+	rval = find_register(t->sval);
+	t = &a->tokens[++a->tpos];
+	if (t->type != TOK_PUNCT || t->cval != ')') {
+	    fail(a, "Expecting ')'");
+	    return;
+	}
+	a->tpos++;
+    }
+    a->code[codepos] = (a->code[codepos] & 0xF0) | (rval & 0xF);
+    for (i = 0; i < 8; i++)
+	a->code[codepos+1+i] = (val >> (i*8)) & 0xFF;
+}
+
+static void get_arg(asm_ptr a, arg_t arg, int pos, int hi)
+{
+    switch(arg) {
+    case R_ARG:
+	get_reg(a, pos, hi);
+	break;
+    case M_ARG:
+	get_mem(a, pos);
+	break;
+    case I_ARG:
+	get_num(a, pos, hi);
+	break;
+    case NO_ARG:
+    default:
+	break;
+    }
+}
+
+static void finish_line(asm_ptr a)
+{
+    token_ptr t = a->tokens;
+    instr_ptr instr;
+    int i;
+
+    if (a->tcount == 0 || a->hit_error)
+	return;
+    /* See if this is a labeled line */
+    if (t[0].type == TOK_IDENT) {
+	if (a->tcount < 2 || t[1].type != TOK_PUNCT || t[1].cval != ':') {
+	    fail(a, "Missing Colon");
+	    return;
+	}
+	if (a->pass == 1)
+	    add_symbol(a, t[0].sval, a->bytepos);
+	a->tpos += 2;
+	if (a->tcount == 2)
+	    return;
+    }
+    t = &a->tokens[a->tpos];
+    if (t->type != TOK_INSTR) {
+	fail(a, "Bad Instruction");
+	return;
+    }
+    if (strcmp(t->sval, ".pos") == 0) {
+	if (a->tpos+1 >= a->tcount || t[1].type != TOK_NUM) {
+	    fail(a, "Invalid Address");
+	    return;
+	}
+	a->bytepos = t[1].ival;
+	return;
+    }
+    if (strcmp(t->sval, ".align") == 0) {
+	word_t al;
+	if (a->tpos+1 >= a->tcount || t[1].type != TOK_NUM ||
+	    (al = t[1].ival) <= 0) {
+	    fail(a, "Invalid Alignment");
+	    return;
+	}
+	a->bytepos = ((a->bytepos+al-1)/al)*al;
+	return;
+    }
+    instr = find_instr(t->sval);
+    if (instr == NULL) {
+	fail(a, "Invalid Instruction");
+	return;
+    }
+    a->tpos++;
+
+    /* Pass 1 only needs the instruction size */
+    if (a->pass == 1) {
+	a->bytepos += instr->bytes;
+	return;
+    }
+
+    a->code[0] = instr->code;
+    a->code[1] = HPACK(REG_NONE, REG_NONE);
+    get_arg(a, instr->arg1, instr->arg1pos, instr->arg1hi);
+    if (instr->arg2 != NO_ARG) {
+	t = &a->tokens[a->tpos];
+	if (a->tpos >= a->tcount || t->type != TOK_PUNCT || t->cval != ',') {
+	    fail(a, "Expecting Comma");
+	    return;
+	}
+	a->tpos++;
+	get_arg(a, instr->arg2, instr->arg2pos, instr->arg2hi);
+    }
+    for (i = 0; i < instr->bytes && !a->hit_error; i++) {
+	if (!set_byte_val(a->m, a->bytepos+i, a->code[i]))
+	    fail(a, "Code address limit exceeded");
+    }
+    a->bytepos += instr->bytes;
+    a->bytes += instr->bytes;
+}
+
+int asm_mem(mem_t m, char *src, char *errbuf, int errlen)
+{
+    asm_rec a;
+    char *line;
+    char *start;
+    int len;
+
+    memset(&a, 0, sizeof(a));
+    a.m = m;
+    a.errbuf = errbuf;
+    a.errlen = errlen;
+    a.symbols = (symbol_rec *) malloc(STAB * sizeof(symbol_rec));
+    line = (char *) malloc(strlen(src)+1);
+    for (a.pass = 1; a.pass <= 2 && !a.hit_error; a.pass++) {
+	a.bytepos = 0;
+	a.lineno = 1;
+	for (start = src; *start && !a.hit_error; a.lineno++) {
+	    len = strcspn(start, "\n");
+	    strncpy(line, start, len);
+	    line[len] = '\0';
+	    tokenize(&a, line);
+	    finish_line(&a);
+	    start += len;
+	    if (*start)
+		start++;
+	}
+    }
+    free(line);
+    free(a.symbols);
+    return a.hit_error ? -1 : a.bytes;
+}
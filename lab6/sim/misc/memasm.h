@@ -0,0 +1,20 @@
+/*
+ * memasm.h - Y86-64 assembler that works directly on simulator memory
+ *
+ * Accepts the same source language as yas, but instead of writing a
+ * .yo listing to be read back with load_mem, it places the generated
+ * bytes straight into a memory image.  Used by the simulators to run
+ * generated test programs without going through the file system.
+ */
+
+#ifndef MEMASM_H
+#define MEMASM_H
+
+/*
+ * Assemble the program in src into memory m.  Return the number of
+ * bytes generated, or -1 on error, in which case a message naming the
+ * offending line is left in errbuf (if errbuf is nonNULL).
+ */
+int asm_mem(mem_t m, char *src, char *errbuf, int errlen);
+
+#endif /* MEMASM_H */
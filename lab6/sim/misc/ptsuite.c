@@ -0,0 +1,624 @@
+/*
+ * ptsuite.c - Native version of the regression tests in ../ptest
+ *
+ * The generators below produce exactly the programs (and test names)
+ * of the corresponding Perl scripts, so a failing test can be studied
+ * the same way: its source is left behind as <test>.ys.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "isa.h"
+#include "memasm.h"
+#include "ptsuite.h"
+
+static char *suite_name[PT_NSUITE] =
+    {"optest", "jtest", "ctest", "htest", "etest"};
+
+/* One generated test program */
+typedef struct {
+    char name[32];
+    ptsuite_t suite;
+    char *src;          /* Y86-64 source */
+    check_rec result;
+} ptest_rec, *ptest_ptr;
+
+/* All tests of a run */
+typedef struct {
+    ptest_ptr tests;
+    int count;
+    int size;
+    char *src;          /* Its source, built up by emit() */
+    int len;
+    int srcsize;
+} tlist_rec, *tlist_ptr;
+
+/* Shared state of the worker pool */
+typedef struct {
+    tlist_ptr tl;
+    int next;           /* Next test to be run */
+    word_t max_instr;
+    pthread_mutex_t lock;
+} pool_rec, *pool_ptr;
+
+/****************** Test program generation ******************/
+
+/* Append formatted text to the source of the test being generated */
+static void emit(tlist_ptr tl, const char *format, ...)
+{
+    va_list ap;
+    int n;
+    for (;;) {
+	va_start(ap, format);
+	n = vsnprintf(tl->src + tl->len, tl->srcsize - tl->len, format, ap);
+	va_end(ap);
+	if (tl->len + n < tl->srcsize)
+	    break;
+	tl->srcsize = 2 * (tl->len + n + 1);
+	tl->src = realloc(tl->src, tl->srcsize);
+    }
+    tl->len += n;
+}
+
+/* Start a new test in suite named by format */
+static void start_test(tlist_ptr tl, ptsuite_t suite, const char *format, ...)
+{
+    ptest_ptr t;
+    va_list ap;
+    if (tl->count == tl->size) {
+	tl->size = tl->size ? 2 * tl->size : 256;
+	tl->tests = realloc(tl->tests, tl->size * sizeof(ptest_rec));
+    }
+    t = &tl->tests[tl->count];
+    va_start(ap, format);
+    vsnprintf(t->name, sizeof(t->name), format, ap);
+    va_end(ap);
+    t->suite = suite;
+    t->src = NULL;
+    tl->srcsize = 1024;
+    tl->src = malloc(tl->srcsize);
+    tl->src[0] = '\0';
+    tl->len = 0;
+}
+
+static void end_test(tlist_ptr tl)
+{
+    tl->tests[tl->count++].src = tl->src;
+    tl->src = NULL;
+}
+
+/* optest.pl: Test single instructions in pipeline */
+static void gen_optest(tlist_ptr tl, bool_t test_iaddq)
+{
+    static int vals[] = {0x100, 0x020, 0x004};
+    static char *instr[] = {"rrmovq", "addq", "subq", "andq", "xorq"};
+    static char *regs[] = {"rdx", "rbx", "rsp"};
+    static char *sinstr[] = {"pushq", "popq"};
+    static char *sregs[] = {"rdx", "rsp"};
+    int i, a, b;
+
+    for (i = 0; i < 5; i++)
+	for (a = 0; a < 3; a++)
+	    for (b = 0; b < 3; b++) {
+		start_test(tl, PT_OPTEST, "op-%s-%s-%s",
+			   instr[i], regs[a], regs[b]);
+		emit(tl, "irmovq $%d, %%%s\n", vals[0], regs[a]);
+		emit(tl, "irmovq $%d, %%%s\n", vals[1], regs[b]);
+		emit(tl, "nop\nnop\nnop\n");
+		emit(tl, "%s %%%s,%%%s\n", instr[i], regs[a], regs[b]);
+		emit(tl, "nop\nnop\nhalt\n");
+		end_test(tl);
+	    }
+
+    if (test_iaddq) {
+	for (a = 0; a < 3; a++)
+	    for (i = 0; i < 3; i++) {
+		start_test(tl, PT_OPTEST, "op-iaddq-%d-%s", vals[i], regs[a]);
+		emit(tl, "irmovq $%d, %%%s\n", vals[i], regs[a]);
+		emit(tl, "nop\nnop\nnop\n");
+		emit(tl, "iaddq $-32, %%%s\n", regs[a]);
+		emit(tl, "nop\nnop\nhalt\n");
+		end_test(tl);
+	    }
+    }
+
+    for (i = 0; i < 2; i++)
+	for (a = 0; a < 2; a++) {
+	    start_test(tl, PT_OPTEST, "op-%s-%s", sinstr[i], sregs[a]);
+	    emit(tl, "irmovq $0x200,%%rsp\n");
+	    emit(tl, "irmovq $%d, %%rax\n", vals[1]);
+	    emit(tl, "nop\nnop\nnop\n");
+	    emit(tl, "rmmovq %%rax, 0(%%rsp)\n");
+	    emit(tl, "irmovq $%d, %%rax\n", vals[2]);
+	    emit(tl, "nop\nnop\nnop\n");
+	    emit(tl, "rmmovq %%rax, -4(%%rsp)\n");
+	    emit(tl, "irmovq $%d, %%rdx\n", vals[0]);
+	    emit(tl, "nop\nnop\nnop\n");
+	    emit(tl, "%s %%%s\n", sinstr[i], sregs[a]);
+	    emit(tl, "nop\nnop\nhalt\n");
+	    end_test(tl);
+	}
+}
+
+/* jtest.pl: Test jump instructions */
+static void gen_jtest(tlist_ptr tl, bool_t test_iaddq)
+{
+    static int vals[] = {32, 64};
+    static char *instr[] = {"jmp", "jle", "jl", "je", "jne", "jge", "jg",
+			    "call"};
+    /* Common start of each test, and the blocks of code that follow
+       a taken and a not-taken jump */
+    static char *init =
+	"irmovq stack, %rsp\n"
+	"irmovq $1, %rsi\n"
+	"irmovq $2, %rdi\n"
+	"irmovq $4, %rbp\n";
+    static char *fallthru =
+	"addq %rsi,%rax\n"
+	"addq %rdi,%rax\n"
+	"addq %rbp,%rax\n"
+	"halt\n";
+    static char *target =
+	"target:\n"
+	"addq %rsi,%rdx\n"
+	"addq %rdi,%rdx\n"
+	"addq %rbp,%rdx\n"
+	"nop\nnop\nhalt\n";
+    static char *stack = ".pos 0x100\nstack:\n";
+    int i, a, b;
+
+    /* Forward tests */
+    for (i = 0; i < 8; i++)
+	for (a = 0; a < 2; a++)
+	    for (b = 0; b < 2; b++) {
+		start_test(tl, PT_JTEST, "jf-%s-%d-%d",
+			   instr[i], vals[a], vals[b]);
+		emit(tl, "%sirmovq $%d, %%rax\nirmovq $%d, %%rdx\n",
+		     init, vals[a], vals[b]);
+		emit(tl, "subq %%rdx,%%rax\n%s target\n", instr[i]);
+		emit(tl, "%s%s%s", fallthru, target, stack);
+		end_test(tl);
+	    }
+
+    /* Backward tests */
+    for (i = 0; i < 8; i++)
+	for (a = 0; a < 2; a++)
+	    for (b = 0; b < 2; b++) {
+		start_test(tl, PT_JTEST, "jb-%s-%d-%d",
+			   instr[i], vals[a], vals[b]);
+		emit(tl, "%sirmovq $%d, %%rax\nirmovq $%d, %%rdx\n",
+		     init, vals[a], vals[b]);
+		emit(tl, "jmp skip\nhalt\n%s", target);
+		emit(tl, "skip:\nsubq %%rdx,%%rax\n%s target\n", instr[i]);
+		emit(tl, "%s%s", fallthru, stack);
+		end_test(tl);
+	    }
+
+    /* Forward tests using iaddq */
+    if (test_iaddq) {
+	for (i = 0; i < 8; i++)
+	    for (a = 0; a < 2; a++)
+		for (b = 0; b < 2; b++) {
+		    start_test(tl, PT_JTEST, "ji-%s-%d-%d",
+			       instr[i], vals[a], vals[b]);
+		    emit(tl, "%sirmovq $%d, %%rax\n", init, vals[a]);
+		    emit(tl, "iaddq $-%d,%%rax\n%s target\n",
+			 vals[b], instr[i]);
+		    emit(tl, "%s%s%s", fallthru, target, stack);
+		    end_test(tl);
+		}
+    }
+}
+
+/* ctest.pl: Test for pipeline hazard combinations.  Each template
+   gives four instruction slots separated by '|' */
+static char *ctest_templates[] = {
+    "||jne target\n\thalt\ntarget:|",      /* M */
+    "|||ret",                              /* R */
+    "||mrmovq (%rax),%rsp|ret",            /* G1a */
+    "|mrmovq (%rax),%rsp||ret",            /* G1b */
+    "mrmovq (%rax),%rsp|||ret",            /* G1c */
+    "||irmovq $3,%rax|rrmovq %rax,%rdx",   /* G2a */
+    "|irmovq $3,%rax||rrmovq %rax,%rdx",   /* G2b */
+    "irmovq $3,%rax|||rrmovq %rax,%rdx",   /* G2c */
+};
+
+/* Split template into its four slots */
+static void split_template(char *tmpl, char slot[4][64])
+{
+    int i, len;
+    for (i = 0; i < 4; i++) {
+	len = strcspn(tmpl, "|");
+	strncpy(slot[i], tmpl, len);
+	slot[i][len] = '\0';
+	tmpl += len;
+	if (*tmpl)
+	    tmpl++;
+    }
+}
+
+static void gen_ctest(tlist_ptr tl)
+{
+    int n = sizeof(ctest_templates) / sizeof(char *);
+    int testcnt = 0;
+    int i1, i2, i;
+
+    for (i1 = 0; i1 < n; i1++)
+	for (i2 = i1+1; i2 < n; i2++) {
+	    char s1[4][64], s2[4][64];
+	    char *test[4];
+	    bool_t ok = TRUE;
+	    split_template(ctest_templates[i1], s1);
+	    split_template(ctest_templates[i2], s2);
+	    /* Combine the two, provided they don't need the same slot */
+	    for (i = 0; i < 4; i++) {
+		if (!s1[i][0])
+		    test[i] = s2[i][0] ? s2[i] : "nop";
+		else if (!s2[i][0] || strcmp(s1[i], s2[i]) == 0)
+		    test[i] = s1[i];
+		else
+		    ok = FALSE;
+	    }
+	    if (!ok)
+		continue;
+	    start_test(tl, PT_CTEST, "c-%d", testcnt++);
+	    emit(tl,
+		 "irmovq Stack1,%%rsp\n"
+		 "irmovq rtnpt,%%rdx\n"
+		 "rmmovq %%rdx,(%%rsp)   # Put return point on top of Stack1\n"
+		 "irmovq Stack2,%%rax\n"
+		 "rmmovq %%rsp,(%%rax)   # Put Stack1 on top of Stack2\n"
+		 "irmovq Stack3,%%rsp   # Point to Stack3\n"
+		 "pushq %%rdx\n"
+		 "rrmovq %%rsp,%%rbp\n"
+		 "irmovq $3,%%rdx\n"
+		 "xorq %%rbx,%%rbx\n");
+	    for (i = 0; i < 4; i++)
+		emit(tl, "%s\n", test[i]);
+	    emit(tl,
+		 "irmovq $3,%%rbx       # Not reached when sequence ends with ret\n"
+		 "halt\n"
+		 "rtnpt:  irmovq $5,%%rsi       # Return point\n"
+		 "halt\n"
+		 ".pos 0x60\nStack1:\n"
+		 ".pos 0x68\nStack2:\n"
+		 ".pos 0x70\nStack3:\n"
+		 "halt\n");
+	    end_test(tl);
+	}
+}
+
+/* htest.pl: Test for pipeline hazards.  The digit before the colon
+   tells which register (%rax, %rbp or %rsp) is written or read */
+static char *htest_dest[] = {
+    "1:rrmovq %rcx,%rax",
+    "1:irmovq $0x101,%rax",
+    "1:mrmovq 0(%rbp),%rax",
+    "1:addq   %rax,%rax",
+    "1:popq   %rax",
+    "1:cmovne %rcx,%rax",
+    "1:cmove  %rcx,%rax",
+    "2:rrmovq %rax,%rbp",
+    "2:irmovq $0x100,%rbp",
+    "2:mrmovq 4(%rbp),%rbp",
+    "2:addq   %rax,%rbp",
+    "2:popq   %rbp",
+    "2:cmovne %rax,%rbp",
+    "2:cmove  %rax,%rbp",
+    "3:rrmovq %rbp,%rsp",
+    "3:irmovq $0x104,%rsp",
+    "3:mrmovq 4(%rbp),%rsp",
+    "3:addq   %rax,%rsp",
+    "3:popq   %rbp",
+    "3:pushq  %rax",
+    "3:pushq  %rsp",
+    "3:popq   %rsp",
+    "1:cmovne %rbp,%rsp",
+    "1:cmove  %rbp,%rsp",
+    /* Only with iaddq */
+    "1:iaddq $0x201,%rax",
+    "2:iaddq $0x4,%rbp",
+    "3:iaddq $0x4,%rsp",
+};
+
+static char *htest_src[] = {
+    "1:rrmovq %rax,%rbp",
+    "1:rmmovq %rax,0(%rbp)",
+    "1:rmmovq %rbp,0(%rax)",
+    "1:mrmovq 4(%rax),%rbp",
+    "1:addq   %rax,%rbp",
+    "1:addq   %rbp,%rax",
+    "1:addq   %rax,%rax",
+    "1:pushq  %rax",
+    "2:rrmovq %rbp,%rbp",
+    "2:rmmovq %rbp,4(%rbp)",
+    "2:rmmovq %rax,0(%rbp)",
+    "2:mrmovq 8(%rbp),%rax",
+    "2:addq   %rbp,%rax",
+    "2:addq   %rax,%rbp",
+    "2:addq   %rbp,%rbp",
+    "2:pushq  %rbp",
+    "3:rrmovq %rsp,%rbp",
+    "3:rmmovq %rsp,4(%rbp)",
+    "3:rmmovq %rax,-4(%rsp)",
+    "3:mrmovq 4(%rsp),%rax",
+    "3:addq   %rsp,%rax",
+    "3:addq   %rax,%rsp",
+    "3:addq   %rsp,%rsp",
+    "3:pushq  %rsp",
+    "3:ret",
+    /* Only with iaddq */
+    "1:iaddq $0x301,%rax",
+    "2:iaddq $0x8,%rbp",
+    "3:iaddq $0x8,%rsp",
+};
+
+#define HTEST_NIADDQ 3
+
+/* Code following the instructions under test: tables of return
+   addresses at 0x08, 0x100 and 0x180, each pointing to halts */
+static void htest_data(tlist_ptr tl)
+{
+    static int base[] = {0x08, 0x100, 0x180};
+    static int nhalt[] = {14, 8, 8};
+    int t, i;
+    for (t = 0; t < 3; t++) {
+	emit(tl, ".pos 0x%x\n", base[t]);
+	for (i = 1; i <= 6; i++)
+	    emit(tl, ".quad pos%d%d\n", t, i);
+	for (i = 1; i <= 6; i++)
+	    emit(tl, "pos%d%d:\nhalt\n", t, i);
+	for (i = 0; i < nhalt[t]; i++)
+	    emit(tl, "halt\n");
+    }
+}
+
+static void htest_prog(tlist_ptr tl, char *i1, char *i2, char *i3, char *i4)
+{
+    emit(tl,
+	 "irmovq $0xf5,%%rax\n"
+	 "irmovq $0,%%rbp\n"
+	 "rmmovq %%rax,0xe0(%%rbp)\n"
+	 "irmovq $0xf7,%%rax\n"
+	 "rmmovq %%rax,0xe8(%%rbp)\n"
+	 "irmovq $0xfb,%%rax\n"
+	 "rmmovq %%rax,0xf0(%%rbp)\n"
+	 "irmovq $0xff,%%rax\n"
+	 "rmmovq %%rax,0xf8(%%rbp)\n"
+	 "irmovq $0x100,%%rbp\n"
+	 "irmovq $0x10c,%%rsp\n"
+	 "xorq %%rax,%%rax      # Set Z condition code\n"
+	 "irmovq $0x80,%%rax\n");
+    emit(tl, "%s\n%s\n%s\n%s\n", i1, i2, i3, i4);
+    emit(tl, "rrmovq %%rsp,%%rbp\nhalt\n");
+    htest_data(tl);
+}
+
+static void gen_htest(tlist_ptr tl, bool_t test_iaddq)
+{
+    int ndest = sizeof(htest_dest) / sizeof(char *);
+    int nsrc = sizeof(htest_src) / sizeof(char *);
+    int di, si;
+
+    if (!test_iaddq) {
+	ndest -= HTEST_NIADDQ;
+	nsrc -= HTEST_NIADDQ;
+    }
+    for (di = 0; di < ndest; di++)
+	for (si = 0; si < nsrc; si++) {
+	    char *d = htest_dest[di] + 2;
+	    char *s = htest_src[si] + 2;
+	    if (htest_dest[di][0] != htest_src[si][0])
+		continue;
+	    /* Two instructions with 2 nops between them */
+	    start_test(tl, PT_HTEST, "hnn-%d-%d", di, si);
+	    htest_prog(tl, d, "nop", "nop", s);
+	    end_test(tl);
+	    /* Two instructions with nop between them */
+	    start_test(tl, PT_HTEST, "hn-%d-%d", di, si);
+	    htest_prog(tl, d, "nop", "", s);
+	    end_test(tl);
+	    /* Two instructions in succession */
+	    start_test(tl, PT_HTEST, "h-%d-%d", di, si);
+	    htest_prog(tl, d, "", "", s);
+	    end_test(tl);
+	}
+}
+
+/* etest.pl: Test for exception followed by state-setting instruction */
+static void gen_etest(tlist_ptr tl)
+{
+    static char *stateset[] = {
+	"andq %rcx,%rcx",
+	"rmmovq %rcx,(%rax)"
+    };
+    static char *exceptset[] = {
+	"halt",
+	".byte 0xFF",
+	"rmmovq %rax,0xF0000000(%rax)"
+    };
+    int ei, si, nop;
+
+    for (ei = 0; ei < 3; ei++)
+	for (si = 0; si < 2; si++)
+	    for (nop = 1; nop >= 0; nop--) {
+		start_test(tl, PT_ETEST, nop ? "en-%d-%d" : "e-%d-%d", ei, si);
+		emit(tl,
+		     "irmovq $-1,%%rcx    # Create nonzero value\n"
+		     "irmovq $0x100,%%rax\n"
+		     "xorq %%rdx,%%rdx      # Set Z condition code\n");
+		emit(tl, "%s\n%s\n%s\n", exceptset[ei], nop ? "nop" : "",
+		     stateset[si]);
+		emit(tl, "nop\nnop\nhalt\n");
+		end_test(tl);
+	    }
+}
+
+/****************** Checking ******************/
+
+bool_t check_state(state_ptr s, byte_t istat, mem_t r, mem_t m, byte_t stat,
+		   bool_t check_cc, cc_t cc, check_ptr c)
+{
+    int id;
+    word_t pos, val, ival;
+
+    if (stat != istat) {
+	snprintf(c->what, sizeof(c->what), "Status %s, ISA has %s",
+		 stat_name(stat), stat_name(istat));
+	return FALSE;
+    }
+    for (id = REG_RAX; id < REG_NONE; id++) {
+	val = get_reg_val(r, id);
+	ival = get_reg_val(s->r, id);
+	if (val != ival) {
+	    snprintf(c->what, sizeof(c->what),
+		     "Register %s = 0x%llx, ISA has 0x%llx",
+		     reg_name(id), val, ival);
+	    return FALSE;
+	}
+    }
+    /* Equal contents have equal hashes; only search when they differ */
+    if (m->hash != s->m->hash && memcmp(m->contents, s->m->contents, m->len)) {
+	for (pos = 0; m->contents[pos] == s->m->contents[pos]; pos++)
+	    ;
+	pos &= ~0x7;
+	get_word_val(m, pos, &val);
+	get_word_val(s->m, pos, &ival);
+	snprintf(c->what, sizeof(c->what),
+		 "Memory 0x%.4llx = 0x%llx, ISA has 0x%llx", pos, val, ival);
+	return FALSE;
+    }
+    if (check_cc && cc != s->cc) {
+	snprintf(c->what, sizeof(c->what),
+		 "Condition codes %s, ISA has %s", cc_name(cc), cc_name(s->cc));
+	return FALSE;
+    }
+    return TRUE;
+}
+
+/****************** Running ******************/
+
+/* Take tests from the pool until there are none left */
+static void *ptest_worker(void *arg)
+{
+    pool_ptr pool = (pool_ptr) arg;
+    mem_t image = init_mem(MEM_SIZE);
+    ptest_ptr t;
+    int i;
+
+    sim_init();
+    for (;;) {
+	pthread_mutex_lock(&pool->lock);
+	i = pool->next++;
+	pthread_mutex_unlock(&pool->lock);
+	if (i >= pool->tl->count)
+	    break;
+	t = &pool->tl->tests[i];
+	clear_mem(image);
+	if (asm_mem(image, t->src, t->result.what,
+		    sizeof(t->result.what)) < 0) {
+	    t->result.ok = FALSE;
+	    t->result.cycle = t->result.instr = t->result.pc = 0;
+	    continue;
+	}
+	sim_check_prog(image, pool->max_instr, &t->result);
+    }
+    sim_free();
+    free_mem(image);
+    return NULL;
+}
+
+/* Leave source of failing test behind, as the Perl scripts do */
+static void save_test(ptest_ptr t)
+{
+    char fname[64];
+    FILE *f;
+    sprintf(fname, "%s.ys", t->name);
+    f = fopen(fname, "w");
+    if (!f) {
+	fprintf(stderr, "Can't write to %s\n", fname);
+	return;
+    }
+    fputs(t->src, f);
+    fclose(f);
+}
+
+int ptest_run(char *simname, bool_t test_iaddq, int nthreads,
+	      word_t max_instr, int verbosity)
+{
+    tlist_rec tl;
+    pool_rec pool;
+    pthread_t tid[nthreads];
+    struct timeval start, finish;
+    int tcount[PT_NSUITE], ecount[PT_NSUITE];
+    int i, s, errors = 0;
+
+    gettimeofday(&start, NULL);
+    memset(&tl, 0, sizeof(tl));
+    gen_optest(&tl, test_iaddq);
+    gen_jtest(&tl, test_iaddq);
+    gen_ctest(&tl);
+    gen_htest(&tl, test_iaddq);
+    gen_etest(&tl);
+
+    pool.tl = &tl;
+    pool.next = 0;
+    pool.max_instr = max_instr;
+    pthread_mutex_init(&pool.lock, NULL);
+    /* The calling thread is one of the workers */
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&tid[i], NULL, ptest_worker, &pool) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+    ptest_worker(&pool);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+    gettimeofday(&finish, NULL);
+
+    /* Report results in the order the tests were generated */
+    if (verbosity > 0)
+	printf("Simulating with %s\n", simname);
+    for (s = 0; s < PT_NSUITE; s++) {
+	tcount[s] = ecount[s] = 0;
+	if (verbosity > 0)
+	    printf("%s\n", suite_name[s]);
+	for (i = 0; i < tl.count; i++) {
+	    ptest_ptr t = &tl.tests[i];
+	    if (t->suite != s)
+		continue;
+	    tcount[s]++;
+	    if (t->result.ok)
+		continue;
+	    ecount[s]++;
+	    save_test(t);
+	    if (verbosity > 0)
+		printf("Test %s failed at cycle %lld, instruction %lld "
+		       "(PC 0x%llx): %s\n", t->name, t->result.cycle,
+		       t->result.instr, t->result.pc, t->result.what);
+	}
+	if (verbosity > 0) {
+	    if (ecount[s] == 0)
+		printf("  All %d ISA Checks Succeed\n", tcount[s]);
+	    else
+		printf("  %d/%d ISA Checks Failed\n", ecount[s], tcount[s]);
+	}
+	errors += ecount[s];
+    }
+    printf("%d/%d tests failed (%d threads, %.3f seconds)\n",
+	   errors, tl.count, nthreads,
+	   (finish.tv_sec - start.tv_sec) +
+	   (finish.tv_usec - start.tv_usec) / 1e6);
+
+    for (i = 0; i < tl.count; i++)
+	free(tl.tests[i].src);
+    free(tl.tests);
+    return errors;
+}
@@ -0,0 +1,56 @@
+/*
+ * ptsuite.h - Native version of the regression tests in ../ptest
+ *
+ * Generates the same test programs as optest.pl, jtest.pl, ctest.pl,
+ * htest.pl and etest.pl, assembles them in memory and runs them on a
+ * pool of threads.  Rather than comparing the final state with yis,
+ * each program is run in lockstep with the ISA simulator, so a failure
+ * is reported at the first instruction where the two disagree.
+ */
+
+#ifndef PTSUITE_H
+#define PTSUITE_H
+
+/* Test groups, named after the scripts that generate them */
+typedef enum { PT_OPTEST, PT_JTEST, PT_CTEST, PT_HTEST, PT_ETEST,
+	       PT_NSUITE } ptsuite_t;
+
+/* Outcome of running one program against the ISA simulator */
+typedef struct {
+    bool_t ok;
+    word_t cycle;     /* Cycle in which the diverging instruction completed */
+    word_t instr;     /* Number of instructions completed before it */
+    word_t pc;        /* Address of the diverging instruction */
+    byte_t stat;      /* Status of the simulator when it stopped */
+    char what[128];   /* What differed */
+} check_rec, *check_ptr;
+
+/*
+ * Supplied by the simulator under test.  sim_check_prog runs the
+ * program in image from address 0 for at most max_instr instructions,
+ * stepping the ISA simulator each time an instruction completes and
+ * comparing the two with check_state.
+ */
+void sim_init();
+void sim_free();
+void sim_check_prog(mem_t image, word_t max_instr, check_ptr c);
+
+/*
+ * Compare the state s and status istat of the ISA simulator with the
+ * register file r, memory m and status stat of the simulator, and the
+ * condition codes if check_cc is set.  On a mismatch, describe it in
+ * c->what and return FALSE.
+ */
+bool_t check_state(state_ptr s, byte_t istat, mem_t r, mem_t m, byte_t stat,
+		   bool_t check_cc, cc_t cc, check_ptr c);
+
+/*
+ * Generate and run all test groups (including iaddq tests if
+ * test_iaddq is set) on nthreads threads, printing a report to stdout.
+ * The source of each failing test is saved as <test>.ys in the current
+ * directory.  Return the number of failed tests.
+ */
+int ptest_run(char *simname, bool_t test_iaddq, int nthreads,
+	      word_t max_instr, int verbosity);
+
+#endif /* PTSUITE_H */
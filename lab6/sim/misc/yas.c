@@ -3,6 +3,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "yas.h"
 #include "isa.h"
@@ -15,6 +17,10 @@ int gui_mode = 0;
 
 FILE *outfile;
 
+/* Binary image (.ybo), written on request (-b) */
+int write_image = 0;
+FILE *imgfile = NULL;
+
 int verbose = 0;
 /* Generate initialized memory for Verilog? */
 int vcode = 0;
@@ -130,6 +136,43 @@ static void hexstuff(char *dest, word_t value, int len)
     }
 }
 
+/* Segment of the image being collected: consecutive bytes from segaddr.
+   A run longer than SEGMAX is written as several segments */
+#define SEGMAX (0x10000 + 16)
+static char segbuf[SEGMAX];
+static word_t segaddr = 0;
+static int seglen = 0;
+
+static void put_le_word(FILE *out, word_t val)
+{
+    int i;
+    for (i = 0; i < 8; i++) {
+	fputc(val & 0xFF, out);
+	val >>= 8;
+    }
+}
+
+static void flush_segment()
+{
+    if (seglen == 0)
+	return;
+    put_le_word(imgfile, segaddr);
+    put_le_word(imgfile, seglen);
+    fwrite(segbuf, 1, seglen, imgfile);
+    seglen = 0;
+}
+
+/* Add the code of the current line at pos to the image */
+static void image_code(word_t pos)
+{
+    if (seglen > 0 && (pos != segaddr + seglen || seglen + bcount > SEGMAX))
+	flush_segment();
+    if (seglen == 0)
+	segaddr = pos;
+    memcpy(segbuf + seglen, code, bcount);
+    seglen += bcount;
+}
+
 void print_code(FILE *out, int pos)
 {
     char outstring[33];
@@ -172,6 +215,8 @@ void print_code(FILE *out, int pos)
 	else
 	    strcpy(outstring, "                            | ");
     }
+    if (imgfile && tcount)
+	image_code(pos);
     if (vcode) {
       fprintf(out, "//%s%s\n", outstring, input_line);
       if (tcount) {
@@ -540,8 +585,9 @@ int yylex();
 
 static void usage(char *pname)
 {
-    printf("Usage: %s [-V[n]] file.ys\n", pname);
+    printf("Usage: %s [-V[n]] [-b] file.ys\n", pname);
     printf("   -V[n]  Generate memory initialization in Verilog format (n-way blocking)\n");
+    printf("   -b     Also write the binary image file.ybo\n");
     exit(0);
 }
 
@@ -550,12 +596,18 @@ int main(int argc, char *argv[])
     int rootlen;
     char infname[512];
     char outfname[512];
+    char imgfname[512];
+    struct stat yo;
     int nextarg = 1;
     if (argc < 2)
 	usage(argv[0]);
-    if (argv[nextarg][0] == '-') {
+    while (nextarg < argc && argv[nextarg][0] == '-') {
       char flag = argv[nextarg][1];
       switch (flag) {
+      case 'b':
+	write_image = 1;
+	nextarg++;
+	break;
       case 'V':
 	vcode = 1;
 	if (argv[nextarg][2]) {
@@ -571,6 +623,8 @@ int main(int argc, char *argv[])
 	usage(argv[0]);
       }
     }
+    if (nextarg >= argc || strlen(argv[nextarg]) < 3)
+	usage(argv[0]);
     rootlen = strlen(argv[nextarg])-3;
     if (strcmp(argv[nextarg]+rootlen, ".ys"))
 	usage(argv[0]);
@@ -597,6 +651,22 @@ int main(int argc, char *argv[])
 	fprintf(stderr, "Can't open output file '%s'\n", outfname);
 	exit(1);
       }
+      /* An image left from an earlier run no longer matches the .yo */
+      strncpy(imgfname, argv[nextarg], rootlen);
+      strcpy(imgfname+rootlen, ".ybo");
+      unlink(imgfname);
+      if (write_image) {
+	imgfile = fopen(imgfname, "wb");
+	if (!imgfile) {
+	  fprintf(stderr, "Can't open output file '%s'\n", imgfname);
+	  exit(1);
+	}
+	/* The stamp of the .yo is filled in once it is written */
+	fwrite(IMG_MAGIC, 1, IMG_MAGIC_LEN, imgfile);
+	put_le_word(imgfile, 0);
+	put_le_word(imgfile, 0);
+	put_le_word(imgfile, 0);
+      }
     }
 
     pass = 1;
@@ -620,6 +690,16 @@ int main(int argc, char *argv[])
     yylex();
     fclose(yyin);
     fclose(outfile);
+    if (imgfile) {
+	flush_segment();
+	if (stat(outfname, &yo) == 0) {
+	    fseek(imgfile, IMG_MAGIC_LEN, SEEK_SET);
+	    put_le_word(imgfile, yo.st_size);
+	    put_le_word(imgfile, yo.st_mtim.tv_sec);
+	    put_le_word(imgfile, yo.st_mtim.tv_nsec);
+	}
+	fclose(imgfile);
+    }
     return hit_error;
 }
 
@@ -28,7 +28,7 @@ int main(int argc, char *argv[])
 
     if (argc < 2 || argc > 3)
 	usage(argv[0]);
-    code_file = fopen(argv[1], "r");
+    code_file = open_object(argv[1]);
     if (!code_file) {
 	fprintf(stderr, "Can't open code file '%s'\n", argv[1]);
 	exit(1);
@@ -0,0 +1,346 @@
+/*
+ * bench.c - In-process CPE benchmark for ncopy kernels
+ *
+ * The driver built for each block length mirrors the one generated by
+ * gen-driver.pl: a main routine that sets up %rsp, %rdx, %rsi and %rdi
+ * and calls ncopy, followed by the source block, the guarded
+ * destination block and a small stack.  Since it contains the same
+ * instructions as the generated driver, the cycle counts are the same
+ * as those scraped by benchmark.pl.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "bench.h"
+#include "hazard.h"
+#include "lanes.h"
+
+/* Values placed around the destination block */
+#define PREVAL  0xbcdefa
+#define POSTVAL 0xdefabc
+/* Initial contents of the destination block */
+#define DESTVAL 0xcdefab
+
+/* Words of run time stack below label Stack */
+#define STACK_WORDS 16
+
+#define LINELEN 4096
+
+/* Work handed to each benchmark thread */
+typedef struct {
+    kernel_ptr k;
+    int maxlen;
+    int nthreads;
+    int id;
+    unsigned seed;
+    word_t max_instr;
+    bench_result_t *result;
+} bench_job_rec, *bench_job_ptr;
+
+/* One input of bench_check */
+typedef struct {
+    int n;          /* Block length */
+    int rval;       /* Expected count */
+    word_t src;     /* Addresses of the blocks */
+    word_t dest;
+} check_input_t;
+
+/* Address of a label in a line of a .yo file, or -1 if there is none */
+static word_t yo_label(char *buf, char *label)
+{
+    char *bar = strchr(buf, '|');
+    char *p;
+    int len = strlen(label);
+    if (!bar || strncmp(buf, "0x", 2) != 0)
+	return -1;
+    for (p = bar + 1; isspace((int)*p); p++)
+	;
+    if (strncmp(p, label, len) != 0 || p[len] != ':')
+	return -1;
+    return strtoll(buf, NULL, 16);
+}
+
+bool_t bench_load_kernel(kernel_ptr k, char *fname)
+{
+    char buf[LINELEN];
+    FILE *f = fopen(fname, "r");
+    word_t pos, addr;
+
+    if (!f) {
+	fprintf(stderr, "Couldn't open kernel file %s\n", fname);
+	return FALSE;
+    }
+    k->image = init_mem(MEM_SIZE);
+    if (load_mem(k->image, f, 1) == 0) {
+	fprintf(stderr, "No lines of code found in %s\n", fname);
+	fclose(f);
+	free_mem(k->image);
+	return FALSE;
+    }
+
+    /* Find the entry point and the end of the function, as check-len.pl */
+    k->entry = 0;
+    k->end = 0;
+    rewind(f);
+    while (fgets(buf, LINELEN, f)) {
+	if ((addr = yo_label(buf, "ncopy")) >= 0)
+	    k->entry = addr;
+	if ((addr = yo_label(buf, "End")) >= 0)
+	    k->end = addr;
+    }
+    fclose(f);
+
+    /* Anything assembled past End: also belongs to the kernel */
+    for (pos = k->image->len - 1; pos >= k->end; pos--) {
+	if (k->image->contents[pos]) {
+	    k->end = pos + 1;
+	    break;
+	}
+    }
+    return TRUE;
+}
+
+void bench_free_kernel(kernel_ptr k)
+{
+    free_mem(k->image);
+    k->image = NULL;
+}
+
+/* Encode instructions of the driver.  Return address of next instruction */
+static word_t put_irmovq(mem_t m, word_t pos, reg_id_t r, word_t val)
+{
+    set_byte_val(m, pos, HPACK(I_IRMOVQ, F_NONE));
+    set_byte_val(m, pos + 1, HPACK(REG_NONE, r));
+    set_word_val(m, pos + 2, val);
+    return pos + 10;
+}
+
+static word_t put_call(mem_t m, word_t pos, word_t dest)
+{
+    set_byte_val(m, pos, HPACK(I_CALL, F_NONE));
+    set_word_val(m, pos + 1, dest);
+    return pos + 9;
+}
+
+#define ALIGN(x, n) (((x) + (n) - 1) & ~((word_t) (n) - 1))
+
+/*
+ * Fill mem with the kernel and a driver for block length n.  Sets *mainp
+ * to the address of the driver, *destp and *srcp to the blocks and
+ * returns the number of positive source elements, or -1 if the program
+ * doesn't fit in memory.  If anysign, each word is positive with
+ * probability 1/2, as with gen-driver.pl -r.
+ */
+static int build_driver(mem_t m, kernel_ptr k, int n, unsigned seed,
+			bool_t anysign,
+			word_t *mainp, word_t *srcp, word_t *destp)
+{
+    word_t pos, src, dest, stack;
+    word_t data[BENCH_CHECKLEN];
+    int tval = n / 2;
+    int rval = 0;
+    int i;
+
+    /* Same choice of signs as gen-driver.pl: exactly n/2 positive words */
+    for (i = 0; i < n; i++) {
+	data[i] = -(i+1);
+	if (anysign ? rand_r(&seed) % 2 == 1 :
+	    (rval < tval && rand_r(&seed) % 2 == 1) || tval - rval >= n - i) {
+	    data[i] = -data[i];
+	    rval++;
+	}
+    }
+
+    pos = ALIGN(k->end, 16);
+    src = ALIGN(pos + 4*10 + 9 + 1, 8);
+    dest = ALIGN(src + 8*(n+1), 16) + 8;
+    stack = ALIGN(dest + 8*(n+1), 8) + 8*STACK_WORDS;
+    if (stack > m->len)
+	return -1;
+
+    set_mem(m, k->image);
+    *mainp = pos;
+    pos = put_irmovq(m, pos, REG_RSP, stack);
+    pos = put_irmovq(m, pos, REG_RDX, n);
+    pos = put_irmovq(m, pos, REG_RSI, dest);
+    pos = put_irmovq(m, pos, REG_RDI, src);
+    pos = put_call(m, pos, k->entry);
+    set_byte_val(m, pos, HPACK(I_HALT, F_NONE));
+
+    for (i = 0; i < n; i++) {
+	set_word_val(m, src + 8*i, data[i]);
+	set_word_val(m, dest + 8*i, DESTVAL);
+    }
+    set_word_val(m, src + 8*n, PREVAL);
+    set_word_val(m, dest - 8, PREVAL);
+    set_word_val(m, dest + 8*n, POSTVAL);
+    *srcp = src;
+    *destp = dest;
+    return rval;
+}
+
+/* Did the kernel count and copy correctly? */
+static bool_t check_driver(mem_t m, word_t rax, int n, int rval,
+			   word_t src, word_t dest)
+{
+    word_t sv, dv;
+    int i;
+    if (rax != rval)
+	return FALSE;
+    for (i = 0; i < n; i++) {
+	get_word_val(m, src + 8*i, &sv);
+	get_word_val(m, dest + 8*i, &dv);
+	if (sv != dv)
+	    return FALSE;
+    }
+    get_word_val(m, dest - 8, &dv);
+    if (dv != PREVAL)
+	return FALSE;
+    get_word_val(m, dest + 8*n, &dv);
+    return dv == POSTVAL;
+}
+
+/* Simulate every nthreads'th length, starting at the job's id */
+static void *bench_worker(void *arg)
+{
+    bench_job_ptr job = (bench_job_ptr) arg;
+    byte_t run_status;
+    word_t main_pos, src, dest;
+    int n, rval;
+
+    sim_init();
+    for (n = job->id; n <= job->maxlen; n += job->nthreads) {
+	bench_result_t *r = &job->result[n];
+	sim_reset();
+	rval = build_driver(mem, job->k, n, job->seed + n, FALSE,
+			    &main_pos, &src, &dest);
+	if (rval < 0) {
+	    r->cycles = 0;
+	    r->ok = FALSE;
+	    continue;
+	}
+	/* The first cycle loads the PC register from its next state */
+	pc_curr->pc = pc_next->pc = main_pos;
+	sim_run_pipe(job->max_instr, 5*job->max_instr, &run_status, NULL);
+	r->cycles = cycles;
+	r->ok = run_status == STAT_HLT &&
+	    check_driver(mem, get_reg_val(reg, REG_RAX), n, rval, src, dest);
+    }
+    hz_merge();
+    sim_free();
+    return NULL;
+}
+
+int bench_run(kernel_ptr k, int maxlen, int nthreads, unsigned seed,
+	      word_t max_instr, bench_result_t *result)
+{
+    pthread_t tid[nthreads];
+    bench_job_rec job[nthreads];
+    int i, bad = 0;
+
+    if (maxlen > BENCH_MAXLEN)
+	maxlen = BENCH_MAXLEN;
+    for (i = 0; i < nthreads; i++) {
+	job[i].k = k;
+	job[i].maxlen = maxlen;
+	job[i].nthreads = nthreads;
+	job[i].id = i;
+	job[i].seed = seed;
+	job[i].max_instr = max_instr;
+	job[i].result = result;
+    }
+    /* The calling thread takes the first share itself */
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&tid[i], NULL, bench_worker, &job[i]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+    bench_worker(&job[0]);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+
+    for (i = 0; i <= maxlen; i++)
+	if (!result[i].ok)
+	    bad++;
+    return bad;
+}
+
+int bench_check_lengths(int maxlen, int *len)
+{
+    int n, count = 0;
+    for (n = 0; n <= maxlen; n++)
+	len[count++] = n;
+    for (n = 2 * BENCH_MAXLEN; n <= BENCH_CHECKLEN; n += BENCH_MAXLEN)
+	len[count++] = n;
+    return count;
+}
+
+int bench_check(kernel_ptr k, int maxlen, int rounds, unsigned seed,
+		word_t max_instr, bool_t *ok)
+{
+    int len[BENCH_CHECKLENS];
+    int nlanes = bench_check_lengths(maxlen, len) * rounds;
+    check_input_t *in =
+	(check_input_t *) calloc(nlanes, sizeof(check_input_t));
+    mem_t m = init_mem(MEM_SIZE);
+    lanes_t l = lanes_init(nlanes, k->image);
+    word_t main_pos;
+    int i, n, bad = 0;
+
+    for (i = 0; i < nlanes; i++) {
+	in[i].n = len[i / rounds];
+	in[i].rval = build_driver(m, k, in[i].n, seed + i, TRUE,
+				  &main_pos, &in[i].src, &in[i].dest);
+	lanes_set_mem(l, i, m);
+	l->pc[i] = main_pos;
+    }
+    if (ok)
+	for (n = 0; n <= BENCH_CHECKLEN; n++)
+	    ok[n] = TRUE;
+
+    lanes_run(l, max_instr);
+
+    for (i = 0; i < nlanes; i++) {
+	if (in[i].rval >= 0 && l->stat[i] == STAT_HLT &&
+	    check_driver(l->mem[i], LANE_REG(l, REG_RAX, i), in[i].n,
+			 in[i].rval, in[i].src, in[i].dest))
+	    continue;
+	bad++;
+	if (ok)
+	    ok[in[i].n] = FALSE;
+    }
+    lanes_free(l);
+    free_mem(m);
+    free(in);
+    return bad;
+}
+
+double bench_cpe(bench_result_t *result, int maxlen)
+{
+    double tcpe = 0.0;
+    int i;
+    if (maxlen <= 0)
+	return 0.0;
+    for (i = 1; i <= maxlen; i++)
+	tcpe += (double) result[i].cycles / i;
+    return tcpe / maxlen;
+}
+
+double bench_score(double cpe)
+{
+    if (cpe <= BENCH_FULLCPE)
+	return BENCH_POINTS;
+    if (cpe <= BENCH_THRESHCPE)
+	return BENCH_POINTS * (BENCH_THRESHCPE - cpe) /
+	    (BENCH_THRESHCPE - BENCH_FULLCPE);
+    return 0.0;
+}
@@ -0,0 +1,81 @@
+/*
+ * bench.h - In-process CPE benchmark for ncopy kernels
+ *
+ * Does the job of benchmark.pl without generating, assembling and
+ * simulating a separate driver program for every block length.  The
+ * kernel is loaded once, the driver and its data are synthesized
+ * directly in simulator memory, and the lengths are spread over a pool
+ * of threads, each reusing one simulator instance through sim_reset().
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+/* Largest block length handled by the benchmark */
+#define BENCH_MAXLEN 64
+
+/* Longest block length correctness.pl tries */
+#define BENCH_CHECKLEN 256
+
+/* Grading criteria (same as benchmark.pl) */
+#define BENCH_POINTS    60.0
+#define BENCH_FULLCPE   7.5
+#define BENCH_THRESHCPE 10.5
+
+/* A kernel image, loaded at the addresses it was assembled for */
+typedef struct {
+    mem_t image;   /* Kernel code */
+    word_t entry;  /* Address of label "ncopy:" */
+    word_t end;    /* First address past the kernel */
+} kernel_rec, *kernel_ptr;
+
+/* Result of running the kernel on one block length */
+typedef struct {
+    word_t cycles;  /* Cycles reported by the pipeline */
+    bool_t ok;      /* Did the kernel halt with the right count and copy? */
+} bench_result_t;
+
+/* Load kernel from a .yo file.  Return FALSE on failure */
+bool_t bench_load_kernel(kernel_ptr k, char *fname);
+
+/* Free storage allocated by bench_load_kernel */
+void bench_free_kernel(kernel_ptr k);
+
+/*
+ * Run the kernel on block lengths 0..maxlen with nthreads simulators.
+ * result must have room for maxlen+1 entries.  seed selects the
+ * pseudo-random signs of the source data.  Return the number of
+ * lengths for which the kernel produced a wrong result.
+ */
+int bench_run(kernel_ptr k, int maxlen, int nthreads, unsigned seed,
+	      word_t max_instr, bench_result_t *result);
+
+/* Most block lengths bench_check tries */
+#define BENCH_CHECKLENS ((BENCH_MAXLEN + 1) + (BENCH_CHECKLEN / BENCH_MAXLEN - 1))
+
+/*
+ * Block lengths bench_check tries for maxlen: 0..maxlen, then 2, 3 and
+ * 4 times BENCH_MAXLEN as correctness.pl.  len must have room for
+ * BENCH_CHECKLENS entries.  Return how many lengths there are.
+ */
+int bench_check_lengths(int maxlen, int *len);
+
+/*
+ * Check the kernel as correctness.pl does with yis, on the block
+ * lengths of bench_check_lengths(maxlen), with rounds inputs of each
+ * length whose words have random signs.  The inputs are run together
+ * at the ISA level on the lanes of lanes.c, for at most max_instr
+ * instructions each.  If ok is not NULL, ok[n] is cleared for every
+ * length n <= BENCH_CHECKLEN with an input handled incorrectly.
+ * Return the number of such inputs.
+ */
+int bench_check(kernel_ptr k, int maxlen, int rounds, unsigned seed,
+		word_t max_instr, bool_t *ok);
+
+/* Average CPE over lengths 1..maxlen */
+double bench_cpe(bench_result_t *result, int maxlen);
+
+/* Score for a given average CPE */
+double bench_score(double cpe);
+
+#endif /* BENCH_H */
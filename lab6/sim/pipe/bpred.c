@@ -0,0 +1,244 @@
+/*
+ * bpred.c - Branch predictors for the PIPE simulator
+ *
+ * 2bit:   Table of 2-bit saturating counters indexed by the jump's PC
+ * gshare: The same table indexed by the PC xor'ed with the outcomes of
+ *         the most recent jumps
+ * btb:    Direct-mapped branch target buffer.  A jump is predicted
+ *         taken only if it hits in the buffer and its counter says so
+ * taken, nt and btfnt are the static strategies of pipe-std.hcl,
+ * pipe-nt.hcl and pipe-btfnt.hcl.
+ *
+ * History and counters are updated when a jump resolves, not
+ * speculatively.  The return-address stack is updated as calls and
+ * rets are fetched, and is not repaired after a misprediction.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "bpred.h"
+
+/* Configuration */
+bp_type_t bp_type = BP_GSHARE;
+int bp_bits = -1;
+int bp_ras_depth = BP_RAS_DEPTH;
+
+static char *bp_names[BP_NTYPE] =
+    { "taken", "nt", "btfnt", "2bit", "gshare", "btb" };
+
+/* Branch target buffer entry */
+typedef struct {
+    bool_t valid;
+    word_t pc;
+    word_t target;
+    byte_t counter;
+} btb_ele;
+
+/* Predictor state of this thread */
+static SIM_TLS byte_t *counters = NULL;
+static SIM_TLS btb_ele *btb = NULL;
+static SIM_TLS word_t *ras = NULL;
+static SIM_TLS word_t mask;
+static SIM_TLS word_t history;
+static SIM_TLS int ras_top;   /* Index of next free entry */
+static SIM_TLS int ras_count; /* Valid entries, at most bp_ras_depth */
+
+/* Statistics */
+static SIM_TLS bool_t consulted;
+static SIM_TLS bool_t ras_consulted; /* Were rets predicted at all? */
+static SIM_TLS word_t jumps, jump_misses, rets, ret_misses;
+
+bool_t bp_set_type(char *name)
+{
+    int t;
+    for (t = 0; t < BP_NTYPE; t++) {
+	if (strcmp(name, bp_names[t]) == 0) {
+	    bp_type = t;
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+char *bp_type_name(bp_type_t t)
+{
+    return t < BP_NTYPE ? bp_names[t] : "???";
+}
+
+static int table_bits()
+{
+    if (bp_bits >= 0)
+	return bp_bits;
+    return bp_type == BP_BTB ? BP_BTB_BITS : BP_TABLE_BITS;
+}
+
+void bp_init()
+{
+    word_t size = (word_t) 1 << table_bits();
+    mask = size - 1;
+    counters = (byte_t *) malloc(size * sizeof(byte_t));
+    btb = (btb_ele *) malloc(size * sizeof(btb_ele));
+    ras = (word_t *) malloc((bp_ras_depth + 1) * sizeof(word_t));
+    bp_reset();
+}
+
+void bp_reset()
+{
+    word_t i;
+    if (!counters)
+	return;
+    /* Start out weakly taken */
+    for (i = 0; i <= mask; i++)
+	counters[i] = 2;
+    memset(btb, 0, (mask + 1) * sizeof(btb_ele));
+    history = 0;
+    ras_top = ras_count = 0;
+    consulted = ras_consulted = FALSE;
+    jumps = jump_misses = rets = ret_misses = 0;
+}
+
+void bp_free()
+{
+    free(counters);
+    free(btb);
+    free(ras);
+    counters = NULL;
+    btb = NULL;
+    ras = NULL;
+}
+
+static word_t counter_index(word_t pc)
+{
+    if (bp_type == BP_GSHARE)
+	return (pc ^ history) & mask;
+    return pc & mask;
+}
+
+word_t bp_predict(word_t pc, byte_t ifun, word_t target, word_t valp)
+{
+    btb_ele *e;
+    consulted = TRUE;
+    switch (bp_type) {
+    case BP_NT:
+	return ifun == C_YES ? target : valp;
+    case BP_BTFNT:
+	return ifun == C_YES || target <= pc ? target : valp;
+    case BP_2BIT:
+    case BP_GSHARE:
+	if (ifun == C_YES)
+	    return target;
+	return counters[counter_index(pc)] >= 2 ? target : valp;
+    case BP_BTB:
+	/* Unconditional jumps need an entry too */
+	e = &btb[pc & mask];
+	return e->valid && e->pc == pc && e->counter >= 2 ? e->target : valp;
+    case BP_TAKEN:
+    default:
+	return target;
+    }
+}
+
+word_t bp_predict_ret(word_t valp)
+{
+    consulted = ras_consulted = TRUE;
+    if (ras_count == 0)
+	return valp;
+    return ras[(ras_top + bp_ras_depth - 1) % bp_ras_depth];
+}
+
+void bp_fetch(byte_t icode, word_t valp)
+{
+    if (bp_ras_depth == 0)
+	return;
+    if (icode == I_CALL) {
+	/* Oldest entry is overwritten when stack is full */
+	ras[ras_top] = valp;
+	ras_top = (ras_top + 1) % bp_ras_depth;
+	if (ras_count < bp_ras_depth)
+	    ras_count++;
+    } else if (icode == I_RET && ras_count > 0) {
+	ras_top = (ras_top + bp_ras_depth - 1) % bp_ras_depth;
+	ras_count--;
+    }
+}
+
+/* Move 2-bit saturating counter toward outcome */
+static byte_t train(byte_t c, bool_t taken)
+{
+    if (taken)
+	return c < 3 ? c + 1 : 3;
+    return c > 0 ? c - 1 : 0;
+}
+
+void bp_resolve_jump(word_t pc, byte_t ifun, bool_t taken, word_t target,
+		     word_t predpc)
+{
+    /* Jumps are 9 bytes long */
+    word_t actual = taken ? target : pc + 9;
+    btb_ele *e;
+
+    jumps++;
+    if (predpc != actual)
+	jump_misses++;
+
+    if (counters) {
+	word_t i = counter_index(pc);
+	counters[i] = train(counters[i], taken);
+	history = ((history << 1) | (taken ? 1 : 0)) & mask;
+	e = &btb[pc & mask];
+	if (e->valid && e->pc == pc) {
+	    e->counter = train(e->counter, taken);
+	} else if (taken) {
+	    /* Allocate on first taken execution */
+	    e->valid = TRUE;
+	    e->pc = pc;
+	    e->target = target;
+	    e->counter = 2;
+	}
+    }
+}
+
+void bp_resolve_ret(word_t retpc, word_t predpc)
+{
+    rets++;
+    if (predpc != retpc)
+	ret_misses++;
+}
+
+static void report_count(FILE *f, char *what, word_t n, word_t misses)
+{
+    double acc = n > 0 ? 100.0 * (n - misses) / n : 100.0;
+    fprintf(f, "  %s: %lld, %lld mispredicted (%.2f%% accurate)\n",
+	    what, n, misses, acc);
+}
+
+bool_t bp_consulted()
+{
+    return consulted;
+}
+
+void bp_report(FILE *f, word_t cycles)
+{
+    word_t lost = BP_JUMP_PENALTY * jump_misses + BP_RET_PENALTY * ret_misses;
+
+    if (ras_consulted)
+	fprintf(f, "Branch prediction: %s, %lld entries, %d-entry RAS\n",
+		bp_type_name(bp_type), mask + 1, bp_ras_depth);
+    else if (consulted)
+	fprintf(f, "Branch prediction: %s, %lld entries\n",
+		bp_type_name(bp_type), mask + 1);
+    else
+	fprintf(f, "Branch prediction: fixed by HCL\n");
+    report_count(f, "Jumps", jumps, jump_misses);
+    /* A simulator that predicts jumps only stalls on rets instead */
+    if (ras_consulted || !consulted)
+	report_count(f, "Returns", rets, ret_misses);
+    fprintf(f, "  Mispredict cycles: %lld (%.2f%% of %lld cycles)\n",
+	    lost, cycles > 0 ? 100.0 * lost / cycles : 0.0, cycles);
+}
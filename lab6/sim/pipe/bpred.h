@@ -0,0 +1,72 @@
+/*
+ * bpred.h - Branch predictors for the PIPE simulator
+ *
+ * The HCL files fix a prediction strategy in f_predPC.  This module
+ * keeps predictor state on the simulator side instead, so an HCL file
+ * (see pipe-bp.hcl) can ask it where a jump or ret is likely to go.
+ * The simulator trains the predictor as jumps leave the execute stage
+ * and returns leave the memory stage, and counts how often the PC that
+ * followed each of them in the pipeline was wrong.  The counts are
+ * kept whichever HCL file is used, so the static strategies can be
+ * compared with the dynamic ones.
+ */
+
+#ifndef BPRED_H
+#define BPRED_H
+
+/* Direction predictors for conditional jumps */
+typedef enum { BP_TAKEN, BP_NT, BP_BTFNT, BP_2BIT, BP_GSHARE, BP_BTB,
+	       BP_NTYPE } bp_type_t;
+
+/* Default sizes (log2 of the number of entries) */
+#define BP_TABLE_BITS 10
+#define BP_BTB_BITS   6
+#define BP_RAS_DEPTH  16
+
+/* Bubbles inserted by pipe-bp.hcl when a jump or ret was mispredicted */
+#define BP_JUMP_PENALTY 2
+#define BP_RET_PENALTY  3
+
+/* Configuration, set from the command line before sim_init */
+extern bp_type_t bp_type;
+extern int bp_bits;       /* log2 of table size, or -1 for the default */
+extern int bp_ras_depth;  /* Return-address stack entries (0 disables it) */
+
+/* Look up predictor by name ("2bit", "gshare", ...).  Return FALSE if
+   there is no such predictor */
+bool_t bp_set_type(char *name);
+char *bp_type_name(bp_type_t t);
+
+/* Allocate (bp_init), clear (bp_reset) and free the predictor tables
+   of the calling thread */
+void bp_init();
+void bp_reset();
+void bp_free();
+
+/*
+ * Queries made by the HCL while fetching.  bp_predict gives the
+ * predicted address following the jump at pc with condition ifun,
+ * whose target is target and whose fall-through address is valp.
+ * bp_predict_ret gives the address a ret is predicted to return to,
+ * or valp when the return-address stack is empty.
+ */
+word_t bp_predict(word_t pc, byte_t ifun, word_t target, word_t valp);
+word_t bp_predict_ret(word_t valp);
+
+/* An instruction is passed from fetch to decode (pushes and pops the
+   return-address stack) */
+void bp_fetch(byte_t icode, word_t valp);
+
+/* A jump has resolved in execute, or a ret has read its return address.
+   predpc is where the pipeline went after it */
+void bp_resolve_jump(word_t pc, byte_t ifun, bool_t taken, word_t target,
+		     word_t predpc);
+void bp_resolve_ret(word_t retpc, word_t predpc);
+
+/* Has the HCL consulted the predictor since bp_reset? */
+bool_t bp_consulted();
+
+/* Print accuracy and mispredict cycles out of total cycles */
+void bp_report(FILE *f, word_t cycles);
+
+#endif /* BPRED_H */
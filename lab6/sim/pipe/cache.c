@@ -0,0 +1,162 @@
+/*
+ * cache.c - Instruction and data cache timing model for PIPE
+ *
+ * Set-associative with LRU replacement.  Each line records its tag,
+ * whether it is dirty, and when it was last used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "cache.h"
+
+typedef struct {
+    bool_t valid;
+    bool_t dirty;
+    word_t tag;
+    word_t last_use;
+} line_rec;
+
+struct cache_rec {
+    cache_config_t config;
+    line_rec *lines;     /* sets * ways lines, set by set */
+    word_t clock;        /* Advances with every access, for LRU */
+    cache_stats_t stats;
+};
+
+static bool_t power_of_2(int x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+bool_t cache_parse(char *spec, cache_config_t *c)
+{
+    char policy[8] = "wb";
+    int n = sscanf(spec, "%d:%d:%d:%d:%7s", &c->sets, &c->ways,
+		   &c->bsize, &c->latency, policy);
+    if (n < 4 || !power_of_2(c->sets) || c->ways < 1 ||
+	!power_of_2(c->bsize) || c->latency < 0)
+	return FALSE;
+    if (strcmp(policy, "wb") == 0)
+	c->policy = WP_BACK;
+    else if (strcmp(policy, "wt") == 0)
+	c->policy = WP_THROUGH;
+    else
+	return FALSE;
+    return TRUE;
+}
+
+cache_t cache_new(cache_config_t *config)
+{
+    cache_t c = (cache_t) malloc(sizeof(struct cache_rec));
+    c->config = *config;
+    c->lines = (line_rec *) malloc(config->sets * config->ways *
+				   sizeof(line_rec));
+    cache_reset(c);
+    return c;
+}
+
+void cache_free(cache_t c)
+{
+    if (!c)
+	return;
+    free(c->lines);
+    free(c);
+}
+
+void cache_reset(cache_t c)
+{
+    memset(c->lines, 0, c->config.sets * c->config.ways * sizeof(line_rec));
+    memset(&c->stats, 0, sizeof(c->stats));
+    c->clock = 0;
+}
+
+/* Access the block holding addr.  Return TRUE on a hit */
+static bool_t access_block(cache_t c, word_t addr, bool_t write)
+{
+    word_t block = (uword_t) addr / c->config.bsize;
+    word_t tag = block / c->config.sets;
+    line_rec *set = &c->lines[(block % c->config.sets) * c->config.ways];
+    line_rec *victim = set;
+    int w;
+
+    c->clock++;
+    for (w = 0; w < c->config.ways; w++) {
+	line_rec *l = &set[w];
+	if (l->valid && l->tag == tag) {
+	    l->last_use = c->clock;
+	    if (write) {
+		if (c->config.policy == WP_BACK)
+		    l->dirty = TRUE;
+		else
+		    c->stats.mem_writes++;
+	    }
+	    return TRUE;
+	}
+	/* Prefer an empty line, then the least recently used */
+	if (victim->valid && (!l->valid || l->last_use < victim->last_use))
+	    victim = l;
+    }
+
+    c->stats.misses++;
+    if (write && c->config.policy == WP_THROUGH) {
+	/* No write allocate */
+	c->stats.mem_writes++;
+	return TRUE;
+    }
+    if (victim->valid && victim->dirty)
+	c->stats.writebacks++;
+    victim->valid = TRUE;
+    victim->dirty = write;
+    victim->tag = tag;
+    victim->last_use = c->clock;
+    return FALSE;
+}
+
+int cache_access(cache_t c, word_t addr, int len, bool_t write)
+{
+    word_t first = (uword_t) addr / c->config.bsize;
+    word_t last = (uword_t) (addr + len - 1) / c->config.bsize;
+    int wait = 0;
+
+    c->stats.accesses++;
+    if (write)
+	c->stats.writes++;
+    if (!access_block(c, addr, write))
+	wait += c->config.latency;
+    if (last != first && !access_block(c, addr + len - 1, write))
+	wait += c->config.latency;
+    return wait;
+}
+
+void cache_stall(cache_t c, int cycles)
+{
+    c->stats.stall_cycles += cycles;
+}
+
+cache_stats_t *cache_stats(cache_t c)
+{
+    return &c->stats;
+}
+
+void cache_report(cache_t c, char *name, FILE *f)
+{
+    cache_config_t *g = &c->config;
+    cache_stats_t *s = &c->stats;
+    double rate = s->accesses > 0 ? 100.0 * s->misses / s->accesses : 0.0;
+
+    fprintf(f, "%s: %d sets, %d ways, %d-byte blocks, %d-cycle misses\n",
+	    name, g->sets, g->ways, g->bsize, g->latency);
+    fprintf(f, "  Accesses: %lld, misses: %lld (%.2f%%), stall cycles: %lld\n",
+	    s->accesses, s->misses, rate, s->stall_cycles);
+    if (s->writes == 0)
+	return;
+    if (g->policy == WP_BACK)
+	fprintf(f, "  Write-back: %lld writes, %lld dirty blocks written back\n",
+		s->writes, s->writebacks);
+    else
+	fprintf(f, "  Write-through: %lld writes passed on to memory\n",
+		s->mem_writes);
+}
@@ -0,0 +1,65 @@
+/*
+ * cache.h - Instruction and data cache timing model for PIPE
+ *
+ * The caches only keep tags: the data always comes from the simulator's
+ * memory, so they affect timing but never results.  An access that
+ * misses costs the configured latency, during which the pipeline is
+ * held up through the same pipe register controls the HCL uses.
+ * Each cache is blocking: a second miss waits for the first fill.
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+/* Write-back with write-allocate, or write-through without allocate */
+typedef enum { WP_BACK, WP_THROUGH } write_policy_t;
+
+/* Geometry and timing of one cache */
+typedef struct {
+    int sets;         /* Number of sets (power of 2) */
+    int ways;         /* Blocks per set */
+    int bsize;        /* Block size in bytes (power of 2) */
+    int latency;      /* Extra cycles taken by a miss */
+    write_policy_t policy;
+} cache_config_t;
+
+typedef struct {
+    word_t accesses;
+    word_t writes;
+    word_t misses;
+    word_t writebacks;   /* Dirty blocks evicted (write-back) */
+    word_t mem_writes;   /* Writes passed on to memory (write-through) */
+    word_t stall_cycles; /* Cycles the pipeline waited on this cache */
+} cache_stats_t;
+
+typedef struct cache_rec *cache_t;
+
+/*
+ * Parse a specification of the form sets:ways:bsize:latency[:wt|:wb]
+ * into c.  Return FALSE if it is malformed.
+ */
+bool_t cache_parse(char *spec, cache_config_t *c);
+
+/* Create a cache with configuration c, initially empty */
+cache_t cache_new(cache_config_t *c);
+void cache_free(cache_t c);
+
+/* Invalidate all blocks and clear the statistics */
+void cache_reset(cache_t c);
+
+/*
+ * Access the bytes addr..addr+len-1 (at most two blocks), reading or
+ * writing.  Return the number of cycles the access must wait: 0 on a
+ * hit, the latency for each block missed.
+ */
+int cache_access(cache_t c, word_t addr, int len, bool_t write);
+
+/* Charge cycles the pipeline waited on c */
+void cache_stall(cache_t c, int cycles);
+
+cache_stats_t *cache_stats(cache_t c);
+
+/* Print geometry and statistics, headed by name */
+void cache_report(cache_t c, char *name, FILE *f);
+
+#endif /* CACHE_H */
@@ -0,0 +1,199 @@
+/*
+ * hazard.c - Attribute the cycles lost to bubbles in PIPE
+ *
+ * Lost cycles are counted per cause for every byte address of memory,
+ * first in a table private to each simulator thread and then, by
+ * hz_merge, in a table shared by all of them.  This way -B can profile
+ * a kernel over all block lengths at once.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "hazard.h"
+
+#define LINELEN 4096
+
+bool_t hz_enabled = FALSE;
+
+static char *hz_names[HZ_NCAUSE] =
+    { "none", "load/use", "data", "jump", "ret", "error", "icache", "dcache",
+      "other" };
+
+/* Lost cycles of one address by cause.  The HZ_NONE column holds the
+   sum of the others */
+typedef word_t hz_row[HZ_NCAUSE];
+
+/* Lost cycles of this thread, and of all threads */
+static SIM_TLS hz_row *profile = NULL;
+static hz_row *total = NULL;
+static pthread_mutex_t total_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void hz_init()
+{
+    if (hz_enabled && !profile)
+	profile = (hz_row *) calloc(MEM_SIZE, sizeof(hz_row));
+}
+
+void hz_free()
+{
+    free(profile);
+    profile = NULL;
+}
+
+char *hz_name(hazard_t cause)
+{
+    return cause < HZ_NCAUSE ? hz_names[cause] : "???";
+}
+
+void hz_charge(hazard_t cause, word_t pc)
+{
+    if (!profile)
+	return;
+    if (cause == HZ_NONE || cause >= HZ_NCAUSE)
+	cause = HZ_OTHER;
+    if (pc < 0 || pc >= MEM_SIZE)
+	pc = 0;
+    profile[pc][cause]++;
+    profile[pc][HZ_NONE]++;
+}
+
+void hz_merge()
+{
+    word_t pc;
+    int c;
+    if (!profile)
+	return;
+    pthread_mutex_lock(&total_lock);
+    if (!total)
+	total = (hz_row *) calloc(MEM_SIZE, sizeof(hz_row));
+    for (pc = 0; pc < MEM_SIZE; pc++)
+	for (c = 0; c < HZ_NCAUSE; c++)
+	    total[pc][c] += profile[pc][c];
+    pthread_mutex_unlock(&total_lock);
+    memset(profile, 0, MEM_SIZE * sizeof(hz_row));
+}
+
+/* Order addresses by decreasing lost cycles, then increasing address */
+static int cmp_lost(const void *a, const void *b)
+{
+    word_t pa = *(word_t *) a;
+    word_t pb = *(word_t *) b;
+    if (total[pa][HZ_NONE] != total[pb][HZ_NONE])
+	return total[pa][HZ_NONE] < total[pb][HZ_NONE] ? 1 : -1;
+    return pa < pb ? -1 : pa > pb;
+}
+
+void hz_report(FILE *f, mem_t code, word_t cycles)
+{
+    word_t sums[HZ_NCAUSE];
+    word_t *pcs;
+    word_t pc;
+    int c, n = 0;
+    byte_t instr;
+
+    memset(sums, 0, sizeof(sums));
+    if (!total)
+	total = (hz_row *) calloc(MEM_SIZE, sizeof(hz_row));
+    pcs = (word_t *) malloc(MEM_SIZE * sizeof(word_t));
+    for (pc = 0; pc < MEM_SIZE; pc++) {
+	if (total[pc][HZ_NONE] == 0)
+	    continue;
+	for (c = 0; c < HZ_NCAUSE; c++)
+	    sums[c] += total[pc][c];
+	pcs[n++] = pc;
+    }
+    qsort(pcs, n, sizeof(word_t), cmp_lost);
+
+    fprintf(f, "Lost cycles: %lld of %lld (%.2f%%)\n", sums[HZ_NONE], cycles,
+	    cycles > 0 ? 100.0 * sums[HZ_NONE] / cycles : 0.0);
+    for (c = HZ_NONE+1; c < HZ_NCAUSE; c++)
+	if (sums[c])
+	    fprintf(f, "  %-9s %8lld\n", hz_name(c), sums[c]);
+    if (n == 0)
+	return;
+    fprintf(f, "Lost cycles by instruction:\n");
+    fprintf(f, "  %-8s %-8s %6s", "PC", "Instr", "Lost");
+    for (c = HZ_NONE+1; c < HZ_NCAUSE; c++)
+	fprintf(f, " %8s", hz_name(c));
+    fprintf(f, "\n");
+    for (c = 0; c < n; c++) {
+	int cause;
+	pc = pcs[c];
+	if (!get_byte_val(code, pc, &instr))
+	    instr = HPACK(I_NOP, F_NONE);
+	fprintf(f, "  0x%-6llx %-8s %6lld", pc, iname(instr), total[pc][HZ_NONE]);
+	for (cause = HZ_NONE+1; cause < HZ_NCAUSE; cause++) {
+	    if (total[pc][cause])
+		fprintf(f, " %8lld", total[pc][cause]);
+	    else
+		fprintf(f, " %8s", "");
+	}
+	fprintf(f, "\n");
+    }
+    free(pcs);
+}
+
+/* Address of the instruction on a line of a .yo file, or -1 if there
+   is none (labels, comments and data are not instructions) */
+static word_t yo_instr_addr(char *buf)
+{
+    char *p = buf;
+    char *end;
+    word_t addr;
+    while (isspace((int)*p))
+	p++;
+    if (strncmp(p, "0x", 2) != 0)
+	return -1;
+    addr = strtoll(p, &end, 16);
+    if (*end != ':')
+	return -1;
+    for (p = end + 1; isspace((int)*p); p++)
+	;
+    if (!isxdigit((int)*p))
+	return -1;
+    return addr;
+}
+
+bool_t hz_annotate(char *yofile, FILE *out)
+{
+    char buf[LINELEN];
+    FILE *f = fopen(yofile, "r");
+    word_t pc;
+    int c;
+
+    if (!f)
+	return FALSE;
+    if (!total)
+	total = (hz_row *) calloc(MEM_SIZE, sizeof(hz_row));
+    fprintf(out, "%6s", "Lost");
+    for (c = HZ_NONE+1; c < HZ_NCAUSE; c++)
+	fprintf(out, " %8s", hz_name(c));
+    fprintf(out, " |\n");
+    while (fgets(buf, LINELEN, f)) {
+	pc = yo_instr_addr(buf);
+	if (pc >= 0 && pc < MEM_SIZE && total[pc][HZ_NONE] > 0) {
+	    fprintf(out, "%6lld", total[pc][HZ_NONE]);
+	    for (c = HZ_NONE+1; c < HZ_NCAUSE; c++) {
+		if (total[pc][c])
+		    fprintf(out, " %8lld", total[pc][c]);
+		else
+		    fprintf(out, " %8s", "");
+	    }
+	} else {
+	    fprintf(out, "%6s", "");
+	    for (c = HZ_NONE+1; c < HZ_NCAUSE; c++)
+		fprintf(out, " %8s", "");
+	}
+	fprintf(out, " | %s", buf);
+    }
+    fclose(f);
+    return TRUE;
+}
@@ -0,0 +1,44 @@
+/*
+ * hazard.h - Attribute the cycles lost to bubbles in PIPE
+ *
+ * Every cycle in which write back holds a bubble is a lost cycle.  The
+ * simulator records why each bubble was inserted and which instruction
+ * caused it, carries that along with the bubble as it moves down the
+ * pipeline, and charges it here when it reaches write back.
+ */
+
+#ifndef HAZARD_H
+#define HAZARD_H
+
+/* Why a bubble was inserted */
+typedef enum { HZ_NONE, HZ_LOADUSE, HZ_DATA, HZ_JUMP, HZ_RET, HZ_ERROR,
+	       HZ_ICACHE, HZ_DCACHE, HZ_OTHER, HZ_NCAUSE } hazard_t;
+
+/* Collect the profile? (set from the command line before sim_init) */
+extern bool_t hz_enabled;
+
+/* Allocate and free the profile of the calling thread */
+void hz_init();
+void hz_free();
+
+/* Charge one lost cycle to cause and the instruction at pc */
+void hz_charge(hazard_t cause, word_t pc);
+
+/* Add the profile of the calling thread to the total, and clear it.
+   Safe to call from several threads */
+void hz_merge();
+
+char *hz_name(hazard_t cause);
+
+/*
+ * Print the total profile: lost cycles by cause, and by instruction in
+ * decreasing order.  code is used to name the instructions, cycles is
+ * the total number of cycles simulated.
+ */
+void hz_report(FILE *f, mem_t code, word_t cycles);
+
+/* Copy the .yo listing in yofile to out, with the lost cycles of each
+   instruction in front of it.  Return FALSE if yofile can't be read */
+bool_t hz_annotate(char *yofile, FILE *out);
+
+#endif /* HAZARD_H */
@@ -0,0 +1,922 @@
+/*
+ * ooo.c - Out-of-order Y86-64 core in the style of Tomasulo
+ *
+ * Each cycle is simulated in the order commit, load, issue, dispatch,
+ * fetch, so that every stage sees the work the stages after it have
+ * finished:
+ *
+ * Fetch    Up to width instructions into a fetch queue, stopping after
+ *          a control transfer predicted taken.  Jumps are predicted by
+ *          bpred.c (-p), returns by its return-address stack.
+ * Dispatch Up to width instructions, in order, from the fetch queue
+ *          into the ROB, and into the RS and LSQ when they need them.
+ *          Source registers and condition codes are renamed to the ROB
+ *          entries that will produce them.  cmovXX also reads its
+ *          destination, and passes it through when the move isn't
+ *          taken, so its destination can be renamed in dispatch.
+ * Issue    Up to width instructions whose operands are ready, oldest
+ *          first.  They execute in one cycle, so a dependent
+ *          instruction can issue in the next.  A mispredicted jump
+ *          flushes every younger instruction and redirects fetch.
+ * Load     One load per cycle reads memory, once its address is known
+ *          and the addresses of all older stores are.  A load from the
+ *          address of the youngest older store that overlaps it gets
+ *          the store's data; a partial overlap waits until the store
+ *          commits.  A ret whose return address was mispredicted
+ *          flushes as a jump does.
+ * Commit   Up to width finished instructions from the head of the ROB
+ *          update registers, condition codes and memory (stores only
+ *          write memory here).  Commit stops at an exception, which is
+ *          therefore precise.  A store that overwrites an instruction
+ *          already fetched flushes everything after it.
+ *
+ * Operands name the ROB entry producing them.  When an entry commits
+ * its results are copied to the operands still naming it, as the
+ * common data bus of Tomasulo's design would, so the entry can be
+ * reused.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "ptsuite.h"
+#include "bpred.h"
+#include "ooo.h"
+
+/* Cycle at which a result that isn't computed yet becomes ready */
+#define NEVER ((word_t) 1 << 62)
+
+/* Number of buckets in the occupancy histograms */
+#define HIST_BINS 8
+
+/* A register or condition code operand */
+typedef struct {
+    int tag;          /* ROB entry producing it, or -1 if val holds it */
+    bool_t mport;     /* Produced as the entry's valM rather than valE */
+    word_t val;
+} opnd_t;
+
+/* A reorder buffer entry */
+typedef struct {
+    word_t seq;       /* Program order */
+    byte_t status;
+    byte_t icode;
+    byte_t ifun;
+    word_t pc;
+    word_t valc;
+    word_t valp;
+    word_t predpc;
+    byte_t dste;
+    byte_t dstm;
+    opnd_t a, b;      /* Source registers */
+    opnd_t c;         /* Condition codes */
+    bool_t in_rs;     /* Waiting to issue */
+    bool_t in_lsq;
+    bool_t issued;
+    word_t issue_cycle;
+    bool_t loaded;
+    word_t vale;
+    word_t valm;
+    word_t addr;      /* Memory address */
+    word_t data;      /* Data to store */
+    cc_t cc;          /* Condition codes set by OPq or iaddq */
+    bool_t taken;     /* Outcome of a jump */
+    word_t ready_e;   /* First cycle valE and cc can be used */
+    word_t ready_m;   /* First cycle valM can be used */
+} rob_ent;
+
+/* Called as each instruction commits.  Return FALSE to stop */
+typedef bool_t (*commit_fn)(rob_ent *e, void *arg);
+
+/* Why dispatch moved fewer than width instructions */
+typedef enum { DS_ROB, DS_RS, DS_LSQ, DS_FETCH, DS_NCAUSE } dstall_t;
+static char *dstall_names[DS_NCAUSE] =
+    { "ROB full", "RS full", "LSQ full", "fetch" };
+
+/* What the head of the ROB waited for when nothing committed */
+typedef enum { CS_EMPTY, CS_LOAD, CS_EXEC, CS_NCAUSE } cstall_t;
+static char *cstall_names[CS_NCAUSE] =
+    { "empty ROB", "load", "execute" };
+
+bool_t ooo_mode = FALSE;
+ooo_config_t ooo_config = { 32, 16, 8, 2 };
+
+/* Core of this thread */
+static SIM_TLS rob_ent *rob = NULL;
+static SIM_TLS int rob_head, rob_count;
+static SIM_TLS int rs_used, lsq_used;
+static SIM_TLS opnd_t rat[REG_NONE];  /* Register alias table */
+static SIM_TLS opnd_t rat_cc;
+static SIM_TLS word_t next_seq;
+
+/* Fetch queue */
+typedef struct {
+    byte_t status;
+    byte_t icode;
+    byte_t ifun;
+    byte_t ra;
+    byte_t rb;
+    word_t pc;
+    word_t valc;
+    word_t valp;
+    word_t predpc;
+} fetched_t;
+
+static SIM_TLS fetched_t *fq = NULL;
+static SIM_TLS int fq_head, fq_count, fq_size;
+static SIM_TLS word_t fetch_pc;
+static SIM_TLS bool_t fetch_stopped;  /* After an exception, until a flush */
+static SIM_TLS bool_t redirect;       /* Flushed this cycle */
+static SIM_TLS bool_t started;
+static SIM_TLS bool_t retiring;       /* Has the first instruction committed? */
+static SIM_TLS word_t now;            /* Current cycle */
+
+/* Statistics */
+static SIM_TLS word_t dstalls[DS_NCAUSE];
+static SIM_TLS word_t cstalls[CS_NCAUSE];
+static SIM_TLS word_t jump_flushes, ret_flushes, smc_flushes, forwards;
+static SIM_TLS word_t *rob_hist = NULL, *rs_hist = NULL, *lsq_hist = NULL;
+
+bool_t ooo_parse(char *spec, ooo_config_t *c)
+{
+    int n;
+    c->width = 2;
+    n = sscanf(spec, "%d:%d:%d:%d", &c->rob, &c->rs, &c->lsq, &c->width);
+    return n >= 3 && c->rob >= 1 && c->rs >= 1 && c->lsq >= 1 &&
+	c->width >= 1;
+}
+
+void ooo_init()
+{
+    ooo_config_t *g = &ooo_config;
+    fq_size = 2 * g->width;
+    rob = (rob_ent *) malloc(g->rob * sizeof(rob_ent));
+    fq = (fetched_t *) malloc(fq_size * sizeof(fetched_t));
+    rob_hist = (word_t *) malloc((g->rob + 1) * sizeof(word_t));
+    rs_hist = (word_t *) malloc((g->rs + 1) * sizeof(word_t));
+    lsq_hist = (word_t *) malloc((g->lsq + 1) * sizeof(word_t));
+    ooo_reset();
+}
+
+static void clear_rat()
+{
+    int r;
+    for (r = 0; r < REG_NONE; r++)
+	rat[r].tag = -1;
+    rat_cc.tag = -1;
+}
+
+void ooo_reset()
+{
+    ooo_config_t *g = &ooo_config;
+    if (!rob)
+	return;
+    rob_head = rob_count = rs_used = lsq_used = 0;
+    fq_head = fq_count = 0;
+    clear_rat();
+    next_seq = 0;
+    started = retiring = redirect = fetch_stopped = FALSE;
+    now = 0;
+    memset(dstalls, 0, sizeof(dstalls));
+    memset(cstalls, 0, sizeof(cstalls));
+    jump_flushes = ret_flushes = smc_flushes = forwards = 0;
+    memset(rob_hist, 0, (g->rob + 1) * sizeof(word_t));
+    memset(rs_hist, 0, (g->rs + 1) * sizeof(word_t));
+    memset(lsq_hist, 0, (g->lsq + 1) * sizeof(word_t));
+}
+
+void ooo_free()
+{
+    free(rob);
+    free(fq);
+    free(rob_hist);
+    free(rs_hist);
+    free(lsq_hist);
+    rob = NULL;
+    fq = NULL;
+    rob_hist = rs_hist = lsq_hist = NULL;
+}
+
+/* Index of the i'th oldest ROB entry */
+static int rob_index(int i)
+{
+    return (rob_head + i) % ooo_config.rob;
+}
+
+static bool_t is_load(byte_t icode)
+{
+    return icode == I_MRMOVQ || icode == I_POPQ || icode == I_RET;
+}
+
+static bool_t is_store(byte_t icode)
+{
+    return icode == I_RMMOVQ || icode == I_PUSHQ || icode == I_CALL;
+}
+
+/* Is the operand available in cycle now? */
+static bool_t opnd_ready(opnd_t *o)
+{
+    rob_ent *p;
+    if (o->tag < 0)
+	return TRUE;
+    p = &rob[o->tag];
+    return (o->mport ? p->ready_m : p->ready_e) <= now;
+}
+
+static word_t opnd_val(opnd_t *o)
+{
+    rob_ent *p;
+    if (o->tag < 0)
+	return o->val;
+    p = &rob[o->tag];
+    return o->mport ? p->valm : p->vale;
+}
+
+static cc_t opnd_cc(opnd_t *o)
+{
+    return o->tag < 0 ? (cc_t) o->val : rob[o->tag].cc;
+}
+
+/* Rename register r for reading */
+static void rename_src(byte_t r, opnd_t *o)
+{
+    if (r == REG_NONE) {
+	o->tag = -1;
+	o->val = 0;
+    } else if (rat[r].tag < 0) {
+	o->tag = -1;
+	o->val = get_reg_val(reg, r);
+    } else {
+	*o = rat[r];
+    }
+}
+
+/* Point the alias table at the results of entry t */
+static void rename_dsts(int t)
+{
+    rob_ent *e = &rob[t];
+    if (e->dste != REG_NONE) {
+	rat[e->dste].tag = t;
+	rat[e->dste].mport = FALSE;
+    }
+    if (e->dstm != REG_NONE) {
+	rat[e->dstm].tag = t;
+	rat[e->dstm].mport = TRUE;
+    }
+    if (e->icode == I_ALU || e->icode == I_IADDQ) {
+	rat_cc.tag = t;
+	rat_cc.mport = FALSE;
+    }
+}
+
+/* Drop every entry younger than the i'th oldest, and fetch from pc */
+static void flush_after(int i, word_t pc)
+{
+    int j;
+    rob_count = i + 1;
+    rs_used = lsq_used = 0;
+    clear_rat();
+    for (j = 0; j < rob_count; j++) {
+	rob_ent *e = &rob[rob_index(j)];
+	rs_used += e->in_rs;
+	lsq_used += e->in_lsq;
+	rename_dsts(rob_index(j));
+    }
+    fq_count = 0;
+    fetch_pc = pc;
+    fetch_stopped = FALSE;
+    redirect = TRUE;
+}
+
+/*
+ * Fetch the instruction at pc into f.  Return the address predicted to
+ * follow it, and clear *more if fetch should stop there for this cycle.
+ */
+static word_t fetch(word_t pc, fetched_t *f, bool_t *more)
+{
+    byte_t instr = HPACK(I_NOP, F_NONE);
+    byte_t regids = HPACK(REG_NONE, REG_NONE);
+    word_t valp = pc + 1;
+    bool_t need_regids, need_valc;
+
+    memset(f, 0, sizeof(*f));
+    f->pc = pc;
+    f->status = STAT_AOK;
+    if (!get_byte_val(mem, pc, &instr))
+	f->status = STAT_ADR;
+    f->icode = HI4(instr);
+    f->ifun = LO4(instr);
+    if (f->status == STAT_AOK && f->icode > I_IADDQ)
+	f->status = STAT_INS;
+    need_regids =
+	f->icode == I_RRMOVQ || f->icode == I_ALU || f->icode == I_PUSHQ ||
+	f->icode == I_POPQ || f->icode == I_IRMOVQ || f->icode == I_RMMOVQ ||
+	f->icode == I_MRMOVQ || f->icode == I_IADDQ;
+    need_valc =
+	f->icode == I_IRMOVQ || f->icode == I_RMMOVQ || f->icode == I_MRMOVQ ||
+	f->icode == I_JMP || f->icode == I_CALL || f->icode == I_IADDQ;
+    if (f->status == STAT_AOK) {
+	if (need_regids && !get_byte_val(mem, valp++, &regids))
+	    f->status = STAT_ADR;
+	if (need_valc && !get_word_val(mem, valp, &f->valc))
+	    f->status = STAT_ADR;
+	if (need_valc)
+	    valp += 8;
+	if (f->status == STAT_AOK && f->icode == I_HALT)
+	    f->status = STAT_HLT;
+    }
+    f->ra = HI4(regids);
+    f->rb = LO4(regids);
+    f->valp = valp;
+
+    f->predpc = valp;
+    if (f->status != STAT_AOK) {
+	/* Nothing useful follows */
+	fetch_stopped = TRUE;
+	*more = FALSE;
+	return valp;
+    }
+    if (f->icode == I_JMP)
+	f->predpc = bp_predict(pc, f->ifun, f->valc, valp);
+    else if (f->icode == I_CALL)
+	f->predpc = f->valc;
+    else if (f->icode == I_RET)
+	f->predpc = bp_predict_ret(valp);
+    bp_fetch(f->icode, valp);
+    if (f->predpc != valp)
+	*more = FALSE;
+    return f->predpc;
+}
+
+static void fetch_stage()
+{
+    bool_t more = TRUE;
+    int n;
+
+    if (redirect)
+	return;
+    for (n = 0; n < ooo_config.width && more && !fetch_stopped &&
+	     fq_count < fq_size; n++) {
+	fetched_t *f = &fq[(fq_head + fq_count) % fq_size];
+	fetch_pc = fetch(fetch_pc, f, &more);
+	fq_count++;
+    }
+}
+
+/* Set up the ROB entry t for the fetched instruction f */
+static void rename_entry(fetched_t *f, int t)
+{
+    rob_ent *e = &rob[t];
+    byte_t srca = REG_NONE, srcb = REG_NONE;
+    bool_t reads_cc = FALSE;
+
+    memset(e, 0, sizeof(*e));
+    e->seq = next_seq++;
+    e->status = f->status;
+    e->icode = f->icode;
+    e->ifun = f->ifun;
+    e->pc = f->pc;
+    e->valc = f->valc;
+    e->valp = f->valp;
+    e->predpc = f->predpc;
+    e->dste = e->dstm = REG_NONE;
+    e->ready_e = e->ready_m = NEVER;
+
+    if (e->status == STAT_AOK) {
+	switch (e->icode) {
+	case I_RRMOVQ:
+	    srca = f->ra;
+	    e->dste = f->rb;
+	    if (e->ifun != C_YES) {
+		srcb = f->rb;
+		reads_cc = TRUE;
+	    }
+	    break;
+	case I_IRMOVQ:
+	    e->dste = f->rb;
+	    break;
+	case I_RMMOVQ:
+	    srca = f->ra;
+	    srcb = f->rb;
+	    break;
+	case I_MRMOVQ:
+	    srcb = f->rb;
+	    e->dstm = f->ra;
+	    break;
+	case I_ALU:
+	    srca = f->ra;
+	    srcb = f->rb;
+	    e->dste = f->rb;
+	    break;
+	case I_IADDQ:
+	    srcb = f->rb;
+	    e->dste = f->rb;
+	    break;
+	case I_JMP:
+	    reads_cc = TRUE;
+	    break;
+	case I_PUSHQ:
+	    srca = f->ra;
+	    /* Fall through */
+	case I_CALL:
+	    srcb = REG_RSP;
+	    e->dste = REG_RSP;
+	    break;
+	case I_POPQ:
+	    e->dstm = f->ra;
+	    /* Fall through */
+	case I_RET:
+	    srca = REG_RSP;
+	    srcb = REG_RSP;
+	    e->dste = REG_RSP;
+	    break;
+	default:
+	    break;
+	}
+    }
+    rename_src(srca, &e->a);
+    rename_src(srcb, &e->b);
+    if (reads_cc && rat_cc.tag >= 0) {
+	e->c = rat_cc;
+    } else {
+	e->c.tag = -1;
+	e->c.val = cc;
+    }
+    rename_dsts(t);
+
+    if (e->status != STAT_AOK || e->icode == I_NOP) {
+	/* Nothing to execute */
+	e->ready_e = e->ready_m = now + 1;
+    } else {
+	e->in_rs = TRUE;
+	rs_used++;
+	if (is_load(e->icode) || is_store(e->icode)) {
+	    e->in_lsq = TRUE;
+	    lsq_used++;
+	}
+    }
+}
+
+static void dispatch_stage()
+{
+    ooo_config_t *g = &ooo_config;
+    int n;
+    dstall_t why = DS_FETCH;
+
+    for (n = 0; n < g->width; n++) {
+	fetched_t *f = &fq[fq_head];
+	bool_t exec, mem_op;
+	if (fq_count == 0) {
+	    why = DS_FETCH;
+	    break;
+	}
+	exec = f->status == STAT_AOK && f->icode != I_NOP;
+	mem_op = exec && (is_load(f->icode) || is_store(f->icode));
+	if (rob_count == g->rob) {
+	    why = DS_ROB;
+	    break;
+	}
+	if (exec && rs_used == g->rs) {
+	    why = DS_RS;
+	    break;
+	}
+	if (mem_op && lsq_used == g->lsq) {
+	    why = DS_LSQ;
+	    break;
+	}
+	rename_entry(f, rob_index(rob_count));
+	rob_count++;
+	fq_head = (fq_head + 1) % fq_size;
+	fq_count--;
+    }
+    if (retiring && n < g->width)
+	dstalls[why]++;
+}
+
+/* Execute the i'th oldest entry.  Return FALSE if it was a mispredicted
+   jump, whose younger instructions have been flushed */
+static bool_t execute(int i)
+{
+    rob_ent *e = &rob[rob_index(i)];
+    word_t a = opnd_val(&e->a);
+    word_t b = opnd_val(&e->b);
+    cc_t ccv = opnd_cc(&e->c);
+    word_t alua = 0, alub = 0;
+    alu_t fun = A_ADD;
+    word_t actual;
+
+    e->in_rs = FALSE;
+    rs_used--;
+    e->issued = TRUE;
+    e->issue_cycle = now;
+    e->ready_e = e->ready_m = now + 1;
+
+    switch (e->icode) {
+    case I_RRMOVQ:
+	alua = cond_holds(ccv, e->ifun) ? a : b;
+	break;
+    case I_IRMOVQ:
+	alua = e->valc;
+	break;
+    case I_RMMOVQ:
+    case I_MRMOVQ:
+    case I_IADDQ:
+	alua = e->valc;
+	alub = b;
+	break;
+    case I_ALU:
+	alua = a;
+	alub = b;
+	fun = e->ifun;
+	break;
+    case I_CALL:
+    case I_PUSHQ:
+	alua = -8;
+	alub = b;
+	break;
+    case I_RET:
+    case I_POPQ:
+	alua = 8;
+	alub = b;
+	break;
+    default:
+	break;
+    }
+    e->vale = compute_alu(fun, alua, alub);
+    if (e->icode == I_ALU || e->icode == I_IADDQ)
+	e->cc = compute_cc(fun, alua, alub);
+
+    if (is_store(e->icode)) {
+	e->addr = e->vale;
+	e->data = e->icode == I_CALL ? e->valp : a;
+	if (e->addr < 0 || e->addr + 8 > mem->len)
+	    e->status = STAT_ADR;
+    } else if (is_load(e->icode)) {
+	e->addr = e->icode == I_MRMOVQ ? e->vale : a;
+	/* Value comes from the load stage */
+	e->ready_m = NEVER;
+    } else if (e->icode == I_JMP) {
+	e->taken = cond_holds(ccv, e->ifun);
+	actual = e->taken ? e->valc : e->valp;
+	if (actual != e->predpc) {
+	    jump_flushes++;
+	    flush_after(i, actual);
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+static void issue_stage()
+{
+    int i, n = 0;
+    for (i = 0; i < rob_count && n < ooo_config.width; i++) {
+	rob_ent *e = &rob[rob_index(i)];
+	if (!e->in_rs || !opnd_ready(&e->a) || !opnd_ready(&e->b) ||
+	    !opnd_ready(&e->c))
+	    continue;
+	n++;
+	if (!execute(i))
+	    break;
+    }
+}
+
+/*
+ * Can the load at the i'th oldest entry read memory?  If the youngest
+ * older store writing its address can give it the data, set *fwd.
+ */
+static bool_t load_ready(int i, rob_ent **fwd)
+{
+    rob_ent *l = &rob[rob_index(i)];
+    int j;
+    *fwd = NULL;
+    for (j = i - 1; j >= 0; j--) {
+	rob_ent *s = &rob[rob_index(j)];
+	if (!s->in_lsq || !is_store(s->icode))
+	    continue;
+	if (!s->issued)
+	    return FALSE;
+	if (s->status != STAT_AOK)
+	    continue;
+	if (s->addr + 8 <= l->addr || l->addr + 8 <= s->addr)
+	    continue;
+	if (s->addr != l->addr)
+	    return FALSE;
+	*fwd = s;
+	return TRUE;
+    }
+    return TRUE;
+}
+
+static void load_stage()
+{
+    int i;
+    for (i = 0; i < rob_count; i++) {
+	rob_ent *e = &rob[rob_index(i)];
+	rob_ent *fwd;
+	if (!is_load(e->icode) || !e->issued || e->loaded ||
+	    e->issue_cycle >= now)
+	    continue;
+	if (!load_ready(i, &fwd))
+	    continue;
+	e->loaded = TRUE;
+	e->ready_m = now + 1;
+	if (fwd) {
+	    e->valm = fwd->data;
+	    forwards++;
+	} else if (!get_word_val(mem, e->addr, &e->valm)) {
+	    e->status = STAT_ADR;
+	}
+	if (e->icode == I_RET && e->status == STAT_AOK &&
+	    e->valm != e->predpc) {
+	    ret_flushes++;
+	    flush_after(i, e->valm);
+	}
+	/* One memory port */
+	break;
+    }
+}
+
+/* Has a store to addr overwritten an instruction in flight? */
+static bool_t stale_code(word_t addr)
+{
+    int i;
+    for (i = 0; i < rob_count; i++) {
+	rob_ent *e = &rob[rob_index(i)];
+	if (e->pc < addr + 8 && addr < e->valp)
+	    return TRUE;
+    }
+    for (i = 0; i < fq_count; i++) {
+	fetched_t *f = &fq[(fq_head + i) % fq_size];
+	if (f->pc < addr + 8 && addr < f->valp)
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+/* Copy the results of entry t to the operands that name it */
+static void broadcast(int t)
+{
+    rob_ent *p = &rob[t];
+    int i, r;
+    for (i = 0; i < rob_count; i++) {
+	rob_ent *e = &rob[rob_index(i)];
+	opnd_t *o[3] = { &e->a, &e->b, &e->c };
+	int k;
+	for (k = 0; k < 3; k++) {
+	    if (o[k]->tag != t)
+		continue;
+	    o[k]->val = k == 2 ? p->cc : o[k]->mport ? p->valm : p->vale;
+	    o[k]->tag = -1;
+	}
+    }
+    for (r = 0; r < REG_NONE; r++)
+	if (rat[r].tag == t)
+	    rat[r].tag = -1;
+    if (rat_cc.tag == t)
+	rat_cc.tag = -1;
+}
+
+/*
+ * Commit finished instructions from the head of the ROB, at most
+ * max_retire of them, calling commit (if not NULL) after each.  Return
+ * how many committed, and set *statp to the status of the last one.
+ */
+static int commit_stage(word_t max_retire, commit_fn commit, void *arg,
+			byte_t *statp)
+{
+    int n = 0;
+    while (n < ooo_config.width && n < max_retire && rob_count > 0) {
+	int t = rob_head;
+	rob_ent *e = &rob[t];
+	if (e->ready_e > now || e->ready_m > now)
+	    break;
+	if (e->status == STAT_AOK) {
+	    if (e->dste != REG_NONE)
+		set_reg_val(reg, e->dste, e->vale);
+	    if (e->dstm != REG_NONE)
+		set_reg_val(reg, e->dstm, e->valm);
+	    if (is_store(e->icode))
+		set_word_val(mem, e->addr, e->data);
+	    if (e->icode == I_ALU || e->icode == I_IADDQ)
+		cc = e->cc;
+	    if (e->icode == I_JMP)
+		bp_resolve_jump(e->pc, e->ifun, e->taken, e->valc, e->predpc);
+	    if (e->icode == I_RET)
+		bp_resolve_ret(e->valm, e->predpc);
+	}
+	if (dumpfile)
+	    sim_log("\tCommit: %s at 0x%llx, Stat = %s\n",
+		    iname(HPACK(e->icode, e->ifun)), e->pc,
+		    stat_name(e->status));
+	if (e->in_lsq)
+	    lsq_used--;
+	rob_head = rob_index(1);
+	rob_count--;
+	broadcast(t);
+	*statp = e->status;
+	retiring = TRUE;
+	instructions++;
+	n++;
+	if (commit && !commit(e, arg))
+	    break;
+	if (e->status != STAT_AOK)
+	    break;
+	if (is_store(e->icode) && stale_code(e->addr)) {
+	    /* Self-modifying code: fetch the new instructions */
+	    smc_flushes++;
+	    flush_after(-1, e->valp);
+	    break;
+	}
+    }
+    if (retiring && n == 0) {
+	rob_ent *h = &rob[rob_head];
+	if (rob_count == 0)
+	    cstalls[CS_EMPTY]++;
+	else if (h->issued && is_load(h->icode))
+	    cstalls[CS_LOAD]++;
+	else
+	    cstalls[CS_EXEC]++;
+    }
+    return n;
+}
+
+static void log_rob()
+{
+    int i;
+    for (i = 0; i < rob_count; i++) {
+	rob_ent *e = &rob[rob_index(i)];
+	char *state = e->ready_e <= now && e->ready_m <= now ? "done" :
+	    e->issued ? "executing" : "waiting";
+	sim_log("  %3lld: 0x%.3llx %-7s %-9s %s\n", e->seq, e->pc,
+		iname(HPACK(e->icode, e->ifun)), state, stat_name(e->status));
+    }
+}
+
+/*
+ * Simulate one cycle, committing at most max_retire instructions.
+ * Return how many committed; *statp is set to the status of the last.
+ */
+static int ooo_step(word_t max_retire, commit_fn commit, void *arg,
+		    byte_t *statp)
+{
+    byte_t stat = STAT_AOK;
+    int n;
+
+    /* Start where the PC pipe register of PIPE would (see bench.c) */
+    if (!started) {
+	fetch_pc = pc_next->pc;
+	started = TRUE;
+    }
+    if (dumpfile) {
+	sim_log("\nCycle %lld. CC=%s, Fetch PC = 0x%llx, ROB %d, RS %d, LSQ %d\n",
+		now, cc_name(cc), fetch_pc, rob_count, rs_used, lsq_used);
+	log_rob();
+    }
+
+    redirect = FALSE;
+    n = commit_stage(max_retire, commit, arg, &stat);
+    if (n > 0)
+	*statp = stat;
+    if (retiring)
+	cycles++;
+    if (n == 0 || stat == STAT_AOK) {
+	load_stage();
+	issue_stage();
+	dispatch_stage();
+	fetch_stage();
+	if (retiring) {
+	    rob_hist[rob_count]++;
+	    rs_hist[rs_used]++;
+	    lsq_hist[lsq_used]++;
+	}
+    }
+    now++;
+    return n;
+}
+
+word_t ooo_run_pipe(word_t max_instr, word_t max_cycle,
+		    byte_t *statusp, cc_t *ccp)
+{
+    word_t icount = 0;
+    word_t ccount = 0;
+    byte_t run_status = STAT_AOK;
+
+    while (icount < max_instr && ccount < max_cycle) {
+	icount += ooo_step(max_instr - icount, NULL, NULL, &run_status);
+	if (run_status != STAT_AOK)
+	    break;
+	ccount++;
+    }
+    if (statusp)
+	*statusp = run_status;
+    if (ccp)
+	*ccp = cc;
+    return icount;
+}
+
+/* State of a lockstep run against the ISA simulator */
+typedef struct {
+    state_ptr isa;
+    byte_t isa_status;
+    word_t ccount;
+    check_ptr c;
+} check_arg_rec, *check_arg_ptr;
+
+static bool_t check_commit(rob_ent *e, void *arg)
+{
+    check_arg_ptr a = (check_arg_ptr) arg;
+    a->isa_status = step_state(a->isa, NULL);
+    a->c->pc = e->pc;
+    a->c->cycle = a->ccount;
+    if (!check_state(a->isa, a->isa_status, reg, mem, e->status,
+		     TRUE, cc, a->c)) {
+	a->c->ok = FALSE;
+	return FALSE;
+    }
+    a->c->instr++;
+    return TRUE;
+}
+
+void ooo_check_prog(mem_t image, word_t max_instr, check_ptr c)
+{
+    check_arg_rec a;
+    byte_t run_status = STAT_AOK;
+
+    sim_reset();
+    set_mem(mem, image);
+    a.isa = new_state(mem->len);
+    set_mem(a.isa->m, mem);
+    a.isa->cc = cc;
+    a.isa_status = STAT_AOK;
+    a.c = c;
+
+    c->ok = TRUE;
+    c->instr = 0;
+    for (a.ccount = 0; c->instr < max_instr && a.ccount < 5*max_instr;
+	 a.ccount++) {
+	ooo_step(max_instr - c->instr, check_commit, &a, &run_status);
+	if (!c->ok || run_status != STAT_AOK)
+	    break;
+    }
+    c->stat = run_status;
+    if (c->ok && run_status == STAT_AOK && c->instr < max_instr) {
+	c->ok = FALSE;
+	snprintf(c->what, sizeof(c->what),
+		 "Cycle limit reached, ISA status %s", stat_name(a.isa_status));
+    }
+    free_state(a.isa);
+}
+
+/* Print the histogram of an occupancy between 0 and size */
+static void report_hist(FILE *f, char *name, word_t *hist, int size)
+{
+    int bin = (size + HIST_BINS) / HIST_BINS;
+    word_t total = 0, sum = 0;
+    int i, lo;
+
+    for (i = 0; i <= size; i++) {
+	total += hist[i];
+	sum += i * hist[i];
+    }
+    fprintf(f, "  %s occupancy: mean %.2f of %d\n", name,
+	    total > 0 ? (double) sum / total : 0.0, size);
+    for (lo = 0; lo <= size; lo += bin) {
+	int hi = lo + bin - 1 < size ? lo + bin - 1 : size;
+	word_t n = 0;
+	for (i = lo; i <= hi; i++)
+	    n += hist[i];
+	if (n > 0)
+	    fprintf(f, "    %3d-%-3d %6.2f%%\n", lo, hi, 100.0 * n / total);
+    }
+}
+
+void ooo_report(FILE *f)
+{
+    ooo_config_t *g = &ooo_config;
+    int i;
+
+    fprintf(f, "Out-of-order core: %d ROB, %d RS, %d LSQ entries, %d wide\n",
+	    g->rob, g->rs, g->lsq, g->width);
+    fprintf(f, "  IPC %.2f\n",
+	    cycles > 0 ? (double) instructions / cycles : 0.0);
+    fprintf(f, "  Dispatch stopped by:");
+    for (i = 0; i < DS_NCAUSE; i++)
+	fprintf(f, " %s %lld%s", dstall_names[i], dstalls[i],
+		i < DS_NCAUSE-1 ? "," : "\n");
+    fprintf(f, "  Nothing committed, head waiting for:");
+    for (i = 0; i < CS_NCAUSE; i++)
+	fprintf(f, " %s %lld%s", cstall_names[i], cstalls[i],
+		i < CS_NCAUSE-1 ? "," : "\n");
+    fprintf(f, "  Flushes: %lld jumps, %lld returns, %lld stores to code\n",
+	    jump_flushes, ret_flushes, smc_flushes);
+    fprintf(f, "  Loads forwarded from stores: %lld\n", forwards);
+    report_hist(f, "ROB", rob_hist, g->rob);
+    report_hist(f, "RS", rs_hist, g->rs);
+    report_hist(f, "LSQ", lsq_hist, g->lsq);
+}
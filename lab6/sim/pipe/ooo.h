@@ -0,0 +1,51 @@
+/*
+ * ooo.h - Out-of-order Y86-64 core in the style of Tomasulo
+ *
+ * Instructions are fetched and renamed in order into a reorder buffer
+ * (ROB), wait in reservation stations (RS) until their operands are
+ * ready, execute out of order, and commit in order from the head of
+ * the ROB.  Memory instructions also hold a load/store queue (LSQ)
+ * entry.  Like wide.c, the model runs on psim's program state, so -t,
+ * -B and -T check and benchmark it as they do the HCL pipelines.
+ */
+
+#ifndef OOO_H
+#define OOO_H
+
+/* Sizes of the core */
+typedef struct {
+    int rob;     /* Reorder buffer entries */
+    int rs;      /* Reservation station entries */
+    int lsq;     /* Load/store queue entries */
+    int width;   /* Instructions fetched, dispatched, issued and
+		    committed per cycle */
+} ooo_config_t;
+
+/* Simulate the out-of-order core instead of the HCL pipeline? (-O) */
+extern bool_t ooo_mode;
+extern ooo_config_t ooo_config;
+
+/*
+ * Parse a specification of the form rob:rs:lsq[:width] into c.
+ * Return FALSE if it is malformed.
+ */
+bool_t ooo_parse(char *spec, ooo_config_t *c);
+
+/* Allocate, empty and free the core of the calling thread.  After a
+   reset, fetch starts at the address in pc_next */
+void ooo_init();
+void ooo_reset();
+void ooo_free();
+
+/* Same contract as sim_run_pipe */
+word_t ooo_run_pipe(word_t max_instr, word_t max_cycle,
+		    byte_t *statusp, cc_t *ccp);
+
+/* Same contract as sim_check_prog.  Registers, memory and condition
+   codes are compared as each instruction commits */
+void ooo_check_prog(mem_t image, word_t max_instr, check_ptr c);
+
+/* Print IPC, stall causes and occupancy histograms */
+void ooo_report(FILE *f);
+
+#endif /* OOO_H */
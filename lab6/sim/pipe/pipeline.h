@@ -51,6 +51,9 @@ void update_pipes();
 /* Set all pipes to bubble values */
 void clear_pipes();
 
+/* Release all pipes */
+void free_pipes();
+
 /* Utility code */
 
 /* Print hex/oct/binary format with leading zeros */
@@ -15,6 +15,15 @@
 #include "pipeline.h"
 #include "stages.h"
 #include "sim.h"
+#include "bench.h"
+#include "tune.h"
+#include "ptsuite.h"
+#include "batch.h"
+#include "bpred.h"
+#include "hazard.h"
+#include "cache.h"
+#include "wide.h"
+#include "ooo.h"
 
 #define MAXBUF 1024
 #define DEFAULTNAME "Y86-64 Simulator: "
@@ -41,8 +50,23 @@ int gui_mode = FALSE;    /* Run in GUI mode instead of TTY mode? (-g) */
 char *object_filename;   /* The input object file name. */
 FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
+bool_t verbosity_set = FALSE; /* Was -v given? */
+bool_t bp_set = FALSE;   /* Was -p, -b or -r given? */
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
+bool_t do_bench = FALSE; /* Benchmark ncopy kernel? [TTY only] (-B) */
+int bench_len = BENCH_MAXLEN; /* Largest block length for -B (-n) */
+int sim_threads = 1;     /* Number of simulator threads for -B, -T (-j) */
+unsigned bench_seed = 1; /* Seed for the -B source data (-s) */
+int check_rounds = 1;    /* Random inputs per length checked by -B, -u (-C) */
+bool_t do_ptest = FALSE; /* Run the ptest suite natively? (-T) */
+bool_t ptest_iaddq = FALSE; /* Include iaddq tests in the suite? (-i) */
+bool_t do_batch = FALSE; /* Run many object files, CSV summary? (-c) */
+char *tune_filename = NULL; /* Write best generated ncopy kernel to (-u) */
+char *annotate_filename = NULL; /* Annotated listing of lost cycles (-a) */
+bool_t use_icache = FALSE; /* Model instruction cache? (-I) */
+bool_t use_dcache = FALSE; /* Model data cache? (-D) */
+cache_config_t icache_config, dcache_config;
 
 /************* 
  * End Globals 
@@ -56,6 +80,12 @@ bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
 word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+static void run_bench_sim();             /* Benchmark ncopy kernel (-B) */
+static void run_ptest_sim();             /* Run ptest suite (-T) */
+static void run_batch_sim(char **files, int nfiles); /* Batch mode (-c) */
+static void run_tune_sim();              /* Tune ncopy kernel (-u) */
+static void annotate_listing();          /* Write listing for -a */
+static void report_caches();             /* Print cache statistics */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -84,7 +114,7 @@ int sim_main(int argc, char **argv)
     char *myargv[MAXARGS];
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgBTiHwcl:v:n:j:s:p:b:r:a:I:D:O:u:C:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -98,6 +128,7 @@ int sim_main(int argc, char **argv)
 		printf("Invalid verbosity %d\n", verbosity);
 		usage(argv[0]);
 	    }
+	    verbosity_set = TRUE;
 	    break;
 	case 't':
 	    do_check = TRUE;
@@ -105,6 +136,99 @@ int sim_main(int argc, char **argv)
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
+	case 'B':
+	    do_bench = TRUE;
+	    break;
+	case 'T':
+	    do_ptest = TRUE;
+	    break;
+	case 'c':
+	    do_batch = TRUE;
+	    break;
+	case 'i':
+	    ptest_iaddq = TRUE;
+	    break;
+	case 'H':
+	    hz_enabled = TRUE;
+	    break;
+	case 'w':
+	    wide_mode = TRUE;
+	    break;
+	case 'O':
+	    ooo_mode = ooo_parse(optarg, &ooo_config);
+	    if (!ooo_mode) {
+		printf("Invalid core specification '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'a':
+	    hz_enabled = TRUE;
+	    annotate_filename = optarg;
+	    break;
+	case 'I':
+	    use_icache = cache_parse(optarg, &icache_config);
+	    if (!use_icache) {
+		printf("Invalid cache specification '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'D':
+	    use_dcache = cache_parse(optarg, &dcache_config);
+	    if (!use_dcache) {
+		printf("Invalid cache specification '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'u':
+	    tune_filename = optarg;
+	    break;
+	case 'n':
+	    bench_len = atoi(optarg);
+	    if (bench_len < 0 || bench_len > BENCH_MAXLEN) {
+		printf("n must be between 0 and %d\n", BENCH_MAXLEN);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'j':
+	    sim_threads = atoi(optarg);
+	    if (sim_threads < 1) {
+		printf("Invalid thread count %d\n", sim_threads);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'C':
+	    check_rounds = atoi(optarg);
+	    if (check_rounds < 0) {
+		printf("Invalid number of inputs per length %d\n", check_rounds);
+		usage(argv[0]);
+	    }
+	    break;
+	case 's':
+	    bench_seed = strtoul(optarg, NULL, 0);
+	    break;
+	case 'p':
+	    if (!bp_set_type(optarg)) {
+		printf("Unknown branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    bp_set = TRUE;
+	    break;
+	case 'b':
+	    bp_bits = atoi(optarg);
+	    if (bp_bits < 0 || bp_bits > 20) {
+		printf("Predictor table bits must be between 0 and 20\n");
+		usage(argv[0]);
+	    }
+	    bp_set = TRUE;
+	    break;
+	case 'r':
+	    bp_ras_depth = atoi(optarg);
+	    if (bp_ras_depth < 0) {
+		printf("Invalid return-address stack depth %d\n", bp_ras_depth);
+		usage(argv[0]);
+	    }
+	    bp_set = TRUE;
+	    break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -112,6 +236,45 @@ int sim_main(int argc, char **argv)
 	}
     }
 
+    /* The C models have no GUI, hazard profile or caches */
+    if ((wide_mode || ooo_mode) &&
+	(gui_mode || hz_enabled || use_icache || use_dcache)) {
+	printf("-w and -O can't be combined with -g, -H, -a, -I or -D\n");
+	usage(argv[0]);
+    }
+    if (wide_mode && ooo_mode) {
+	printf("Choose one of -w and -O\n");
+	usage(argv[0]);
+    }
+    if (do_batch && (gui_mode || do_bench || do_ptest || hz_enabled)) {
+	printf("-c can't be combined with -g, -B, -T, -H or -a\n");
+	usage(argv[0]);
+    }
+
+    if (tune_filename && (gui_mode || do_bench || do_ptest || do_batch ||
+			  do_check || hz_enabled)) {
+	printf("-u can't be combined with -g, -B, -T, -c, -t, -H or -a\n");
+	usage(argv[0]);
+    }
+
+    /* Search for the best ncopy kernel (-u flag) */
+    if (tune_filename) {
+	if (optind < argc) {
+	    printf("-u takes no object file argument\n");
+	    usage(argv[0]);
+	}
+	run_tune_sim();
+    }
+
+    /* Run every object file given in batch mode (-c flag) */
+    if (do_batch) {
+	if (optind == argc) {
+	    printf("Missing object file arguments in batch mode\n");
+	    usage(argv[0]);
+	}
+	run_batch_sim(argv + optind, argc - optind);
+    }
+
 
     /* Do we have too many arguments? */
     if (optind < argc - 1) {
@@ -128,7 +291,7 @@ int sim_main(int argc, char **argv)
     object_file = NULL;
     if (optind < argc) {
 	object_filename = argv[optind];
-	object_file = fopen(object_filename, "r");
+	object_file = open_object(object_filename);
 	if (!object_file) {
 	    fprintf(stderr, "Couldn't open object file %s\n", object_filename);
 	    exit(1);
@@ -169,6 +332,24 @@ int sim_main(int argc, char **argv)
 	exit(0);
     }
 
+    /* Benchmark an ncopy kernel over all block lengths (-B flag) */
+    if (do_bench) {
+	if (!object_filename) {
+	    printf("Missing kernel file argument in benchmark mode\n");
+	    usage(argv[0]);
+	}
+	fclose(object_file);
+	run_bench_sim();
+	exit(0);
+    }
+
+    /* Run the processor tests of ../ptest in process (-T flag) */
+    if (do_ptest) {
+	if (object_file)
+	    fclose(object_file);
+	run_ptest_sim();
+    }
+
     /* Otherwise, run the simulator in TTY mode (no -g flag) */
     run_tty_sim();
 
@@ -185,7 +366,7 @@ static void run_tty_sim()
     cc_t result_cc = 0;
     word_t byte_cnt = 0;
     mem_t mem0, reg0;
-    state_ptr isa_state = NULL;
+    check_rec check;
 
 
     /* In TTY mode, the default object file comes from stdin */
@@ -209,19 +390,21 @@ static void run_tty_sim()
 	printf("%lld bytes of code read\n", byte_cnt);
     }
     fclose(object_file);
-    if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
-	isa_state->cc = cc;
-    }
 
     mem0 = copy_mem(mem);
     reg0 = copy_mem(reg);
     
-    icount = sim_run_pipe(instr_limit, 5*instr_limit, &run_status, &result_cc);
+    if (do_check) {
+	/* Run in lockstep with the ISA simulator, stopping at the first
+	   instruction where the two disagree */
+	sim_check_prog(mem0, instr_limit, &check);
+	icount = check.instr;
+	run_status = check.stat;
+	result_cc = cc;
+    } else {
+	icount = sim_run_pipe(instr_limit, 5*instr_limit,
+			      &run_status, &result_cc);
+    }
     if (verbosity > 0) {
 	printf("%lld instructions executed\n", icount);
 	printf("Status = %s\n", stat_name(run_status));
@@ -232,39 +415,15 @@ static void run_tty_sim()
 	diff_mem(mem0, mem, stdout);
     }
     if (do_check) {
-	byte_t e = STAT_AOK;
-	word_t step;
-	bool_t match = TRUE;
-
-	for (step = 0; step < instr_limit && e == STAT_AOK; step++) {
-	    e = step_state(isa_state, stdout);
-	}
-
-	if (diff_reg(isa_state->r, reg, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Register != Pipeline Register File\n");
-		diff_reg(isa_state->r, reg, stdout);
-	    }
-	}
-	if (diff_mem(isa_state->m, mem, NULL)) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Memory != Pipeline Memory\n");
-		diff_mem(isa_state->m, mem, stdout);
-	    }
-	}
-	if (isa_state->cc != result_cc) {
-	    match = FALSE;
-	    if (verbosity > 0) {
-		printf("ISA Cond. Codes (%s) != Pipeline Cond. Codes (%s)\n",
-		       cc_name(isa_state->cc), cc_name(result_cc));
-	    }
-	}
-	if (match) {
+	if (check.ok) {
 	    printf("ISA Check Succeeds\n");
 	} else {
+	    byte_t instr = 0;
+	    get_byte_val(mem0, check.pc, &instr);
 	    printf("ISA Check Fails\n");
+	    printf("Cycle %lld, instruction %lld, PC 0x%llx (%s): %s\n",
+		   check.cycle, check.instr, check.pc, iname(instr),
+		   check.what);
 	}
     }
 
@@ -274,7 +433,148 @@ static void run_tty_sim()
 	printf("CPI: %lld cycles/%lld instructions = %.2f\n",
 	       cycles, instructions, cpi);
     }
+    if (verbosity > 0) {
+	/* Only pipe-bp.hcl asks the predictor anything */
+	if (bp_set || bp_consulted())
+	    bp_report(stdout, cycles);
+	report_caches();
+	if (wide_mode)
+	    wide_report(stdout);
+	if (ooo_mode)
+	    ooo_report(stdout);
+    }
+    if (hz_enabled) {
+	hz_merge();
+	hz_report(stdout, mem0, cycles);
+	annotate_listing();
+    }
+
+}
+
+/*
+ * run_bench_sim - Measure the CPE of the ncopy kernel in object_filename,
+ * the way benchmark.pl does, without leaving the simulator
+ */
+static void run_bench_sim()
+{
+    kernel_rec k;
+    bench_result_t result[BENCH_MAXLEN+1];
+    double cpe;
+    int i, bad;
+
+    if (!bench_load_kernel(&k, object_filename))
+	exit(1);
+    bad = bench_run(&k, bench_len, sim_threads, bench_seed,
+		    instr_limit, result);
+
+    if (verbosity > 0)
+	printf("\t%s\n", object_filename);
+    for (i = 0; i <= bench_len; i++) {
+	if (verbosity > 0) {
+	    if (i > 0)
+		printf("%d\t%lld\t%.2f", i, result[i].cycles,
+		       (double) result[i].cycles / i);
+	    else
+		printf("%d\t%lld", i, result[i].cycles);
+	    printf("%s\n", result[i].ok ? "" : "\tIncorrect result");
+	}
+    }
+    cpe = bench_cpe(result, bench_len);
+    printf("Average CPE\t%.2f\n", cpe);
+    printf("Score\t%.1f/%.1f\n", bench_score(cpe), BENCH_POINTS);
+    if (bad)
+	printf("%d/%d lengths gave incorrect results\n", bad, bench_len+1);
+    if (check_rounds > 0) {
+	bool_t ok[BENCH_CHECKLEN+1];
+	int len[BENCH_CHECKLENS];
+	int ninputs = bench_check_lengths(bench_len, len) * check_rounds;
+	bad = bench_check(&k, bench_len, check_rounds, bench_seed,
+			  instr_limit, ok);
+	printf("ISA check: %d/%d inputs correct\n", ninputs - bad, ninputs);
+	for (i = 0; bad && i <= BENCH_CHECKLEN; i++)
+	    if (!ok[i])
+		printf("\tIncorrect result for length %d\n", i);
+    }
+    if (hz_enabled) {
+	word_t total_cycles = 0;
+	for (i = 0; i <= bench_len; i++)
+	    total_cycles += result[i].cycles;
+	hz_report(stdout, k.image, total_cycles);
+	annotate_listing();
+    }
+    bench_free_kernel(&k);
+}
+
+/*
+ * run_ptest_sim - Run the tests generated by the scripts in ../ptest,
+ * checking each against the ISA simulator instruction by instruction
+ */
+static void run_ptest_sim()
+{
+    int errors = ptest_run(simname, ptest_iaddq, sim_threads,
+			   instr_limit, verbosity);
+    exit(errors ? 1 : 0);
+}
+
+/*
+ * annotate_listing - Write the object file, with the lost cycles of
+ * each instruction in front of it, to annotate_filename
+ */
+static void annotate_listing()
+{
+    FILE *out;
+    if (!annotate_filename)
+	return;
+    if (!object_filename) {
+	printf("Can't annotate listing read from stdin\n");
+	return;
+    }
+    out = fopen(annotate_filename, "w");
+    if (!out) {
+	fprintf(stderr, "Couldn't open annotation file %s\n", annotate_filename);
+	return;
+    }
+    if (!hz_annotate(object_filename, out))
+	fprintf(stderr, "Couldn't read object file %s\n", object_filename);
+    fclose(out);
+}
 
+/*
+ * run_batch_sim - Run each of the object files, printing a CSV summary
+ * rather than the TTY report.  Cycles are only traced, to stderr, if
+ * -v 2 is given.
+ */
+static void run_batch_sim(char **files, int nfiles)
+{
+    FILE *trace = verbosity_set && verbosity >= 2 ? stderr : NULL;
+    int errors = batch_run(files, nfiles, sim_threads, instr_limit,
+			   do_check, trace);
+    exit(errors ? 1 : 0);
+}
+
+/*
+ * run_tune_sim - Generate, check and benchmark ncopy variants, and
+ * write the fastest one that fits in TUNE_MAXBYTES to tune_filename
+ */
+static void run_tune_sim()
+{
+    FILE *out = fopen(tune_filename, "w");
+    bool_t found;
+
+    if (!out) {
+	fprintf(stderr, "Couldn't open kernel output file %s\n", tune_filename);
+	exit(1);
+    }
+    found = tune_run(bench_len, check_rounds > 0 ? check_rounds : 1,
+		     sim_threads, bench_seed, instr_limit, verbosity > 0, out);
+    fclose(out);
+    if (!found) {
+	printf("No variant was correct and short enough\n");
+	remove(tune_filename);
+	exit(1);
+    }
+    printf("Kernel written to %s\n", tune_filename);
+    exit(0);
 }
 
 /*
@@ -282,13 +582,35 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgBTiHwc] [-l m] [-v n] [-n N] [-j J] [-s S] [-p P] [-b B] [-r R] [-a F]\n       [-I C] [-D C] [-O C] [-u F] [-C R] file.yo\n", name);
     printf("file.yo arg required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
-    printf("   -t     Test result against ISA simulator [TTY mode only]\n");
+    printf("   -t     Check every instruction against ISA simulator [TTY mode only]\n");
+    printf("   -B     Benchmark the ncopy kernel in file.yo (replaces benchmark.pl)\n");
+    printf("   -n N   Set max block length to benchmark, up to %d (default %d)\n", BENCH_MAXLEN, bench_len);
+    printf("   -j J   Simulate the block lengths, tests or files on J threads (default %d)\n", sim_threads);
+    printf("   -s S   Seed for the benchmark source data (default %u)\n", bench_seed);
+    printf("   -C R   Check R random inputs of each length on the ISA simulator (default %d)\n", check_rounds);
+    printf("   -u F   Search for the fastest ncopy kernel under %d bytes, write it to F\n", TUNE_MAXBYTES);
+    printf("   -T     Run the ptest suite against the ISA simulator (replaces ptest/*.pl)\n");
+    printf("   -i     Include the iaddq tests in the ptest suite\n");
+    printf("   -c     Run every file.yo given and print a CSV summary (batch mode)\n");
+    printf("   -p P   Branch predictor consulted by pipe-bp.hcl: taken, nt, btfnt,\n");
+    printf("          2bit, gshare or btb (default %s)\n", bp_type_name(bp_type));
+    printf("   -b B   Predictor has 2^B counters or BTB entries (default %d, btb %d)\n",
+	   BP_TABLE_BITS, BP_BTB_BITS);
+    printf("   -r R   Return-address stack depth, 0 for none (default %d)\n", bp_ras_depth);
+    printf("   -H     Report cycles lost to hazards by cause and instruction\n");
+    printf("   -a F   Same, and write file.yo annotated with lost cycles to F\n");
+    printf("   -I C   Model an instruction cache, C = sets:ways:bsize:latency\n");
+    printf("   -D C   Model a data cache, C = sets:ways:bsize:latency[:wb|:wt]\n");
+    printf("   -w     Simulate the two-wide pipeline of wide.c instead of the HCL\n");
+    printf("   -O C   Simulate the out-of-order core of ooo.c instead of the HCL,\n");
+    printf("          C = rob:rs:lsq[:width] (e.g. %d:%d:%d:%d)\n",
+	   ooo_config.rob, ooo_config.rs, ooo_config.lsq, ooo_config.width);
     exit(0);
 }
 
@@ -304,75 +626,93 @@ static void usage(char *name)
 
 /* Performance monitoring */
 /* How many cycles have been simulated? */
-word_t cycles = 0;
+SIM_TLS word_t cycles = 0;
 /* How many instructions have passed through the WB stage? */
-word_t instructions = 0;
+SIM_TLS word_t instructions = 0;
 
 /* Has simulator gotten past initial bubbles? */
-static int starting_up = 1;
+static SIM_TLS int starting_up = 1;
+
+/* Why the bubble in each pipe register was inserted, and by which
+   instruction (for -H) */
+static SIM_TLS hazard_t hazard_cause[WB_STAGE+1];
+static SIM_TLS word_t hazard_pc[WB_STAGE+1];
+
+/* Caches (-I, -D), cycles until the pending miss of each is served,
+   which access that missed has just been served (so it isn't made
+   again), and whether it replaced a load of a pipe register with a
+   bubble */
+static SIM_TLS cache_t icache = NULL;
+static SIM_TLS cache_t dcache = NULL;
+static SIM_TLS int icache_wait = 0;
+static SIM_TLS int dcache_wait = 0;
+static SIM_TLS word_t icache_served = -1;
+static SIM_TLS bool_t dcache_served = FALSE;
+static SIM_TLS bool_t icache_bubble = FALSE;
+static SIM_TLS bool_t dcache_bubble = FALSE;
 
 
 
 /* Both instruction and data memory */
-mem_t mem;
-word_t minAddr = 0;
-word_t memCnt = 0;
+SIM_TLS mem_t mem;
+SIM_TLS word_t minAddr = 0;
+SIM_TLS word_t memCnt = 0;
 
 /* Register file */
-mem_t reg;
+SIM_TLS mem_t reg;
 /* Condition code register */
-cc_t cc;
+SIM_TLS cc_t cc;
 /* Status code */
-stat_t status;
+SIM_TLS stat_t status;
 
 
 /* Pending updates to state */
-word_t cc_in = DEFAULT_CC;
-word_t wb_destE = REG_NONE;
-word_t wb_valE = 0;
-word_t wb_destM = REG_NONE;
-word_t wb_valM = 0;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-bool_t mem_write = FALSE;
+SIM_TLS word_t cc_in = DEFAULT_CC;
+SIM_TLS word_t wb_destE = REG_NONE;
+SIM_TLS word_t wb_valE = 0;
+SIM_TLS word_t wb_destM = REG_NONE;
+SIM_TLS word_t wb_valM = 0;
+SIM_TLS word_t mem_addr = 0;
+SIM_TLS word_t mem_data = 0;
+SIM_TLS bool_t mem_write = FALSE;
 
 /* EX Operand sources */
-mux_source_t amux = MUX_NONE;
-mux_source_t bmux = MUX_NONE;
+SIM_TLS mux_source_t amux = MUX_NONE;
+SIM_TLS mux_source_t bmux = MUX_NONE;
 
 /* Current and next states of all pipeline registers */
-pc_ptr pc_curr;
-if_id_ptr if_id_curr;
-id_ex_ptr id_ex_curr;
-ex_mem_ptr ex_mem_curr;
-mem_wb_ptr mem_wb_curr;
-
-pc_ptr pc_next;
-if_id_ptr if_id_next;
-id_ex_ptr id_ex_next;
-ex_mem_ptr ex_mem_next;
-mem_wb_ptr mem_wb_next;
+SIM_TLS pc_ptr pc_curr;
+SIM_TLS if_id_ptr if_id_curr;
+SIM_TLS id_ex_ptr id_ex_curr;
+SIM_TLS ex_mem_ptr ex_mem_curr;
+SIM_TLS mem_wb_ptr mem_wb_curr;
+
+SIM_TLS pc_ptr pc_next;
+SIM_TLS if_id_ptr if_id_next;
+SIM_TLS id_ex_ptr id_ex_next;
+SIM_TLS ex_mem_ptr ex_mem_next;
+SIM_TLS mem_wb_ptr mem_wb_next;
 
 /* Intermediate values */
-word_t f_pc;
-byte_t imem_icode;
-byte_t imem_ifun;
-bool_t imem_error;
-bool_t instr_valid;
-word_t d_regvala;
-word_t d_regvalb;
-word_t e_vala;
-word_t e_valb;
-bool_t e_bcond;
-bool_t dmem_error;
+SIM_TLS word_t f_pc;
+SIM_TLS byte_t imem_icode;
+SIM_TLS byte_t imem_ifun;
+SIM_TLS bool_t imem_error;
+SIM_TLS bool_t instr_valid;
+SIM_TLS word_t d_regvala;
+SIM_TLS word_t d_regvalb;
+SIM_TLS word_t e_vala;
+SIM_TLS word_t e_valb;
+SIM_TLS bool_t e_bcond;
+SIM_TLS bool_t dmem_error;
 
 /* The pipeline state */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+SIM_TLS pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
 
 /* Simulator operating mode */
-sim_mode_t sim_mode = S_FORWARD;
+SIM_TLS sim_mode_t sim_mode = S_FORWARD;
 /* Log file */
-FILE *dumpfile = NULL;
+SIM_TLS FILE *dumpfile = NULL;
 
 /*****************************************************************************
  * reporting code
@@ -524,7 +864,156 @@ void sim_stall_stage(stage_id_t stage) {
 }
 
 
-static int initialized = 0;
+/* Print the statistics of the caches modeled, if any */
+static void report_caches()
+{
+    if (icache)
+	cache_report(icache, "I-cache", stdout);
+    if (dcache)
+	cache_report(dcache, "D-cache", stdout);
+}
+
+/*
+ * Tell the branch predictor what the pipeline has done this cycle:
+ * which instruction is passed on to decode, and which jump or ret has
+ * been found to go where.  Instructions that are being squashed are
+ * left out.
+ */
+static void update_predictor()
+{
+    if (if_id_state->op == P_LOAD && if_id_next->status == STAT_AOK)
+	bp_fetch(if_id_next->icode, if_id_next->valp);
+    if (ex_mem_state->op == P_LOAD && id_ex_curr->icode == I_JMP &&
+	id_ex_curr->status == STAT_AOK)
+	bp_resolve_jump(id_ex_curr->stage_pc, id_ex_curr->ifun, e_bcond,
+			id_ex_curr->valc, id_ex_curr->predpc);
+    if (mem_wb_state->op == P_LOAD && ex_mem_curr->icode == I_RET &&
+	mem_wb_next->status == STAT_AOK)
+	bp_resolve_ret(mem_wb_next->valm, ex_mem_curr->predpc);
+}
+
+/* Did instruction with status s stop the pipeline? */
+static bool_t stat_error(byte_t s)
+{
+    return s == STAT_ADR || s == STAT_INS || s == STAT_HLT || s == STAT_PIP;
+}
+
+/*
+ * Find out why a bubble is being inserted into the pipe register of
+ * stage s, and which instruction to blame, from the state in which
+ * do_stall_check left the pipeline.  The HCL files don't say why they
+ * bubble a stage, so the same hazards are recognized here.  Bubbles
+ * requested through sim_bubble_stage and sim_stall_stage show up in
+ * the same pipe register ops.
+ */
+static hazard_t bubble_reason(stage_id_t s, word_t *pcp)
+{
+    byte_t srca = id_ex_next->srca;
+    byte_t srcb = id_ex_next->srcb;
+
+    /* Waiting for a cache */
+    if (s == WB_STAGE && dcache_bubble) {
+	*pcp = ex_mem_curr->stage_pc;
+	return HZ_DCACHE;
+    }
+    if (s == ID_STAGE && icache_bubble) {
+	*pcp = f_pc;
+	return HZ_ICACHE;
+    }
+    /* Exception in memory or write back */
+    if (stat_error(mem_wb_curr->status)) {
+	*pcp = mem_wb_curr->stage_pc;
+	return HZ_ERROR;
+    }
+    if (stat_error(mem_wb_next->status)) {
+	*pcp = ex_mem_curr->stage_pc;
+	return HZ_ERROR;
+    }
+    /* ret in memory has read a return address other than the one fetched */
+    if (ex_mem_curr->icode == I_RET && ex_mem_curr->status == STAT_AOK &&
+	mem_wb_next->valm != ex_mem_curr->predpc) {
+	*pcp = ex_mem_curr->stage_pc;
+	return HZ_RET;
+    }
+    /* Mispredicted jump in execute */
+    if (id_ex_curr->icode == I_JMP && id_ex_curr->status == STAT_AOK &&
+	(e_bcond ? id_ex_curr->valc : id_ex_curr->stage_pc + 9)
+	!= id_ex_curr->predpc) {
+	*pcp = id_ex_curr->stage_pc;
+	return HZ_JUMP;
+    }
+    /* Decode held back waiting for an operand */
+    if (s == EX_STAGE && if_id_state->op == P_STALL) {
+	if (id_ex_curr->destm != REG_NONE &&
+	    (id_ex_curr->destm == srca || id_ex_curr->destm == srcb)) {
+	    *pcp = id_ex_curr->stage_pc;
+	    return HZ_LOADUSE;
+	}
+	if (id_ex_curr->deste != REG_NONE &&
+	    (id_ex_curr->deste == srca || id_ex_curr->deste == srcb)) {
+	    *pcp = id_ex_curr->stage_pc;
+	    return HZ_DATA;
+	}
+	if ((ex_mem_curr->deste != REG_NONE &&
+	     (ex_mem_curr->deste == srca || ex_mem_curr->deste == srcb)) ||
+	    (ex_mem_curr->destm != REG_NONE &&
+	     (ex_mem_curr->destm == srca || ex_mem_curr->destm == srcb))) {
+	    *pcp = ex_mem_curr->stage_pc;
+	    return HZ_DATA;
+	}
+	if ((mem_wb_curr->deste != REG_NONE &&
+	     (mem_wb_curr->deste == srca || mem_wb_curr->deste == srcb)) ||
+	    (mem_wb_curr->destm != REG_NONE &&
+	     (mem_wb_curr->destm == srca || mem_wb_curr->destm == srcb))) {
+	    *pcp = mem_wb_curr->stage_pc;
+	    return HZ_DATA;
+	}
+    }
+    /* Fetch waiting for a ret to pass through the pipeline */
+    if (if_id_curr->icode == I_RET && if_id_curr->status == STAT_AOK) {
+	*pcp = if_id_curr->stage_pc;
+	return HZ_RET;
+    }
+    if (id_ex_curr->icode == I_RET && id_ex_curr->status == STAT_AOK) {
+	*pcp = id_ex_curr->stage_pc;
+	return HZ_RET;
+    }
+    *pcp = if_id_curr->stage_pc;
+    return HZ_OTHER;
+}
+
+/*
+ * Move the reasons for the bubbles along with the pipe registers, as
+ * update_pipes will at the start of the next cycle, and record the
+ * reason for each new bubble
+ */
+static void track_bubbles()
+{
+    pipe_ptr state[WB_STAGE+1] =
+	{ pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state };
+    int s;
+    for (s = WB_STAGE; s > IF_STAGE; s--) {
+	switch (state[s]->op) {
+	case P_LOAD:
+	    hazard_cause[s] = s > ID_STAGE ? hazard_cause[s-1] : HZ_NONE;
+	    hazard_pc[s] = hazard_pc[s-1];
+	    break;
+	case P_BUBBLE:
+	    hazard_cause[s] = bubble_reason(s, &hazard_pc[s]);
+	    break;
+	case P_ERROR:
+	    hazard_cause[s] = HZ_OTHER;
+	    hazard_pc[s] = if_id_curr->stage_pc;
+	    break;
+	case P_STALL:
+	default:
+	    break;
+	}
+    }
+}
+
+
+static SIM_TLS int initialized = 0;
 
 void sim_init()
 {
@@ -539,6 +1028,15 @@ void sim_init()
     id_ex_state  = new_pipe(sizeof(id_ex_ele), (void *) &bubble_id_ex);
     ex_mem_state = new_pipe(sizeof(ex_mem_ele), (void *) &bubble_ex_mem);
     mem_wb_state = new_pipe(sizeof(mem_wb_ele), (void *) &bubble_mem_wb);
+
+    bp_init();
+    hz_init();
+    if (ooo_mode)
+	ooo_init();
+    if (use_icache)
+	icache = cache_new(&icache_config);
+    if (use_dcache)
+	dcache = cache_new(&dcache_config);
   
     /* connect them to the pipeline stages */
     pc_next   = pc_state->next;
@@ -570,6 +1068,18 @@ void sim_reset()
     memCnt = 0;
     starting_up = 1;
     cycles = instructions = 0;
+    bp_reset();
+    memset(hazard_cause, 0, sizeof(hazard_cause));
+    memset(hazard_pc, 0, sizeof(hazard_pc));
+    if (icache)
+	cache_reset(icache);
+    if (dcache)
+	cache_reset(dcache);
+    icache_wait = dcache_wait = 0;
+    icache_served = -1;
+    wide_reset();
+    ooo_reset();
+    dcache_served = FALSE;
     cc = DEFAULT_CC;
     status = STAT_AOK;
 
@@ -592,6 +1102,22 @@ void sim_reset()
     sim_report();
 }
 
+void sim_free()
+{
+    if (!initialized)
+	return;
+    free_mem(mem);
+    free_reg(reg);
+    free_pipes();
+    bp_free();
+    hz_free();
+    cache_free(icache);
+    cache_free(dcache);
+    ooo_free();
+    icache = dcache = NULL;
+    initialized = 0;
+}
+
 /* Update state elements */
 /* May need to disable updating of memory & condition codes */
 static void update_state(bool_t update_mem, bool_t update_cc)
@@ -649,6 +1175,8 @@ static void update_state(bool_t update_mem, bool_t update_cc)
 
 /* Text representation of status */
 void tty_report(word_t cyc) {
+  if (!dumpfile)
+    return;
   sim_log("\nCycle %lld. CC=%s, Stat=%s\n", cyc, cc_name(cc), stat_name(status));
 
   sim_log("F: predPC = 0x%llx\n", pc_curr->pc);
@@ -719,6 +1247,8 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
     do_id_wb_stages();
 
     do_stall_check();
+    do_cache_check();
+    update_predictor();
 #if 0
     /* This doesn't seem necessary */
     if (id_ex_curr->status != STAT_AOK
@@ -734,9 +1264,18 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
 	instructions++;
 	cycles++;
     } else {
-	if (!starting_up)
+	if (!starting_up) {
 	    cycles++;
+	    if (hz_enabled) {
+		if (mem_wb_curr->status == STAT_BUB)
+		    hz_charge(hazard_cause[WB_STAGE], hazard_pc[WB_STAGE]);
+		else
+		    hz_charge(HZ_OTHER, mem_wb_curr->stage_pc);
+	    }
+	}
     }
+    if (hz_enabled)
+	track_bubbles();
     
     sim_report();
     return status;
@@ -757,6 +1296,10 @@ word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *c
     word_t icount = 0;
     word_t ccount = 0;
     byte_t run_status = STAT_AOK;
+    if (wide_mode)
+	return wide_run_pipe(max_instr, max_cycle, statusp, ccp);
+    if (ooo_mode)
+	return ooo_run_pipe(max_instr, max_cycle, statusp, ccp);
     while (icount < max_instr && ccount < max_cycle) {
         run_status = sim_step_pipe(max_instr-icount, ccount);
 	if (run_status != STAT_BUB)
@@ -772,6 +1315,96 @@ word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *c
     return icount;
 }
 
+/*
+  Run the program in image in lockstep with the ISA simulator (see
+  ptsuite.h).  An instruction has completed once it reaches WB: its
+  memory write has been done, but its register writes are still
+  pending in wb_destE and wb_destM, so those are applied to a copy of
+  the register file before comparing.  The condition codes run ahead
+  of WB, so each instruction carries the ones it left from execute down
+  to WB, where they are compared with the rest.
+*/
+void sim_check_prog(mem_t image, word_t max_instr, check_ptr c)
+{
+    state_ptr isa_state;
+    mem_t rview;
+    word_t ccount = 0;
+    byte_t run_status = STAT_AOK;
+    byte_t isa_status = STAT_AOK;
+
+    if (wide_mode) {
+	wide_check_prog(image, max_instr, c);
+	return;
+    }
+    if (ooo_mode) {
+	ooo_check_prog(image, max_instr, c);
+	return;
+    }
+    rview = init_reg();
+    sim_reset();
+    set_mem(mem, image);
+    isa_state = new_state(mem->len);
+    set_mem(isa_state->m, mem);
+    isa_state->cc = cc;
+
+    c->ok = TRUE;
+    c->instr = 0;
+    while (c->instr < max_instr && ccount < 5*max_instr) {
+	run_status = sim_step_pipe(max_instr-c->instr, ccount);
+	c->cycle = ccount++;
+	/* Stat reads AOK while WB holds a bubble */
+	if (mem_wb_curr->status == STAT_BUB)
+	    continue;
+	/* A popq split in two (pipe-1w) completes with its second half */
+	if (mem_wb_curr->icode == I_POPQ && ex_mem_curr->icode == I_POP2)
+	    continue;
+	c->pc = mem_wb_curr->stage_pc;
+	isa_status = step_state(isa_state, NULL);
+	memcpy(rview->contents, reg->contents, reg->len);
+	if (run_status == STAT_AOK) {
+	    if (wb_destE != REG_NONE)
+		set_reg_val(rview, wb_destE, wb_valE);
+	    if (wb_destM != REG_NONE)
+		set_reg_val(rview, wb_destM, wb_valM);
+	}
+	if (!check_state(isa_state, isa_status, rview, mem, run_status,
+			 TRUE, mem_wb_curr->cc, c)) {
+	    c->ok = FALSE;
+	    break;
+	}
+	c->instr++;
+	if (run_status != STAT_AOK)
+	    break;
+    }
+    c->stat = run_status;
+    if (c->ok && run_status == STAT_AOK && c->instr < max_instr) {
+	c->ok = FALSE;
+	snprintf(c->what, sizeof(c->what),
+		 "Cycle limit reached, ISA status %s", stat_name(isa_status));
+    } else if (c->ok &&
+	       !check_state(isa_state, isa_status, rview, mem, run_status,
+			    TRUE, cc, c)) {
+	c->ok = FALSE;
+    }
+    free_state(isa_state);
+    free_reg(rview);
+}
+
+/* For batch.c: run image, or check it with sim_check_prog */
+void sim_batch_prog(mem_t image, word_t max_instr, batch_ptr b, check_ptr c)
+{
+    if (c) {
+	sim_check_prog(image, max_instr, c);
+	b->stat = c->stat;
+    } else {
+	sim_reset();
+	set_mem(mem, image);
+	sim_run_pipe(max_instr, 5*max_instr, &b->stat, NULL);
+    }
+    b->cycles = cycles;
+    b->instr = instructions;
+}
+
 /* If dumpfile set nonNULL, lots of status info printed out */
 void sim_set_dumpfile(FILE *df)
 {
@@ -1252,8 +1885,8 @@ int Tcl_AppInit(Tcl_Interp *interp)
  *	static variables
  ******************************************************************************/
 
-static pipe_ptr pipes[MAX_STAGE];
-static int pipe_count = 0;
+static SIM_TLS pipe_ptr pipes[MAX_STAGE];
+static SIM_TLS int pipe_count = 0;
 
 /******************************************************************************
  *	function definitions
@@ -1306,6 +1939,18 @@ void update_pipes()
   }
 }
 
+/* Release all pipes */
+void free_pipes()
+{
+  int s;
+  for (s = 0; s < pipe_count; s++) {
+    free(pipes[s]->current);
+    free(pipes[s]->next);
+    free(pipes[s]);
+  }
+  pipe_count = 0;
+}
+
 /* Set all pipes to bubble values */
 void clear_pipes()
 {
@@ -1404,7 +2049,7 @@ void do_if_stage()
     }
     if_id_next->icode = gen_f_icode();
     if_id_next->ifun  = gen_f_ifun();
-    if (!imem_error) {
+    if (!imem_error && dumpfile) {
 	sim_log("\tFetch: f_pc = 0x%llx, imem_instr = %s, f_instr = %s\n",
 		f_pc, iname(instr),
 		iname(HPACK(if_id_next->icode, if_id_next->ifun)));
@@ -1430,6 +2075,7 @@ void do_if_stage()
     if_id_next->valc = valc;
 
     pc_next->pc = gen_f_predPC();
+    if_id_next->predpc = pc_next->pc;
 
     pc_next->status = (if_id_next->status == STAT_AOK) ? STAT_AOK : STAT_BUB;
 
@@ -1477,6 +2123,7 @@ void do_id_wb_stages()
     id_ex_next->ifun = if_id_curr->ifun;
     id_ex_next->valc = if_id_curr->valc;
     id_ex_next->stage_pc = if_id_curr->stage_pc;
+    id_ex_next->predpc = if_id_curr->predpc;
     id_ex_next->status = if_id_curr->status;
 }
 
@@ -1501,7 +2148,7 @@ void do_ex_stage()
     
     ex_mem_next->takebranch = e_bcond;
 
-    if (id_ex_curr->icode == I_JMP)
+    if (id_ex_curr->icode == I_JMP && dumpfile)
       sim_log("\tExecute: instr = %s, cc = %s, branch %staken\n",
 	      iname(HPACK(id_ex_curr->icode, id_ex_curr->ifun)),
 	      cc_name(cc),
@@ -1513,8 +2160,10 @@ void do_ex_stage()
     sim_log("\tExecute: ALU: %c 0x%llx 0x%llx --> 0x%llx\n",
 	    op_name(alufun), alua, alub, aluout);
 
+    ex_mem_next->cc = cc;
     if (setcc) {
 	cc_in = compute_cc(alufun, alua, alub);
+	ex_mem_next->cc = cc_in;
 	sim_log("\tExecute: New cc = %s\n", cc_name(cc_in));
     }
 
@@ -1526,6 +2175,7 @@ void do_ex_stage()
     ex_mem_next->srca = id_ex_curr->srca;
     ex_mem_next->status = id_ex_curr->status;
     ex_mem_next->stage_pc = id_ex_curr->stage_pc;
+    ex_mem_next->predpc = id_ex_curr->predpc;
 }
 
 /* Functions defined using HCL */
@@ -1567,6 +2217,8 @@ void do_mem_stage()
     mem_wb_next->destm = ex_mem_curr->destm;
     mem_wb_next->status = gen_m_stat();
     mem_wb_next->stage_pc = ex_mem_curr->stage_pc;
+    mem_wb_next->predpc = ex_mem_curr->predpc;
+    mem_wb_next->cc = ex_mem_curr->cc;
 }
 
 /* Set stalling conditions for different stages */
@@ -1600,5 +2252,57 @@ void do_stall_check()
     mem_wb_state->op = pipe_cntl("WB", gen_W_stall(), gen_W_bubble());
 }
 
+/*
+ * Override the controls chosen by the HCL while a cache miss is being
+ * served.  A data cache miss holds the instruction in memory, and all
+ * those behind it, and sends bubbles on to write back.  An instruction
+ * cache miss sends bubbles on to decode.  Either way fetch is retried
+ * at the same address: the PC register is loaded with f_pc rather than
+ * stalled, since f_pc may have come from a later stage.  Since the
+ * stages that are held compute the same values again, the results are
+ * the same as without the caches.
+ */
+void do_cache_check()
+{
+    bool_t held = FALSE;
+    icache_bubble = dcache_bubble = FALSE;
+
+    if (dcache && dcache_wait == 0 && !dcache_served && !dmem_error &&
+	ex_mem_curr->status == STAT_AOK && (gen_mem_read() || mem_write))
+	dcache_wait = cache_access(dcache, mem_addr, 8, mem_write);
+    if (icache && icache_wait == 0 && f_pc != icache_served && !imem_error)
+	icache_wait = cache_access(icache, f_pc, if_id_next->valp - f_pc,
+				   FALSE);
+    dcache_served = FALSE;
+    icache_served = -1;
+
+    if (dcache_wait > 0) {
+	held = TRUE;
+	if (--dcache_wait == 0)
+	    dcache_served = TRUE;
+	cache_stall(dcache, 1);
+	if_id_state->op = P_STALL;
+	id_ex_state->op = P_STALL;
+	ex_mem_state->op = P_STALL;
+	dcache_bubble = mem_wb_state->op == P_LOAD;
+	if (dcache_bubble)
+	    mem_wb_state->op = P_BUBBLE;
+    }
+    if (icache_wait > 0) {
+	held = TRUE;
+	if (--icache_wait == 0)
+	    icache_served = f_pc;
+	cache_stall(icache, 1);
+	icache_bubble = if_id_state->op == P_LOAD;
+	if (icache_bubble)
+	    if_id_state->op = P_BUBBLE;
+    }
+    if (held) {
+	pc_state->op = P_LOAD;
+	pc_next->pc = f_pc;
+	pc_next->status = STAT_AOK;
+    }
+}
+
 
 
@@ -19,75 +19,79 @@ typedef enum { IF_STAGE, ID_STAGE, EX_STAGE, MEM_STAGE, WB_STAGE } stage_id_t;
 /* Get rb out of one byte regid field */
 #define GET_RB(r) LO4(r)
 
+/* Simulator state is kept per thread, so that several pipelines can be
+   simulated side by side in one process (see bench.c) */
+#define SIM_TLS __thread
+
 
 /************ Global state declaration ****************/
 
 /* How many cycles have been simulated? */
-extern word_t cycles;
+extern SIM_TLS word_t cycles;
 /* How many instructions have passed through the EX stage? */
-extern word_t instructions;
+extern SIM_TLS word_t instructions;
 
 /* Both instruction and data memory */
-extern mem_t mem;
+extern SIM_TLS mem_t mem;
 
 /* Keep track of range of addresses that have been written */
-extern word_t minAddr;
-extern word_t memCnt;
+extern SIM_TLS word_t minAddr;
+extern SIM_TLS word_t memCnt;
 
 /* Register file */
-extern mem_t reg;
+extern SIM_TLS mem_t reg;
 /* Condition code register */
-extern cc_t cc;
-extern stat_t stat;
+extern SIM_TLS cc_t cc;
+extern SIM_TLS stat_t stat;
 
 /* Operand sources in EX (to show forwarding) */
-extern mux_source_t amux, bmux;
+extern SIM_TLS mux_source_t amux, bmux;
 
 /* Provide global access to current states of all pipeline registers */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+extern SIM_TLS pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
 
 /* Current States */
-extern pc_ptr pc_curr;
-extern if_id_ptr if_id_curr;
-extern id_ex_ptr id_ex_curr;
-extern ex_mem_ptr ex_mem_curr;
-extern mem_wb_ptr mem_wb_curr;
+extern SIM_TLS pc_ptr pc_curr;
+extern SIM_TLS if_id_ptr if_id_curr;
+extern SIM_TLS id_ex_ptr id_ex_curr;
+extern SIM_TLS ex_mem_ptr ex_mem_curr;
+extern SIM_TLS mem_wb_ptr mem_wb_curr;
 
 /* Next States */
-extern pc_ptr pc_next;
-extern if_id_ptr if_id_next;
-extern id_ex_ptr id_ex_next;
-extern ex_mem_ptr ex_mem_next;
-extern mem_wb_ptr mem_wb_next;
+extern SIM_TLS pc_ptr pc_next;
+extern SIM_TLS if_id_ptr if_id_next;
+extern SIM_TLS id_ex_ptr id_ex_next;
+extern SIM_TLS ex_mem_ptr ex_mem_next;
+extern SIM_TLS mem_wb_ptr mem_wb_next;
 
 /* Pending updates to state */
-extern word_t cc_in;
-extern word_t wb_destE;
-extern word_t wb_valE;
-extern word_t wb_destM;
-extern word_t wb_valM;
-extern word_t mem_addr;
-extern word_t mem_data;
-extern bool_t mem_write;
+extern SIM_TLS word_t cc_in;
+extern SIM_TLS word_t wb_destE;
+extern SIM_TLS word_t wb_valE;
+extern SIM_TLS word_t wb_destM;
+extern SIM_TLS word_t wb_valM;
+extern SIM_TLS word_t mem_addr;
+extern SIM_TLS word_t mem_data;
+extern SIM_TLS bool_t mem_write;
 
 
 /* Intermdiate stage values that must be used by control functions */
-extern word_t f_pc;
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern bool_t imem_error;
-extern bool_t instr_valid;
-extern word_t d_regvala;
-extern word_t d_regvalb;
-extern word_t e_vala;
-extern word_t e_valb;
-extern bool_t e_bcond;
-extern bool_t dmem_error;
+extern SIM_TLS word_t f_pc;
+extern SIM_TLS byte_t imem_icode;
+extern SIM_TLS byte_t imem_ifun;
+extern SIM_TLS bool_t imem_error;
+extern SIM_TLS bool_t instr_valid;
+extern SIM_TLS word_t d_regvala;
+extern SIM_TLS word_t d_regvalb;
+extern SIM_TLS word_t e_vala;
+extern SIM_TLS word_t e_valb;
+extern SIM_TLS bool_t e_bcond;
+extern SIM_TLS bool_t dmem_error;
 
 /* Simulator operating mode */
-extern sim_mode_t sim_mode;
+extern SIM_TLS sim_mode_t sim_mode;
 /* Log file */
-extern FILE *dumpfile;
+extern SIM_TLS FILE *dumpfile;
 
 /*************** Simulation Control Functions ***********/
 
@@ -106,6 +110,9 @@ void sim_init();
 /* Reset simulator state, including register, instruction, and data memories */
 void sim_reset();
 
+/* Release the memories and pipe registers allocated by sim_init */
+void sim_free();
+
 /*
   Run pipeline until one of following occurs:
   - A status error is encountered in WB.
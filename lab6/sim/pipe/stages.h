@@ -22,6 +22,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address fetched after this instruction (for checking predictions) */
+    word_t predpc;
 } if_id_ele, *if_id_ptr;
 
 /* ID/EX Pipe Register */
@@ -38,6 +40,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address fetched after this instruction (for checking predictions) */
+    word_t predpc;
 } id_ex_ele, *id_ex_ptr;
 
 /* EX/MEM Pipe Register */
@@ -53,6 +57,10 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address fetched after this instruction (for checking predictions) */
+    word_t predpc;
+    /* Condition codes once this instruction has executed (for checking) */
+    cc_t cc;
 } ex_mem_ele, *ex_mem_ptr;
 
 /* Mem/WB Pipe Register */
@@ -66,6 +74,9 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Address fetched after this instruction (for checking predictions) */
+    word_t predpc;
+    cc_t cc;
 } mem_wb_ele, *mem_wb_ptr;
 
 /************ Global Declarations ********************/
@@ -87,4 +98,7 @@ void do_mem_stage();
 /* Set stalling conditions for different stages */
 void do_stall_check();
 
+/* Hold up the pipeline while the caches serve a miss */
+void do_cache_check();
+
 
@@ -0,0 +1,387 @@
+/*
+ * tune.c - Search for the fastest ncopy kernel that fits the size limit
+ *
+ * Every variant has the same shape as ncopy.ys: an unrolled main loop
+ * that counts %rdx down by the unroll factor, followed by code for the
+ * 0..unroll-1 words left over.  Within the main loop, the loads of up
+ * to depth consecutive words are issued before any of them is stored
+ * and tested, which hides the load/use bubbles of pipelines without
+ * load forwarding.  Like ncopy.ys, the count is accumulated in %rax
+ * starting from the zero left there by the driver.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "isa.h"
+#include "memasm.h"
+#include "bench.h"
+#include "tune.h"
+
+/* Room for the source of one variant */
+#define SRCLEN 65536
+
+/* Registers holding the words in flight, one per level of depth */
+static char *val_reg[TUNE_MAXDEPTH] = { "%rcx", "%r8", "%r9", "%r10" };
+
+/* Source being generated */
+typedef struct {
+    char *buf;
+    int len;
+    int pos;
+    int unroll;
+    int labels;   /* Number of labels generated so far */
+} gen_rec, *gen_ptr;
+
+/* Outcome of trying one variant */
+typedef struct {
+    tune_variant_t v;
+    int bytes;    /* Length of ncopy, or -1 if it didn't assemble */
+    int bad;      /* Block lengths with a wrong result */
+    double cpe;
+} tune_result_t;
+
+/* Work handed to each tuning thread */
+typedef struct {
+    tune_result_t *result;
+    int nvariants;
+    int nthreads;
+    int id;
+    int maxlen;
+    int rounds;
+    unsigned seed;
+    word_t max_instr;
+} tune_job_rec, *tune_job_ptr;
+
+char *tune_rem_name(tune_rem_t rem)
+{
+    switch (rem) {
+    case REM_LOOP:
+	return "loop";
+    case REM_CHAIN:
+	return "chain";
+    case REM_TREE:
+	return "tree";
+    default:
+	return "none";
+    }
+}
+
+static void emit(gen_ptr g, char *fmt, ...)
+{
+    va_list ap;
+    if (g->pos >= g->len)
+	return;
+    va_start(ap, fmt);
+    g->pos += vsnprintf(g->buf + g->pos, g->len - g->pos, fmt, ap);
+    va_end(ap);
+}
+
+/* Displacement operand for word i of a block */
+static void emit_mem(gen_ptr g, int i, char *base)
+{
+    if (i)
+	emit(g, "0x%x(%s)", 8*i, base);
+    else
+	emit(g, "(%s)", base);
+}
+
+/* Copy words first..first+n-1, loading all of them before the first use */
+static void gen_copy(gen_ptr g, int first, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+	emit(g, "    mrmovq ");
+	emit_mem(g, first + i, "%rdi");
+	emit(g, ", %s\n", val_reg[i]);
+    }
+    for (i = 0; i < n; i++) {
+	emit(g, "    rmmovq %s, ", val_reg[i]);
+	emit_mem(g, first + i, "%rsi");
+	emit(g, "\n");
+    }
+    for (i = 0; i < n; i++) {
+	emit(g, "    andq %s, %s\n", val_reg[i], val_reg[i]);
+	emit(g, "    jle P%d\n", g->labels);
+	emit(g, "    iaddq 0x1, %%rax # cnt + 1\n");
+	emit(g, "P%d:\n", g->labels++);
+    }
+}
+
+/* Branch on cond to the copies of the last v words, or to Done if none */
+static void gen_jump(gen_ptr g, char *cond, int v)
+{
+    if (v)
+	emit(g, "    %s T%d\n", cond, v);
+    else
+	emit(g, "    %s Done\n", cond);
+}
+
+/*
+ * Branch on a remainder r in lo..hi, where %rdx holds r - bias, to
+ * label Tr at the start of the last r copies of the chain.  If tail,
+ * the chain follows the code generated here.
+ */
+static void gen_tree(gen_ptr g, int lo, int hi, int bias, bool_t tail)
+{
+    int mid = lo + (hi - lo) / 2;
+    int left = -1;
+
+    emit(g, "    iaddq %d, %%rdx\n", bias - mid);
+    gen_jump(g, "je", mid);
+    if (mid - 1 == lo)
+	gen_jump(g, "jl", lo);
+    else if (mid > lo) {
+	left = g->labels++;
+	emit(g, "    jl N%d\n", left);
+    }
+
+    if (mid + 1 < hi)
+	gen_tree(g, mid + 1, hi, mid, tail && left < 0);
+    else if (!(tail && left < 0 && hi == g->unroll - 1))
+	gen_jump(g, "jmp", hi);
+
+    if (left >= 0) {
+	emit(g, "N%d:\n", left);
+	gen_tree(g, lo, mid - 1, mid, tail);
+    }
+}
+
+/* Copy the r < unroll words left over, with %rdx = r - unroll */
+static void gen_rem(gen_ptr g, tune_rem_t rem)
+{
+    int k = g->unroll;
+    int i;
+
+    switch (rem) {
+    case REM_LOOP:
+	emit(g, "    iaddq %d, %%rdx\n", k);
+	emit(g, "    jle Done\n");
+	emit(g, "Rloop:\n");
+	gen_copy(g, 0, 1);
+	emit(g, "    iaddq 0x8, %%rdi\n");
+	emit(g, "    iaddq 0x8, %%rsi\n");
+	emit(g, "    iaddq -1, %%rdx\n");
+	emit(g, "    jg Rloop\n");
+	break;
+    case REM_CHAIN:
+	emit(g, "    iaddq %d, %%rdx\n", k);
+	emit(g, "    jle Done\n");
+	for (i = 0; i < k - 1; i++) {
+	    gen_copy(g, i, 1);
+	    if (i < k - 2) {
+		emit(g, "    iaddq -1, %%rdx\n");
+		emit(g, "    jle Done\n");
+	    }
+	}
+	break;
+    case REM_TREE:
+	gen_tree(g, 0, k - 1, k, TRUE);
+	for (i = k - 1; i > 0; i--) {
+	    emit(g, "T%d:\n", i);
+	    gen_copy(g, i - 1, 1);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+bool_t tune_gen(tune_variant_t *v, char *buf, int len)
+{
+    gen_rec g;
+    int k = v->unroll;
+    int i, n;
+
+    g.buf = buf;
+    g.len = len;
+    g.pos = 0;
+    g.unroll = k;
+    g.labels = 0;
+
+    emit(&g, "#/* begin ncopy-ys */\n");
+    emit(&g, "##################################################################\n");
+    emit(&g, "# ncopy.ys - Copy a src block of len words to dst.\n");
+    emit(&g, "# Return the number of positive words (>0) contained in src.\n");
+    emit(&g, "#\n");
+    emit(&g, "# Generated by psim -u: main loop unrolled %d times, loads issued\n", k);
+    if (v->rem == REM_NONE)
+	emit(&g, "# %d at a time.\n", v->depth);
+    else
+	emit(&g, "# %d at a time, remaining words copied by a %s.\n",
+	     v->depth, tune_rem_name(v->rem));
+    emit(&g, "#\n");
+    emit(&g, "##################################################################\n");
+    emit(&g, "# Do not modify this portion\n");
+    emit(&g, "# Function prologue.\n");
+    emit(&g, "# %%rdi = src, %%rsi = dst, %%rdx = len\n");
+    emit(&g, "ncopy:\n");
+    emit(&g, "\n");
+    emit(&g, "##################################################################\n");
+    emit(&g, "    iaddq %d, %%rdx\n", -k);
+    emit(&g, "    jl Rem\n");
+    emit(&g, "Loop:\n");
+    for (i = 0; i < k; i += n) {
+	n = k - i < v->depth ? k - i : v->depth;
+	gen_copy(&g, i, n);
+    }
+    emit(&g, "    iaddq 0x%x, %%rdi\n", 8*k);
+    emit(&g, "    iaddq 0x%x, %%rsi\n", 8*k);
+    emit(&g, "    iaddq %d, %%rdx\n", -k);
+    emit(&g, "    jge Loop\n");
+    emit(&g, "Rem:\n");
+    gen_rem(&g, v->rem);
+    emit(&g, "##################################################################\n");
+    emit(&g, "# Do not modify the following section of code\n");
+    emit(&g, "# Function epilogue.\n");
+    emit(&g, "Done:\n");
+    emit(&g, "\tret\n");
+    emit(&g, "##################################################################\n");
+    emit(&g, "# Keep the following label at the end of your function\n");
+    emit(&g, "End:\n");
+    emit(&g, "#/* end ncopy-ys */\n");
+    return g.pos < g.len;
+}
+
+/* Fill result with every point in the search space.  Return the count */
+static int tune_variants(tune_result_t *result)
+{
+    int n = 0;
+    int k, d;
+    tune_rem_t rem;
+
+    for (k = 1; k <= TUNE_MAXUNROLL; k++)
+	for (rem = REM_LOOP; rem < REM_NONE; rem++)
+	    for (d = 1; d <= TUNE_MAXDEPTH && d <= k; d++) {
+		/* Nothing is left over by a loop copying single words */
+		tune_rem_t r = k == 1 ? REM_NONE : rem;
+		if (k == 1 && rem != REM_LOOP)
+		    continue;
+		if (result) {
+		    result[n].v.unroll = k;
+		    result[n].v.rem = r;
+		    result[n].v.depth = d;
+		}
+		n++;
+	    }
+    return n;
+}
+
+/* Assemble and benchmark every nthreads'th variant, from the job's id */
+static void *tune_worker(void *arg)
+{
+    tune_job_ptr job = (tune_job_ptr) arg;
+    bench_result_t bresult[BENCH_MAXLEN+1];
+    char *src = (char *) malloc(SRCLEN);
+    kernel_rec k;
+    int i;
+
+    k.image = init_mem(MEM_SIZE);
+    k.entry = 0;
+    for (i = job->id; i < job->nvariants; i += job->nthreads) {
+	tune_result_t *r = &job->result[i];
+	clear_mem(k.image);
+	r->bytes = -1;
+	if (!tune_gen(&r->v, src, SRCLEN) ||
+	    (r->bytes = asm_mem(k.image, src, NULL, 0)) < 0)
+	    continue;
+	/* No point timing kernels that check-len.pl would reject */
+	if (r->bytes > TUNE_MAXBYTES)
+	    continue;
+	k.end = r->bytes;
+	r->bad = bench_run(&k, job->maxlen, 1, job->seed, job->max_instr,
+			   bresult);
+	r->cpe = bench_cpe(bresult, job->maxlen);
+	r->bad += bench_check(&k, job->maxlen, job->rounds, job->seed,
+			      job->max_instr, NULL);
+    }
+    free_mem(k.image);
+    free(src);
+    return NULL;
+}
+
+/* Does r qualify, and does it beat best? */
+static bool_t tune_better(tune_result_t *r, tune_result_t *best)
+{
+    if (r->bytes < 0 || r->bytes > TUNE_MAXBYTES || r->bad)
+	return FALSE;
+    return !best || r->cpe < best->cpe ||
+	(r->cpe == best->cpe && r->bytes < best->bytes);
+}
+
+bool_t tune_run(int maxlen, int rounds, int nthreads, unsigned seed,
+		word_t max_instr, bool_t verbose, FILE *out)
+{
+    int nvariants = tune_variants(NULL);
+    tune_result_t *result =
+	(tune_result_t *) calloc(nvariants, sizeof(tune_result_t));
+    tune_result_t *best = NULL;
+    pthread_t tid[nthreads];
+    tune_job_rec job[nthreads];
+    char *src;
+    int i, good = 0;
+
+    tune_variants(result);
+    for (i = 0; i < nthreads; i++) {
+	job[i].result = result;
+	job[i].nvariants = nvariants;
+	job[i].nthreads = nthreads;
+	job[i].id = i;
+	job[i].maxlen = maxlen;
+	job[i].rounds = rounds;
+	job[i].seed = seed;
+	job[i].max_instr = max_instr;
+    }
+    /* The calling thread takes the first share itself */
+    for (i = 1; i < nthreads; i++) {
+	if (pthread_create(&tid[i], NULL, tune_worker, &job[i]) != 0) {
+	    perror("pthread_create");
+	    exit(1);
+	}
+    }
+    tune_worker(&job[0]);
+    for (i = 1; i < nthreads; i++)
+	pthread_join(tid[i], NULL);
+
+    if (verbose)
+	printf("Unroll\tRem\tDepth\tBytes\tCPE\n");
+    for (i = 0; i < nvariants; i++) {
+	tune_result_t *r = &result[i];
+	if (verbose) {
+	    printf("%d\t%s\t%d\t", r->v.unroll, tune_rem_name(r->v.rem),
+		   r->v.depth);
+	    if (r->bytes < 0)
+		printf("-\t-\tDidn't assemble\n");
+	    else if (r->bytes > TUNE_MAXBYTES)
+		printf("%d\t-\tToo long\n", r->bytes);
+	    else
+		printf("%d\t%.2f%s\n", r->bytes, r->cpe,
+		       r->bad ? "\tIncorrect result" : "");
+	}
+	if (tune_better(r, best))
+	    best = r;
+	if (tune_better(r, NULL))
+	    good++;
+    }
+    printf("%d/%d variants correct and at most %d bytes\n",
+	   good, nvariants, TUNE_MAXBYTES);
+    if (!best) {
+	free(result);
+	return FALSE;
+    }
+
+    printf("Best: unroll %d, %s remainder, depth %d\n",
+	   best->v.unroll, tune_rem_name(best->v.rem), best->v.depth);
+    printf("ncopy length = %d bytes\n", best->bytes);
+    printf("Average CPE\t%.2f\n", best->cpe);
+    printf("Score\t%.1f/%.1f\n", bench_score(best->cpe), BENCH_POINTS);
+    src = (char *) malloc(SRCLEN);
+    tune_gen(&best->v, src, SRCLEN);
+    fputs(src, out);
+    free(src);
+    free(result);
+    return TRUE;
+}
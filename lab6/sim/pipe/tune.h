@@ -0,0 +1,59 @@
+/*
+ * tune.h - Search for the fastest ncopy kernel that fits the size limit
+ *
+ * Automates the sweep described in the header of ncopy.ys.  Variants
+ * of ncopy are generated from a template over the unroll factor of the
+ * main loop, the way the remaining words are copied and how many loads
+ * are issued before their values are used.  Each variant is assembled
+ * in memory with memasm, timed over every block length with bench.c,
+ * checked on the same lengths as correctness.pl, and measured against
+ * the 1000 byte limit of check-len.pl.  The variants are spread over a
+ * pool of threads.
+ */
+
+#ifndef TUNE_H
+#define TUNE_H
+
+/* Largest kernel accepted by check-len.pl */
+#define TUNE_MAXBYTES 1000
+
+/* Bounds of the search */
+#define TUNE_MAXUNROLL 16
+#define TUNE_MAXDEPTH  4
+
+/* How the words left over by the unrolled loop are copied */
+typedef enum {
+    REM_LOOP,   /* A loop copying one word per iteration */
+    REM_CHAIN,  /* Straight-line copies, testing the count after each */
+    REM_TREE,   /* A search tree on the count jumps into straight-line
+		   copies, as in ncopy.ys */
+    REM_NONE
+} tune_rem_t;
+
+/* One point in the search space */
+typedef struct {
+    int unroll;      /* Words copied per iteration of the main loop */
+    tune_rem_t rem;  /* Remainder strategy */
+    int depth;       /* Loads issued before the first of them is used */
+} tune_variant_t;
+
+/* Name of a remainder strategy */
+char *tune_rem_name(tune_rem_t rem);
+
+/*
+ * Write the ncopy.ys source of variant v to buf, which has room for
+ * len characters.  Return FALSE if it doesn't fit.
+ */
+bool_t tune_gen(tune_variant_t *v, char *buf, int len);
+
+/*
+ * Time every variant on block lengths 0..maxlen and check it with
+ * bench_check on rounds inputs of each length, nthreads variants at a
+ * time, and write the source of the fastest correct one that fits in
+ * TUNE_MAXBYTES to out.  If verbose, print one line per variant.
+ * Return FALSE if no variant qualified.
+ */
+bool_t tune_run(int maxlen, int rounds, int nthreads, unsigned seed,
+		word_t max_instr, bool_t verbose, FILE *out);
+
+#endif /* TUNE_H */
@@ -0,0 +1,613 @@
+/*
+ * wide.c - Two-wide superscalar version of PIPE
+ *
+ * Every cycle the stages are evaluated from write back to fetch, each
+ * moving its instructions into the pipe register the stage after it
+ * has just emptied.  By the time decode runs, the instructions PIPE
+ * forwards from as e_valE, m_valM and M_valE are in the next cycle's M
+ * and W registers, and those of W_valE and W_valM have reached the
+ * register file.  Decode forwards from the youngest of them.
+ *
+ * Decode issues in order, up to two instructions per cycle:
+ *   - An instruction waits while a load in execute writes one of its
+ *     sources (load/use, one bubble as in PIPE).
+ *   - Slot 1 waits if it reads a register slot 0 writes.  Values are
+ *     only forwarded from the stages further down.
+ *   - There is a single data memory port, so slot 1 waits if both
+ *     instructions access memory.
+ * Execute handles slot 0 before slot 1, so condition codes set by
+ * slot 0 are seen by a jump or cmovXX in slot 1 in the same cycle.
+ *
+ * Fetch fills the free slots of decode and stops after a jump or call
+ * predicted taken.  Jumps are predicted by bpred.c (-p) and resolved in
+ * execute, costing two bubbles when wrong.  A ret stops fetch until it
+ * retires, as in PIPE.
+ *
+ * Registers, memory and condition codes only change as instructions
+ * retire from write back, in order.  Retirement stops at the first
+ * instruction with an exception, so exceptions are precise in either
+ * slot.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "ptsuite.h"
+#include "bpred.h"
+#include "wide.h"
+
+#define WIDTH 2
+
+/* An instruction in flight */
+typedef struct {
+    bool_t valid;     /* Does the slot hold an instruction? */
+    byte_t status;
+    byte_t icode;
+    byte_t ifun;
+    word_t pc;
+    word_t valc;
+    word_t valp;
+    word_t predpc;
+    byte_t srca;
+    byte_t srcb;
+    byte_t dste;
+    byte_t dstm;
+    word_t vala;
+    word_t valb;
+    word_t vale;
+    word_t valm;
+    cc_t cc;          /* Condition codes set by OPq or iaddq */
+} wide_slot;
+
+/* Called as each instruction retires.  Return FALSE to stop */
+typedef bool_t (*commit_fn)(wide_slot *s, void *arg);
+
+/* Why decode issued fewer than WIDTH instructions */
+typedef enum { LOST_LOADUSE, LOST_DEPEND, LOST_MEMPORT, LOST_FETCH,
+	       LOST_NCAUSE } lost_t;
+
+static char *lost_names[LOST_NCAUSE] =
+    { "load/use", "dependence", "memory port", "fetch" };
+
+bool_t wide_mode = FALSE;
+
+/* Pipe registers of this thread.  Slot 0 is the older instruction */
+static SIM_TLS wide_slot dreg[WIDTH], ereg[WIDTH], mreg[WIDTH], wreg[WIDTH];
+
+static SIM_TLS word_t fetch_pc;
+static SIM_TLS bool_t started;    /* Has fetch_pc been loaded? */
+static SIM_TLS bool_t retiring;   /* Has the first instruction retired? */
+static SIM_TLS bool_t redirect;   /* Was a jump mispredicted this cycle? */
+static SIM_TLS cc_t ecc;          /* Condition codes seen by execute */
+static SIM_TLS word_t step_count;
+
+/* Statistics, by number of instructions per cycle */
+static SIM_TLS word_t issued[WIDTH+1];
+static SIM_TLS word_t retired[WIDTH+1];
+static SIM_TLS word_t lost[LOST_NCAUSE];
+
+void wide_reset()
+{
+    memset(dreg, 0, sizeof(dreg));
+    memset(ereg, 0, sizeof(ereg));
+    memset(mreg, 0, sizeof(mreg));
+    memset(wreg, 0, sizeof(wreg));
+    started = retiring = redirect = FALSE;
+    ecc = DEFAULT_CC;
+    step_count = 0;
+    memset(issued, 0, sizeof(issued));
+    memset(retired, 0, sizeof(retired));
+    memset(lost, 0, sizeof(lost));
+}
+
+static bool_t uses_mem(wide_slot *s)
+{
+    if (s->status != STAT_AOK)
+	return FALSE;
+    return s->icode == I_RMMOVQ || s->icode == I_MRMOVQ ||
+	s->icode == I_PUSHQ || s->icode == I_POPQ ||
+	s->icode == I_CALL || s->icode == I_RET;
+}
+
+static bool_t writes_mem(wide_slot *s)
+{
+    return s->icode == I_RMMOVQ || s->icode == I_PUSHQ || s->icode == I_CALL;
+}
+
+static bool_t writes_reg(wide_slot *s, byte_t r)
+{
+    return r != REG_NONE && (s->dste == r || s->dstm == r);
+}
+
+/* Register ports of s, as in the decode stage of PIPE.  cmovXX is
+   assumed to write rB until execute has evaluated its condition */
+static void set_ports(wide_slot *s, byte_t ra, byte_t rb)
+{
+    s->srca = s->srcb = s->dste = s->dstm = REG_NONE;
+    if (s->status != STAT_AOK)
+	return;
+    switch (s->icode) {
+    case I_RRMOVQ:
+	s->srca = ra;
+	s->dste = rb;
+	break;
+    case I_IRMOVQ:
+	s->dste = rb;
+	break;
+    case I_RMMOVQ:
+	s->srca = ra;
+	s->srcb = rb;
+	break;
+    case I_MRMOVQ:
+	s->srcb = rb;
+	s->dstm = ra;
+	break;
+    case I_ALU:
+	s->srca = ra;
+	s->srcb = rb;
+	s->dste = rb;
+	break;
+    case I_IADDQ:
+	s->srcb = rb;
+	s->dste = rb;
+	break;
+    case I_PUSHQ:
+	s->srca = ra;
+	/* Fall through */
+    case I_CALL:
+	s->srcb = REG_RSP;
+	s->dste = REG_RSP;
+	break;
+    case I_POPQ:
+	s->dstm = ra;
+	/* Fall through */
+    case I_RET:
+	s->srca = REG_RSP;
+	s->srcb = REG_RSP;
+	s->dste = REG_RSP;
+	break;
+    default:
+	break;
+    }
+}
+
+/*
+ * Fetch the instruction at pc into s.  Return the address predicted to
+ * follow it, and clear *more if fetch should stop there for this cycle.
+ */
+static word_t fetch(word_t pc, wide_slot *s, bool_t *more)
+{
+    byte_t instr = HPACK(I_NOP, F_NONE);
+    byte_t regids = HPACK(REG_NONE, REG_NONE);
+    word_t valp = pc + 1;
+    bool_t need_regids, need_valc;
+
+    memset(s, 0, sizeof(*s));
+    s->valid = TRUE;
+    s->pc = pc;
+    s->status = STAT_AOK;
+    if (!get_byte_val(mem, pc, &instr))
+	s->status = STAT_ADR;
+    s->icode = HI4(instr);
+    s->ifun = LO4(instr);
+    if (s->status == STAT_AOK && s->icode > I_IADDQ)
+	s->status = STAT_INS;
+    need_regids =
+	s->icode == I_RRMOVQ || s->icode == I_ALU || s->icode == I_PUSHQ ||
+	s->icode == I_POPQ || s->icode == I_IRMOVQ || s->icode == I_RMMOVQ ||
+	s->icode == I_MRMOVQ || s->icode == I_IADDQ;
+    need_valc =
+	s->icode == I_IRMOVQ || s->icode == I_RMMOVQ || s->icode == I_MRMOVQ ||
+	s->icode == I_JMP || s->icode == I_CALL || s->icode == I_IADDQ;
+    if (s->status == STAT_AOK) {
+	if (need_regids && !get_byte_val(mem, valp++, &regids))
+	    s->status = STAT_ADR;
+	if (need_valc && !get_word_val(mem, valp, &s->valc))
+	    s->status = STAT_ADR;
+	if (need_valc)
+	    valp += 8;
+	if (s->status == STAT_AOK && s->icode == I_HALT)
+	    s->status = STAT_HLT;
+    }
+    s->valp = valp;
+    set_ports(s, HI4(regids), LO4(regids));
+
+    s->predpc = valp;
+    if (s->status != STAT_AOK)
+	return valp;
+    if (s->icode == I_JMP)
+	s->predpc = bp_predict(pc, s->ifun, s->valc, valp);
+    else if (s->icode == I_CALL)
+	s->predpc = s->valc;
+    if (s->predpc != valp || s->icode == I_RET)
+	*more = FALSE;
+    return s->predpc;
+}
+
+/* Is a ret anywhere in the pipeline? */
+static bool_t ret_in_flight()
+{
+    int i;
+    for (i = 0; i < WIDTH; i++) {
+	if ((dreg[i].valid && dreg[i].icode == I_RET) ||
+	    (ereg[i].valid && ereg[i].icode == I_RET) ||
+	    (mreg[i].valid && mreg[i].icode == I_RET) ||
+	    (wreg[i].valid && wreg[i].icode == I_RET))
+	    return TRUE;
+    }
+    return FALSE;
+}
+
+static void fetch_stage()
+{
+    bool_t more = TRUE;
+    int i;
+
+    /* After a misprediction, PIPE fetches once more down the wrong path */
+    if (redirect || ret_in_flight())
+	return;
+    for (i = 0; i < WIDTH && more; i++)
+	if (!dreg[i].valid)
+	    fetch_pc = fetch(fetch_pc, &dreg[i], &more);
+}
+
+/*
+ * Value of register r as seen by decode.  Return FALSE if it is being
+ * loaded by an instruction that has just left execute.
+ */
+static bool_t read_reg(byte_t r, word_t *valp)
+{
+    int i;
+    *valp = 0;
+    if (r == REG_NONE)
+	return TRUE;
+    for (i = WIDTH-1; i >= 0; i--) {
+	if (!mreg[i].valid)
+	    continue;
+	if (mreg[i].dstm == r)
+	    return FALSE;
+	if (mreg[i].dste == r) {
+	    *valp = mreg[i].vale;
+	    return TRUE;
+	}
+    }
+    for (i = WIDTH-1; i >= 0; i--) {
+	if (!wreg[i].valid)
+	    continue;
+	if (wreg[i].dstm == r) {
+	    *valp = wreg[i].valm;
+	    return TRUE;
+	}
+	if (wreg[i].dste == r) {
+	    *valp = wreg[i].vale;
+	    return TRUE;
+	}
+    }
+    *valp = get_reg_val(reg, r);
+    return TRUE;
+}
+
+static void decode_stage()
+{
+    lost_t why = LOST_FETCH;
+    int i, n = 0;
+
+    if (redirect) {
+	/* Wrong path */
+	memset(dreg, 0, sizeof(dreg));
+    }
+    for (i = 0; i < WIDTH; i++) {
+	wide_slot *s = &dreg[i];
+	word_t vala;
+	if (!s->valid)
+	    break;
+	if (i > 0 && (writes_reg(&dreg[0], s->srca) ||
+		      writes_reg(&dreg[0], s->srcb))) {
+	    why = LOST_DEPEND;
+	    break;
+	}
+	if (i > 0 && uses_mem(&dreg[0]) && uses_mem(s)) {
+	    why = LOST_MEMPORT;
+	    break;
+	}
+	if (!read_reg(s->srca, &vala) || !read_reg(s->srcb, &s->valb)) {
+	    why = LOST_LOADUSE;
+	    break;
+	}
+	s->vala = (s->icode == I_CALL || s->icode == I_JMP) ? s->valp : vala;
+	ereg[n++] = *s;
+    }
+
+    if (retiring) {
+	issued[n]++;
+	lost[why] += WIDTH - n;
+    }
+    for (i = n; i < WIDTH; i++)
+	dreg[i-n] = dreg[i];
+    for (i = WIDTH - n; i < WIDTH; i++)
+	dreg[i].valid = FALSE;
+}
+
+/* Execute s with the condition codes in ecc */
+static void execute(wide_slot *s)
+{
+    word_t alua = 0, alub = 0;
+    alu_t fun = A_ADD;
+    bool_t taken;
+    word_t actual;
+
+    switch (s->icode) {
+    case I_RRMOVQ:
+	alua = s->vala;
+	if (!cond_holds(ecc, s->ifun))
+	    s->dste = REG_NONE;
+	break;
+    case I_IRMOVQ:
+	alua = s->valc;
+	break;
+    case I_RMMOVQ:
+    case I_MRMOVQ:
+    case I_IADDQ:
+	alua = s->valc;
+	alub = s->valb;
+	break;
+    case I_ALU:
+	alua = s->vala;
+	alub = s->valb;
+	fun = s->ifun;
+	break;
+    case I_CALL:
+    case I_PUSHQ:
+	alua = -8;
+	alub = s->valb;
+	break;
+    case I_RET:
+    case I_POPQ:
+	alua = 8;
+	alub = s->valb;
+	break;
+    case I_JMP:
+	taken = cond_holds(ecc, s->ifun);
+	actual = taken ? s->valc : s->valp;
+	bp_resolve_jump(s->pc, s->ifun, taken, s->valc, s->predpc);
+	if (actual != s->predpc) {
+	    redirect = TRUE;
+	    fetch_pc = actual;
+	}
+	break;
+    default:
+	break;
+    }
+    s->vale = compute_alu(fun, alua, alub);
+    if (s->icode == I_ALU || s->icode == I_IADDQ)
+	s->cc = ecc = compute_cc(fun, alua, alub);
+}
+
+static void execute_stage()
+{
+    int i;
+    for (i = 0; i < WIDTH; i++) {
+	wide_slot *s = &ereg[i];
+	/* Squashed behind a mispredicted jump in slot 0 */
+	if (redirect)
+	    s->valid = FALSE;
+	if (s->valid && s->status == STAT_AOK)
+	    execute(s);
+	mreg[i] = *s;
+	s->valid = FALSE;
+    }
+}
+
+/* Loads read memory here.  Stores only check their address, and write
+   memory when they retire */
+static void memory_stage()
+{
+    int i;
+    for (i = 0; i < WIDTH; i++) {
+	wide_slot *s = &mreg[i];
+	if (uses_mem(s)) {
+	    bool_t pop = s->icode == I_POPQ || s->icode == I_RET;
+	    word_t addr = pop ? s->vala : s->vale;
+	    if (writes_mem(s)) {
+		if (addr < 0 || addr + 8 > mem->len)
+		    s->status = STAT_ADR;
+	    } else if (!get_word_val(mem, addr, &s->valm)) {
+		s->status = STAT_ADR;
+	    }
+	}
+	wreg[i] = *s;
+	s->valid = FALSE;
+    }
+}
+
+/*
+ * Retire the instructions in write back in order, at most max_retire
+ * of them, calling commit (if not NULL) after each.  Return how many
+ * retired, and set *statp to the status of the last one.
+ */
+static int writeback_stage(word_t max_retire, commit_fn commit, void *arg,
+			   byte_t *statp)
+{
+    int i, n = 0;
+    for (i = 0; i < WIDTH && n < max_retire; i++) {
+	wide_slot *s = &wreg[i];
+	if (!s->valid)
+	    continue;
+	s->valid = FALSE;
+	if (s->status == STAT_AOK) {
+	    if (s->dste != REG_NONE)
+		set_reg_val(reg, s->dste, s->vale);
+	    if (s->dstm != REG_NONE)
+		set_reg_val(reg, s->dstm, s->valm);
+	    if (writes_mem(s))
+		set_word_val(mem, s->vale, s->vala);
+	    if (s->icode == I_ALU || s->icode == I_IADDQ)
+		cc = s->cc;
+	    if (s->icode == I_RET)
+		fetch_pc = s->valm;
+	}
+	if (dumpfile)
+	    sim_log("\tRetire: %s at 0x%llx, Stat = %s\n",
+		    iname(HPACK(s->icode, s->ifun)), s->pc,
+		    stat_name(s->status));
+	*statp = s->status;
+	retiring = TRUE;
+	instructions++;
+	n++;
+	if (commit && !commit(s, arg))
+	    break;
+	if (s->status != STAT_AOK)
+	    break;
+    }
+    if (retiring)
+	retired[n]++;
+    return n;
+}
+
+static void log_stage(char *name, wide_slot *r)
+{
+    int i;
+    sim_log("%s:", name);
+    for (i = 0; i < WIDTH; i++) {
+	if (r[i].valid)
+	    sim_log("  0x%.3llx %-7s %s", r[i].pc,
+		    iname(HPACK(r[i].icode, r[i].ifun)),
+		    stat_name(r[i].status));
+	else
+	    sim_log(i < WIDTH-1 ? "  %-17s" : "  %s", "bubble");
+    }
+    sim_log("\n");
+}
+
+/*
+ * Simulate one cycle, retiring at most max_retire instructions.  Return
+ * how many retired; *statp is set to the status of the last of them.
+ */
+static int wide_step(word_t max_retire, commit_fn commit, void *arg,
+		     byte_t *statp)
+{
+    byte_t stat = STAT_AOK;
+    int n;
+
+    /* Start where the PC pipe register of PIPE would (see bench.c) */
+    if (!started) {
+	fetch_pc = pc_next->pc;
+	started = TRUE;
+    }
+    if (dumpfile) {
+	sim_log("\nCycle %lld. CC=%s, Fetch PC = 0x%llx\n",
+		step_count, cc_name(cc), fetch_pc);
+	log_stage("D", dreg);
+	log_stage("E", ereg);
+	log_stage("M", mreg);
+	log_stage("W", wreg);
+    }
+    step_count++;
+
+    redirect = FALSE;
+    n = writeback_stage(max_retire, commit, arg, &stat);
+    if (n > 0)
+	*statp = stat;
+    if (retiring)
+	cycles++;
+    if (n > 0 && stat != STAT_AOK)
+	return n;
+    memory_stage();
+    execute_stage();
+    decode_stage();
+    fetch_stage();
+    return n;
+}
+
+word_t wide_run_pipe(word_t max_instr, word_t max_cycle,
+		     byte_t *statusp, cc_t *ccp)
+{
+    word_t icount = 0;
+    word_t ccount = 0;
+    byte_t run_status = STAT_AOK;
+
+    while (icount < max_instr && ccount < max_cycle) {
+	icount += wide_step(max_instr - icount, NULL, NULL, &run_status);
+	if (run_status != STAT_AOK)
+	    break;
+	ccount++;
+    }
+    if (statusp)
+	*statusp = run_status;
+    if (ccp)
+	*ccp = cc;
+    return icount;
+}
+
+/* State of a lockstep run against the ISA simulator */
+typedef struct {
+    state_ptr isa;
+    byte_t isa_status;
+    word_t ccount;
+    check_ptr c;
+} check_arg_rec, *check_arg_ptr;
+
+static bool_t check_commit(wide_slot *s, void *arg)
+{
+    check_arg_ptr a = (check_arg_ptr) arg;
+    a->isa_status = step_state(a->isa, NULL);
+    a->c->pc = s->pc;
+    a->c->cycle = a->ccount;
+    if (!check_state(a->isa, a->isa_status, reg, mem, s->status,
+		     TRUE, cc, a->c)) {
+	a->c->ok = FALSE;
+	return FALSE;
+    }
+    a->c->instr++;
+    return TRUE;
+}
+
+void wide_check_prog(mem_t image, word_t max_instr, check_ptr c)
+{
+    check_arg_rec a;
+    byte_t run_status = STAT_AOK;
+
+    sim_reset();
+    set_mem(mem, image);
+    a.isa = new_state(mem->len);
+    set_mem(a.isa->m, mem);
+    a.isa->cc = cc;
+    a.isa_status = STAT_AOK;
+    a.c = c;
+
+    c->ok = TRUE;
+    c->instr = 0;
+    for (a.ccount = 0; c->instr < max_instr && a.ccount < 5*max_instr;
+	 a.ccount++) {
+	wide_step(max_instr - c->instr, check_commit, &a, &run_status);
+	if (!c->ok || run_status != STAT_AOK)
+	    break;
+    }
+    c->stat = run_status;
+    if (c->ok && run_status == STAT_AOK && c->instr < max_instr) {
+	c->ok = FALSE;
+	snprintf(c->what, sizeof(c->what),
+		 "Cycle limit reached, ISA status %s", stat_name(a.isa_status));
+    }
+    free_state(a.isa);
+}
+
+void wide_report(FILE *f)
+{
+    int i;
+    fprintf(f, "Two-wide pipeline: IPC %.2f\n",
+	    cycles > 0 ? (double) instructions / cycles : 0.0);
+    fprintf(f, "  Cycles retiring 0/1/2 instructions: %lld/%lld/%lld\n",
+	    retired[0], retired[1], retired[2]);
+    fprintf(f, "  Cycles issuing 0/1/2 instructions: %lld/%lld/%lld\n",
+	    issued[0], issued[1], issued[2]);
+    fprintf(f, "  Issue slots lost to:");
+    for (i = 0; i < LOST_NCAUSE; i++)
+	fprintf(f, " %s %lld%s", lost_names[i], lost[i],
+		i < LOST_NCAUSE-1 ? "," : "\n");
+}
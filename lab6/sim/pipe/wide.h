@@ -0,0 +1,33 @@
+/*
+ * wide.h - Two-wide superscalar version of PIPE
+ *
+ * Fetches, decodes, executes and retires up to two instructions per
+ * cycle through the five PIPE stages.  Each pipe register has two
+ * slots, the older instruction in slot 0.  The model is written in C
+ * rather than HCL, and runs on the program state of psim (mem, reg,
+ * cc, cycles, instructions), so that -t, -B and -T work with it as
+ * they do with the HCL pipelines.
+ */
+
+#ifndef WIDE_H
+#define WIDE_H
+
+/* Simulate this pipeline instead of the HCL one? (-w) */
+extern bool_t wide_mode;
+
+/* Empty the pipeline and clear the statistics of the calling thread.
+   Fetch starts at the address in pc_next when the pipeline first runs */
+void wide_reset();
+
+/* Same contract as sim_run_pipe */
+word_t wide_run_pipe(word_t max_instr, word_t max_cycle,
+		     byte_t *statusp, cc_t *ccp);
+
+/* Same contract as sim_check_prog, for ptsuite.c.  Registers, memory
+   and condition codes are all compared as each instruction retires */
+void wide_check_prog(mem_t image, word_t max_instr, check_ptr c);
+
+/* Print issue and retirement statistics */
+void wide_report(FILE *f);
+
+#endif /* WIDE_H */
@@ -7,6 +7,10 @@
 /* Get rb out of one byte regid field */
 #define GET_RB(r) LO4(r)
 
+/* Simulator state is kept per thread, so that several programs can be
+   simulated side by side in one process (see ../misc/ptsuite.c) */
+#define SIM_TLS __thread
+
 
 /************ Global state declaration ****************/
 
@@ -14,51 +18,51 @@
 extern int plusmode;
 
 /* Both instruction and data memory */
-extern mem_t mem;
+extern SIM_TLS mem_t mem;
 
 /* Keep track of range of addresses that have been written */
-extern word_t minAddr;
-extern word_t memCnt;
+extern SIM_TLS word_t minAddr;
+extern SIM_TLS word_t memCnt;
 
 /* Register file */
-extern mem_t reg;
+extern SIM_TLS mem_t reg;
 /* Condition code register */
-extern cc_t cc;
+extern SIM_TLS cc_t cc;
 /* Program counter */
-extern word_t pc;
+extern SIM_TLS word_t pc;
 
 /* For seq+ */
 /* Results computed by previous instruction.
    Used to compute PC in current instruction */
-extern byte_t prev_icode;
-extern byte_t prev_ifun;
-extern word_t prev_valc;
-extern word_t prev_valm;
-extern word_t prev_valp;
-extern bool_t prev_bcond;
+extern SIM_TLS byte_t prev_icode;
+extern SIM_TLS byte_t prev_ifun;
+extern SIM_TLS word_t prev_valc;
+extern SIM_TLS word_t prev_valm;
+extern SIM_TLS word_t prev_valp;
+extern SIM_TLS bool_t prev_bcond;
 
 /* Intermdiate stage values that must be used by control functions */
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern byte_t icode;
-extern word_t ifun;
-extern word_t ra;
-extern word_t rb;
-extern word_t valc;
-extern word_t valp;
-extern bool_t imem_error;
-extern bool_t instr_valid;
-extern word_t vala;
-extern word_t valb;
-extern word_t vale;
-extern bool_t bcond;
-extern bool_t cond;
-extern word_t valm;
-extern bool_t dmem_error;
-extern byte_t status;
+extern SIM_TLS byte_t imem_icode;
+extern SIM_TLS byte_t imem_ifun;
+extern SIM_TLS byte_t icode;
+extern SIM_TLS word_t ifun;
+extern SIM_TLS word_t ra;
+extern SIM_TLS word_t rb;
+extern SIM_TLS word_t valc;
+extern SIM_TLS word_t valp;
+extern SIM_TLS bool_t imem_error;
+extern SIM_TLS bool_t instr_valid;
+extern SIM_TLS word_t vala;
+extern SIM_TLS word_t valb;
+extern SIM_TLS word_t vale;
+extern SIM_TLS bool_t bcond;
+extern SIM_TLS bool_t cond;
+extern SIM_TLS word_t valm;
+extern SIM_TLS bool_t dmem_error;
+extern SIM_TLS byte_t status;
 
 /* Log file */
-extern FILE *dumpfile;
+extern SIM_TLS FILE *dumpfile;
 
 
 /* Sets the simulator name (called from main routine in HCL file) */
@@ -70,6 +74,9 @@ void sim_init();
 /* Reset simulator state, including register, instruction, and data memories */
 void sim_reset();
 
+/* Release the memories allocated by sim_init */
+void sim_free();
+
 /*
   Run processor until one of following occurs:
   - An status error is encountered
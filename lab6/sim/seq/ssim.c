@@ -13,6 +13,8 @@
 #include <string.h>
 #include "isa.h"
 #include "sim.h"
+#include "ptsuite.h"
+#include "batch.h"
 
 #define MAXBUF 1024
 
@@ -40,8 +42,13 @@ int gui_mode = FALSE;    /* Run in GUI mode instead of TTY mode? (-g) */
 char *object_filename;   /* The input object file name. */
 FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
+bool_t verbosity_set = FALSE; /* Was -v given? */
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
+bool_t do_ptest = FALSE; /* Run the ptest suite natively? (-T) */
+bool_t ptest_iaddq = FALSE; /* Include iaddq tests in the suite? (-i) */
+bool_t do_batch = FALSE; /* Run many object files, CSV summary? (-c) */
+int sim_threads = 1;     /* Number of simulator threads for -T, -c (-j) */
 
 /************* 
  * End Globals 
@@ -54,6 +61,8 @@ bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
 
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+static void run_ptest_sim();             /* Run ptest suite (-T) */
+static void run_batch_sim(char **files, int nfiles); /* Batch mode (-c) */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -83,7 +92,7 @@ int sim_main(int argc, char **argv)
 
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgTicl:v:j:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -97,6 +106,7 @@ int sim_main(int argc, char **argv)
 		printf("Invalid verbosity %d\n", verbosity);
 		usage(argv[0]);
 	    }
+	    verbosity_set = TRUE;
 	    break;
 	case 't':
 	    do_check = TRUE;
@@ -104,6 +114,22 @@ int sim_main(int argc, char **argv)
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
+	case 'T':
+	    do_ptest = TRUE;
+	    break;
+	case 'i':
+	    ptest_iaddq = TRUE;
+	    break;
+	case 'c':
+	    do_batch = TRUE;
+	    break;
+	case 'j':
+	    sim_threads = atoi(optarg);
+	    if (sim_threads < 1) {
+		printf("Invalid thread count %d\n", sim_threads);
+		usage(argv[0]);
+	    }
+	    break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -112,6 +138,19 @@ int sim_main(int argc, char **argv)
     }
 
 
+    /* Run every object file given in batch mode (-c flag) */
+    if (do_batch) {
+	if (gui_mode || do_ptest) {
+	    printf("-c can't be combined with -g or -T\n");
+	    usage(argv[0]);
+	}
+	if (optind == argc) {
+	    printf("Missing object file arguments in batch mode\n");
+	    usage(argv[0]);
+	}
+	run_batch_sim(argv + optind, argc - optind);
+    }
+
     /* Do we have too many arguments? */
     if (optind < argc - 1) {
 	printf("Too many command line arguments:");
@@ -127,7 +166,7 @@ int sim_main(int argc, char **argv)
     object_file = NULL;
     if (optind < argc) {
 	object_filename = argv[optind];
-	object_file = fopen(object_filename, "r");
+	object_file = open_object(object_filename);
 	if (!object_file) {
 	    fprintf(stderr, "Couldn't open object file %s\n", object_filename);
 	    exit(1);
@@ -181,6 +220,13 @@ int sim_main(int argc, char **argv)
 	exit(0);
     }
 
+    /* Run the processor tests of ../ptest in process (-T flag) */
+    if (do_ptest) {
+	if (object_file)
+	    fclose(object_file);
+	run_ptest_sim();
+    }
+
     /* Otherwise, run the simulator in TTY mode (no -g flag) */
     run_tty_sim();
 
@@ -284,18 +330,46 @@ static void run_tty_sim()
 
 
 
+/*
+ * run_ptest_sim - Run the tests generated by the scripts in ../ptest,
+ * checking each against the ISA simulator instruction by instruction
+ */
+static void run_ptest_sim()
+{
+    int errors = ptest_run(simname, ptest_iaddq, sim_threads,
+			   instr_limit, verbosity);
+    exit(errors ? 1 : 0);
+}
+
+/*
+ * run_batch_sim - Run each of the object files, printing a CSV summary
+ * rather than the TTY report.  Cycles are only traced, to stderr, if
+ * -v 2 is given.
+ */
+static void run_batch_sim(char **files, int nfiles)
+{
+    FILE *trace = verbosity_set && verbosity >= 2 ? stderr : NULL;
+    int errors = batch_run(files, nfiles, sim_threads, instr_limit,
+			   do_check, trace);
+    exit(errors ? 1 : 0);
+}
+
 /*
  * usage - print helpful diagnostic information
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgTic] [-l m] [-v n] [-j J] file.yo\n", name);
     printf("file.yo required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
     printf("   -t     Test result against ISA simulator (yis) [TTY mode only]\n");
+    printf("   -T     Run the ptest suite against the ISA simulator (replaces ptest/*.pl)\n");
+    printf("   -i     Include the iaddq tests in the ptest suite\n");
+    printf("   -c     Run every file.yo given and print a CSV summary (batch mode)\n");
+    printf("   -j J   Run the tests or files on J threads (default %d)\n", sim_threads);
     exit(0);
 }
 
@@ -312,68 +386,68 @@ static void usage(char *name)
 /*
  * Variables related to hardware units in the processor
  */
-mem_t mem;  /* Instruction and data memory */
-word_t minAddr = 0;
-word_t memCnt = 0;
+SIM_TLS mem_t mem;  /* Instruction and data memory */
+SIM_TLS word_t minAddr = 0;
+SIM_TLS word_t memCnt = 0;
 
 /* Other processor state */
-mem_t reg;               /* Register file */
-cc_t cc = DEFAULT_CC;    /* Condition code register */
-cc_t cc_in = DEFAULT_CC; /* Input to condition code register */
+SIM_TLS mem_t reg;               /* Register file */
+SIM_TLS cc_t cc = DEFAULT_CC;    /* Condition code register */
+SIM_TLS cc_t cc_in = DEFAULT_CC; /* Input to condition code register */
 
 /* 
  * SEQ+: Results computed by previous instruction.
  * Used to compute PC in current instruction 
  */
-byte_t prev_icode = I_NOP;
-byte_t prev_ifun = 0;
-word_t prev_valc = 0;
-word_t prev_valm = 0;
-word_t prev_valp = 0;
-bool_t prev_bcond = FALSE;
+SIM_TLS byte_t prev_icode = I_NOP;
+SIM_TLS byte_t prev_ifun = 0;
+SIM_TLS word_t prev_valc = 0;
+SIM_TLS word_t prev_valm = 0;
+SIM_TLS word_t prev_valp = 0;
+SIM_TLS bool_t prev_bcond = FALSE;
 
-byte_t prev_icode_in = I_NOP;
-byte_t prev_ifun_in = 0;
-word_t prev_valc_in = 0;
-word_t prev_valm_in = 0;
-word_t prev_valp_in = 0;
-bool_t prev_bcond_in = FALSE;
+SIM_TLS byte_t prev_icode_in = I_NOP;
+SIM_TLS byte_t prev_ifun_in = 0;
+SIM_TLS word_t prev_valc_in = 0;
+SIM_TLS word_t prev_valm_in = 0;
+SIM_TLS word_t prev_valp_in = 0;
+SIM_TLS bool_t prev_bcond_in = FALSE;
 
 
 /* Program Counter */
-word_t pc = 0; /* Program counter value */
-word_t pc_in = 0;/* Input to program counter */
+SIM_TLS word_t pc = 0; /* Program counter value */
+SIM_TLS word_t pc_in = 0;/* Input to program counter */
 
 /* Intermediate values */
-byte_t imem_icode = I_NOP;
-byte_t imem_ifun = F_NONE;
-byte_t icode = I_NOP;
-word_t ifun = 0;
-byte_t instr = HPACK(I_NOP, F_NONE);
-word_t ra = REG_NONE;
-word_t rb = REG_NONE;
-word_t valc = 0;
-word_t valp = 0;
-bool_t imem_error;
-bool_t instr_valid;
-
-word_t srcA = REG_NONE;
-word_t srcB = REG_NONE;
-word_t destE = REG_NONE;
-word_t destM = REG_NONE;
-word_t vala = 0;
-word_t valb = 0;
-word_t vale = 0;
-
-bool_t bcond = FALSE;
-bool_t cond = FALSE;
-word_t valm = 0;
-bool_t dmem_error;
-
-bool_t mem_write = FALSE;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-byte_t status = STAT_AOK;
+SIM_TLS byte_t imem_icode = I_NOP;
+SIM_TLS byte_t imem_ifun = F_NONE;
+SIM_TLS byte_t icode = I_NOP;
+SIM_TLS word_t ifun = 0;
+SIM_TLS byte_t instr = HPACK(I_NOP, F_NONE);
+SIM_TLS word_t ra = REG_NONE;
+SIM_TLS word_t rb = REG_NONE;
+SIM_TLS word_t valc = 0;
+SIM_TLS word_t valp = 0;
+SIM_TLS bool_t imem_error;
+SIM_TLS bool_t instr_valid;
+
+SIM_TLS word_t srcA = REG_NONE;
+SIM_TLS word_t srcB = REG_NONE;
+SIM_TLS word_t destE = REG_NONE;
+SIM_TLS word_t destM = REG_NONE;
+SIM_TLS word_t vala = 0;
+SIM_TLS word_t valb = 0;
+SIM_TLS word_t vale = 0;
+
+SIM_TLS bool_t bcond = FALSE;
+SIM_TLS bool_t cond = FALSE;
+SIM_TLS word_t valm = 0;
+SIM_TLS bool_t dmem_error;
+
+SIM_TLS bool_t mem_write = FALSE;
+SIM_TLS word_t mem_addr = 0;
+SIM_TLS word_t mem_data = 0;
+SIM_TLS byte_t status = STAT_AOK;
 
 
 /* Values computed by control logic */
@@ -399,7 +473,7 @@ word_t gen_Stat();
 word_t gen_new_pc();
 
 /* Log file */
-FILE *dumpfile = NULL;
+SIM_TLS FILE *dumpfile = NULL;
 
 #ifdef HAS_GUI
 /* Representations of digits */
@@ -540,7 +614,7 @@ static void sim_report() {
 
 }
 
-static int initialized = 0;
+static SIM_TLS int initialized = 0;
 void sim_init()
 {
 
@@ -611,6 +685,15 @@ void sim_reset()
     sim_report();
 }
 
+void sim_free()
+{
+    if (!initialized)
+	return;
+    free_mem(mem);
+    free_reg(reg);
+    initialized = 0;
+}
+
 /* Update the processor state */
 static void update_state()
 {
@@ -711,8 +794,9 @@ static byte_t sim_step()
     } else {
 	valc = 0;
     }
-    sim_log("IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
-	    iname(HPACK(icode,ifun)), pc, reg_name(ra), reg_name(rb), valc);
+    if (dumpfile)
+	sim_log("IF: Fetched %s at 0x%llx.  ra=%s, rb=%s, valC = 0x%llx\n",
+		iname(HPACK(icode,ifun)), pc, reg_name(ra), reg_name(rb), valc);
 
     if (status == STAT_AOK && icode == I_HALT) {
 	status = STAT_HLT;
@@ -809,6 +893,80 @@ word_t sim_run(word_t max_instr, byte_t *statusp, cc_t *ccp)
     return icount;
 }
 
+/*
+  Run the program in image in lockstep with the ISA simulator (see
+  ptsuite.h).  At the end of sim_step the register, memory and
+  condition code updates of the instruction are still pending until
+  the next update_state, so they are applied to copies of the state
+  before comparing.
+*/
+void sim_check_prog(mem_t image, word_t max_instr, check_ptr c)
+{
+    state_ptr isa_state;
+    mem_t rview = init_reg();
+    mem_t mview = init_mem(MEM_SIZE);
+    byte_t run_status = STAT_AOK;
+    byte_t isa_status;
+    cc_t cc_view;
+
+    sim_reset();
+    set_mem(mem, image);
+    isa_state = new_state(mem->len);
+    set_mem(isa_state->m, mem);
+    isa_state->cc = cc;
+
+    c->ok = TRUE;
+    for (c->instr = 0; c->instr < max_instr; c->instr++) {
+	run_status = sim_step();
+	c->cycle = c->instr;
+	c->pc = pc;
+	isa_status = step_state(isa_state, NULL);
+	memcpy(rview->contents, reg->contents, reg->len);
+	set_mem(mview, mem);
+	cc_view = cc;
+	if (run_status == STAT_AOK) {
+	    if (destE != REG_NONE)
+		set_reg_val(rview, destE, vale);
+	    if (destM != REG_NONE)
+		set_reg_val(rview, destM, valm);
+	    if (mem_write)
+		set_word_val(mview, mem_addr, mem_data);
+	    cc_view = cc_in;
+	}
+	if (!check_state(isa_state, isa_status, rview, mview, run_status,
+			 TRUE, cc_view, c)) {
+	    c->ok = FALSE;
+	    break;
+	}
+	if (run_status != STAT_AOK)
+	    break;
+    }
+    c->stat = run_status;
+    free_state(isa_state);
+    free_reg(rview);
+    free_mem(mview);
+}
+
+/*
+  For batch.c: run image, or check it with sim_check_prog.  Every
+  instruction takes one cycle.  The check stops short of counting the
+  last instruction when it ends the run with an exception, which
+  sim_run counts.
+*/
+void sim_batch_prog(mem_t image, word_t max_instr, batch_ptr b, check_ptr c)
+{
+    if (c) {
+	sim_check_prog(image, max_instr, c);
+	b->stat = c->stat;
+	b->instr = c->instr + (c->ok && c->stat != STAT_AOK);
+    } else {
+	sim_reset();
+	set_mem(mem, image);
+	b->instr = sim_run(max_instr, &b->stat, NULL);
+    }
+    b->cycles = b->instr;
+}
+
 /* If dumpfile set nonNULL, lots of status info printed out */
 void sim_set_dumpfile(FILE *df)
 {
@@ -6,6 +6,7 @@
 #include <assert.h>
 #include "cachelab.h"
 #include <time.h>
+#include <string.h>
 
 trans_func_t func_list[MAX_TRANS_FUNCS];
 int func_counter = 0; 
@@ -81,3 +82,145 @@ void registerTransFunction(void (*trans)(int M, int N, int[N][M], int[M][N]),
     func_list[func_counter].num_evictions =0;
     func_counter++;
 }
+
+/* Ops in the order of their record codes */
+static const char traceOps[] = "LSMI";
+
+/*
+ * traceWriterOpen - Start a binary trace
+ */
+int traceWriterOpen(trace_writer_t *w, const char *filename)
+{
+    w->fp = strcmp(filename, "-") == 0 ? stdout : fopen(filename, "wb");
+    if (!w->fp)
+        return 0;
+    w->count = 0;
+    w->len = 0;
+    w->prev = 0;
+    fwrite(TRACE_MAGIC, 1, TRACE_MAGIC_LEN, w->fp);
+    return 1;
+}
+
+static void tracePutWord(unsigned char *p, unsigned int v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static void traceFlush(trace_writer_t *w)
+{
+    unsigned char header[TRACE_BLOCK_HEADER];
+
+    if (w->count == 0)
+        return;
+    tracePutWord(header, w->count);
+    tracePutWord(header + 4, w->len);
+    fwrite(header, 1, TRACE_BLOCK_HEADER, w->fp);
+    fwrite(w->buf, 1, w->len, w->fp);
+    w->count = 0;
+    w->len = 0;
+    w->prev = 0;
+}
+
+static unsigned char *tracePutVarint(unsigned char *p, unsigned long long v)
+{
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*
+ * traceWrite - Append one access to a binary trace
+ */
+void traceWrite(trace_writer_t *w, char op, unsigned long long addr,
+                unsigned int size)
+{
+    unsigned char *p;
+    unsigned long long delta;
+    int code;
+
+    if (w->len + TRACE_MAX_RECORD > TRACE_BLOCK_BYTES)
+        traceFlush(w);
+    p = w->buf + w->len;
+
+    for (code = 0; code < 7 && (1u << code) != size; code++)
+        ;
+    *p++ = (strchr(traceOps, op) - traceOps) | code << 2;
+
+    delta = addr - w->prev;
+    p = tracePutVarint(p, delta << 1 ^ -(delta >> 63));
+    if (code == 7)
+        p = tracePutVarint(p, size);
+
+    w->prev = addr;
+    w->len = p - w->buf;
+    w->count++;
+}
+
+/*
+ * traceWriterClose - Finish a binary trace
+ */
+int traceWriterClose(trace_writer_t *w)
+{
+    int ok;
+
+    traceFlush(w);
+    ok = !ferror(w->fp);
+    if (w->fp == stdout)
+        ok = fflush(w->fp) == 0 && ok;
+    else
+        ok = fclose(w->fp) == 0 && ok;
+    return ok;
+}
+
+unsigned int traceGetWord(const unsigned char *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (unsigned int) p[3] << 24;
+}
+
+static const unsigned char *traceGetVarint(const unsigned char *p,
+                                           const unsigned char *end,
+                                           unsigned long long *v)
+{
+    int shift;
+
+    *v = 0;
+    for (shift = 0; p < end && shift < 64; shift += 7) {
+        *v |= (unsigned long long) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+/*
+ * traceDecode - Decode one record of a binary trace block
+ */
+const unsigned char *traceDecode(const unsigned char *p,
+                                 const unsigned char *end, char *op,
+                                 unsigned long long *addr,
+                                 unsigned int *size)
+{
+    unsigned long long v;
+    int code;
+
+    if (p >= end)
+        return NULL;
+    *op = traceOps[*p & 3];
+    code = *p++ >> 2 & 7;
+    if (!(p = traceGetVarint(p, end, &v)))
+        return NULL;
+    *addr += v >> 1 ^ -(v & 1);
+    if (code == 7) {
+        if (!(p = traceGetVarint(p, end, &v)))
+            return NULL;
+        *size = v;
+    } else
+        *size = 1u << code;
+    return p;
+}
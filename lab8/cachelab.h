@@ -5,6 +5,8 @@
 #ifndef CACHELAB_TOOLS_H
 #define CACHELAB_TOOLS_H
 
+#include <stdio.h>
+
 #define MAX_TRANS_FUNCS 100
 
 typedef struct trans_func{
@@ -34,4 +36,62 @@ void correctTrans(int M, int N, int A[N][M], int B[M][N]);
 void registerTransFunction(
     void (*trans)(int M,int N,int[N][M],int[M][N]), char* desc);
 
+/*
+ * Binary traces.  A file starts with the 8 bytes of TRACE_MAGIC and is
+ * followed by blocks.  A block is a header of two little-endian 32-bit
+ * words, the number of records and the number of payload bytes, and
+ * then the records.  A record is one byte holding the op (bits 0-1,
+ * L S M I) and the size (bits 2-4, 1 << code, or 7 for a varint size
+ * after the address), then the zigzag varint of the address minus the
+ * one before it in the block.  The first address of a block is taken
+ * against 0, so blocks decode independently.
+ */
+#define TRACE_MAGIC "CLTRACE1"
+#define TRACE_MAGIC_LEN 8
+#define TRACE_BLOCK_HEADER 8
+#define TRACE_BLOCK_BYTES (1 << 16)
+#define TRACE_MAX_RECORD (1 + 10 + 5)
+
+typedef struct trace_writer {
+    FILE *fp;
+    unsigned int count;
+    unsigned int len;
+    unsigned long long prev;
+    unsigned char buf[TRACE_BLOCK_BYTES];
+} trace_writer_t;
+
+/* Start a binary trace in filename, "-" for stdout; 0 on failure */
+int traceWriterOpen(trace_writer_t *w, const char *filename);
+
+/* Append one access, op is one of 'L', 'S', 'M' or 'I' */
+void traceWrite(trace_writer_t *w, char op, unsigned long long addr,
+                unsigned int size);
+
+/* Flush the last block and close the file; 0 on a write error */
+int traceWriterClose(trace_writer_t *w);
+
+/* Little-endian 32-bit word at p, as in block headers */
+unsigned int traceGetWord(const unsigned char *p);
+
+/*
+ * traceDecode - Decode the record at p, which must end before end.
+ * *addr holds the previous address of the block on entry and the new
+ * one on return.  Returns the byte after the record, or NULL if it is
+ * malformed.
+ */
+const unsigned char *traceDecode(const unsigned char *p,
+                                 const unsigned char *end, char *op,
+                                 unsigned long long *addr,
+                                 unsigned int *size);
+
+/*
+ * In-process tracing (tracer.c, for tracegen-inst).  tracerInit sets up
+ * an s, E, b LRU cache that is fed the accesses of every region marked
+ * by accesses to start and end, each region from an empty cache, and
+ * tracerResults gives the counts of the last one.
+ */
+void tracerInit(unsigned int s, unsigned int E, unsigned int b,
+                const volatile void *start, const volatile void *end);
+void tracerResults(int *hits, int *misses, int *evictions);
+
 #endif /* CACHELAB_TOOLS_H */
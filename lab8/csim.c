@@ -1,61 +1,524 @@
+#define _POSIX_C_SOURCE 200112L
 #include "cachelab.h"
 #include "stdint.h"
 #include "stdio.h"
+#include <errno.h>
 #include <getopt.h>
 #include "string.h"
 #include "stdlib.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
 
+//tags of a set start on a cache line and are padded to whole lines
+#define CACHE_LINE 64
+#define TAGS_PER_LINE (CACHE_LINE / sizeof(uint64_t))
+
+//ways are filled in order, so ways [0, used) have been used; of those,
+//holes have been invalidated since (by a cache hierarchy) and hold
+//INVALID_TAG, which no address can have unless s + b is 0
+//with prefetchers, prefetched marks lines filled by a prefetch and not
+//used since, and displaced remembers the last e victims of prefetches,
+//from displacedNext on, to tell the misses they cause
+//the rest is metadata of the replacement policy, allocated only if used:
+//lru and fifo keep a doubly linked list of ways threaded through
+//prev/next, from head (most recently used or filled) to tail; plru keeps
+//the node bits of its tree and rrip the re-reference value of each way
+//in bits; lfu counts uses in counts; random and brrip keep their random
+//number generator in state
 typedef struct {
-    uint64_t tag;
-    uint8_t valid;
-    uint64_t lastVisitTime;
-} line_t;
-typedef struct {
-    line_t *lines;
+    uint64_t *tags;
+    uint8_t *dirty;
+    uint8_t *prefetched;
+    uint64_t *displaced;
+    uint64_t displacedNext;
+    uint32_t *prev;
+    uint32_t *next;
+    uint32_t head;
+    uint32_t tail;
+    uint8_t *bits;
+    uint32_t *counts;
+    uint64_t state;
+    uint64_t used;
+    uint64_t holes;
     uint64_t e;
+    uint64_t index;
 } set_slot_t;
+
+#define INVALID_TAG UINT64_MAX
+#define NO_WAY UINT32_MAX
+
+//replacement policy: hit and insert update the metadata of a set for a
+//hit on way or a fill of an empty way; evict picks the way to refill
+//and updates the metadata as if the new line was inserted there;
+//invalidate forgets way, which becomes empty
+typedef struct {
+    const char *name;
+    void (*hit)(set_slot_t *setSlot, uint32_t way);
+    void (*insert)(set_slot_t *setSlot, uint32_t way);
+    uint32_t (*evict)(set_slot_t *setSlot);
+    void (*invalidate)(set_slot_t *setSlot, uint32_t way);
+} policy_t;
+
+//sets by index, each calloc'd on first use so that a cache costs the
+//memory of the sets a trace touches: up to DENSE_BITS index bits the
+//slots are an array indexed directly, past that an open addressing
+//table of the indices used so far, keyed by keys; elements are size bytes
 typedef struct {
-    set_slot_t *sets;
+    void **slots;
+    uint64_t *keys;
+    uint64_t capacity;
+    uint64_t count;
+    size_t size;
+} sparse_t;
+
+#define DENSE_BITS 16
+
+//sparse init for indices of bits bits
+void sparseInit(sparse_t *sparse, uint8_t bits, size_t size);
+
+//element at index, set to zero bytes if *created
+void *sparseGet(sparse_t *sparse, uint64_t index, int *created);
+
+//free every element (slots [0, capacity) that are not NULL) and the table
+void sparseDelete(sparse_t *sparse);
+
+//mask of the low bits bits of a 64 bit number
+uint64_t lowMask(uint8_t bits);
+
+//sets are made on first use from e and seed
+typedef struct {
+    sparse_t sets;
     uint8_t setIndexBit;
     uint8_t blockBit;
+    uint64_t setMask;
+    uint64_t e;
+    uint64_t seed;
     uint32_t hitTimes;
     uint32_t missTimes;
     uint32_t evictionTimes;
+    uint64_t writebackTimes;
+    uint64_t prefetchTimes;
+    uint64_t usefulPrefetchTimes;
+    uint64_t prefetchEvictionTimes;
+    uint64_t pollutionMissTimes;
 } cache_t;
 
-//cache init
-void cacheInit(cache_t *cache, uint8_t blockBit, uint8_t setIndexBit, uint64_t e);
+//cache init, seed drives the random policies
+void cacheInit(cache_t *cache, uint8_t blockBit, uint8_t setIndexBit, uint64_t e, uint64_t seed);
 
 //cache delete
 void cacheDelete(cache_t *cache);
 
+//free the sets of a cache
+void cacheSetsDelete(cache_t *cache);
+
+//set at setIndex, made if it is the first use
+set_slot_t *cacheSet(cache_t *cache, uint64_t setIndex);
+
+//set and tag of address
+set_slot_t *cacheSetOf(cache_t *cache, uint64_t address, uint64_t *tag);
+
+//line aligned room for e tags
+uint64_t *tagsAlloc(uint64_t e);
+
 //set slot init
-void setSlotInit(set_slot_t *setSlot, uint64_t e);
+void setSlotInit(set_slot_t *setSlot, uint64_t e, uint64_t seed);
 
 //set slot delete
 void setSlotDelete(set_slot_t *setSlot);
 
-//simulate cache
-void cacheVisitAddress(cache_t *cache, uint64_t address);
+//simulate cache, write marks the line dirty
+void cacheVisitAddress(cache_t *cache, uint64_t address, int write);
 
-//eviction = miss + eviction
+//fill address for a prefetch, unless it is cached already
+void cachePrefetch(cache_t *cache, uint64_t address);
+
+//eviction = miss + eviction, prefetchHit = first hit on a prefetched line
 enum set_visit_result {
-    hit, miss, eviction
+    hit, miss, eviction, prefetchHit
+};
+
+//simulate set; on eviction, *victimDirty says if the victim was dirty
+enum set_visit_result setVisitAddress(set_slot_t *setSlot, uint64_t tag, int write, int *victimDirty);
+
+//way holding tag, or used if none
+uint64_t setFind(set_slot_t *setSlot, uint64_t tag);
+
+//put tag in an empty way, or evict one for it and return the victim's
+//tag and dirty bit; the way is returned in *way, clean
+enum set_visit_result setFill(set_slot_t *setSlot, uint64_t tag, uint32_t *way, uint64_t *victim, int *victimDirty);
+
+//empty way
+void setInvalidate(set_slot_t *setSlot, uint32_t way);
+
+//make way the most recently used of the set
+void setTouch(set_slot_t *setSlot, uint32_t way);
+
+//replacement policies
+void lruInsert(set_slot_t *setSlot, uint32_t way);
+uint32_t lruEvict(set_slot_t *setSlot);
+void lruInvalidate(set_slot_t *setSlot, uint32_t way);
+void noUpdate(set_slot_t *setSlot, uint32_t way);
+uint32_t randomEvict(set_slot_t *setSlot);
+void plruTouch(set_slot_t *setSlot, uint32_t way);
+uint32_t plruEvict(set_slot_t *setSlot);
+void lfuHit(set_slot_t *setSlot, uint32_t way);
+void lfuInsert(set_slot_t *setSlot, uint32_t way);
+uint32_t lfuEvict(set_slot_t *setSlot);
+void rripHit(set_slot_t *setSlot, uint32_t way);
+uint32_t rripVictim(set_slot_t *setSlot);
+void srripInsert(set_slot_t *setSlot, uint32_t way);
+uint32_t srripEvict(set_slot_t *setSlot);
+void brripInsert(set_slot_t *setSlot, uint32_t way);
+uint32_t brripEvict(set_slot_t *setSlot);
+
+//next number of a set's random number generator (xorshift64*)
+uint64_t setRandom(set_slot_t *setSlot);
+
+policy_t policies[] = {
+    {"lru", setTouch, lruInsert, lruEvict, lruInvalidate},
+    {"fifo", noUpdate, lruInsert, lruEvict, lruInvalidate},
+    {"random", noUpdate, noUpdate, randomEvict, noUpdate},
+    {"plru", plruTouch, plruTouch, plruEvict, noUpdate},
+    {"lfu", lfuHit, lfuInsert, lfuEvict, noUpdate},
+    {"srrip", rripHit, srripInsert, srripEvict, noUpdate},
+    {"brrip", rripHit, brripInsert, brripEvict, noUpdate},
 };
 
-//simulate set
-enum set_visit_result setVisitAddress(set_slot_t *setSlot, uint64_t tag);
+//policy of the simulation, chosen with -p
+policy_t *policy = &policies[0];
+
+//re-reference values of rrip: a hit predicts near, an insert long, and
+//ways predicted distant are evicted; brrip inserts distant except one
+//time in BRRIP_LONG
+#define RRPV_DISTANT 3
+#define RRPV_LONG 2
+#define BRRIP_LONG 32
+
+//index of tag among the first n tags, n if absent
+typedef uint64_t (*tag_find_t)(const uint64_t *tags, uint64_t n, uint64_t tag);
+
+uint64_t tagFindScalar(const uint64_t *tags, uint64_t n, uint64_t tag);
+#ifdef __x86_64__
+uint64_t tagFindSse(const uint64_t *tags, uint64_t n, uint64_t tag);
+uint64_t tagFindAvx2(const uint64_t *tags, uint64_t n, uint64_t tag);
+#endif
+
+//widest tag search the cpu supports, chosen by cacheInit
+tag_find_t tagFind = tagFindScalar;
+
+//one access of a trace, op is 'L', 'S', 'M', or 'I' if fetches are read
+typedef struct {
+    char op;
+    uint64_t address;
+    uint32_t size;
+} access_t;
+
+//block read when the trace can't be mapped (pipes, stdin)
+#define TRACE_BLOCK (1 << 20)
+
+//unparsed trace is [cur, end); it is either the whole file mapped in
+//place, or a block read into buf
+//binary traces (see cachelab.h) decode left more records of the current
+//block up to blockEnd, from the address prev
+//with markers, only accesses from the one to markerStart to the one to
+//markerEnd are returned (inside is set in between), as by test-trans;
+//tracegen -l announces both on a "markers <start> <end>" line
+typedef struct {
+    const char *cur;
+    const char *end;
+    char *map;
+    size_t mapLength;
+    char *buf;
+    int fd;
+    int eof;
+    int binary;
+    const char *blockEnd;
+    uint32_t left;
+    unsigned long long prev;
+    int fetches;
+    int markers;
+    uint64_t markerStart;
+    uint64_t markerEnd;
+    int inside;
+} trace_reader_t;
+
+//whether traces are cut to the marked region of tracegen (-m)
+int traceMarkers = 0;
+
+//open a trace file, "-" for stdin; return 0 if it can't be opened
+int traceOpen(trace_reader_t *reader, const char *traceFileName);
+
+//next data access of the trace; return 0 at the end
+int traceNext(trace_reader_t *reader, access_t *access);
+
+//close a trace
+void traceClose(trace_reader_t *reader);
+
+//refill the block after the unparsed tail; return 0 if nothing was added
+int traceFill(trace_reader_t *reader);
+
+//refill until n bytes are unparsed; return 0 if the trace ends first
+int traceNeed(trace_reader_t *reader, size_t n);
+
+//traceNext for binary traces
+int traceNextBinary(trace_reader_t *reader, access_t *access);
+
+//blocks an access touches, as block numbers first..last; the whole of
+//its size with -a, else only the block of its address
+void accessBlocks(const access_t *access, uint8_t blockBit, uint64_t *first, uint64_t *last);
+
+//whether accesses cover their size (-a) rather than just their address
+int accessSizes = 0;
+
+//hardware prefetchers, trained on the demand accesses alone so that they
+//don't depend on the state of the cache (nor on -j): next fetches the
+//blocks following each access; stride keeps, per instruction address of
+//the I record before an access, the last address and stride, and once
+//the same stride repeats fetches along it; stream follows a few
+//ascending or descending runs of nearby blocks and fetches ahead of each
+//run once it has moved twice the same way
+//each fetches degree blocks (or strides), starting distance ahead
+enum prefetch_kind {
+    nextLine, strided, stream
+};
+
+#define PREFETCHERS 3
+#define PREFETCH_DEGREE 64
+#define STRIDE_ENTRIES 256
+#define STRIDE_CONFIDENT 2
+#define STREAMS 16
+#define STREAM_WINDOW 16
+
+typedef struct {
+    uint64_t pc;
+    uint64_t last;
+    uint64_t stride;
+    int confidence;
+} stride_entry_t;
+
+typedef struct {
+    uint64_t last;
+    int direction;
+    uint64_t stamp;
+} stream_t;
+
+typedef struct {
+    enum prefetch_kind kind;
+    uint32_t degree;
+    uint32_t distance;
+    stride_entry_t *table;
+    stream_t *streams;
+    uint64_t now;
+} prefetcher_t;
+
+//prefetchers of the simulation, chosen with -P
+prefetcher_t prefetchers[PREFETCHERS];
+int prefetcherCount = 0;
+
+//set up prefetchers from -P: comma separated kind[:degree[:distance]],
+//kind next, stride or stream; return 0 with a message if malformed
+int prefetchInit(char *spec);
+
+//free prefetchers
+void prefetchDelete(void);
+
+//train the prefetchers on an access by the instruction at pc, and put
+//the blocks they fetch in blocks; return how many
+uint32_t prefetchBlocks(const access_t *access, uint64_t pc, uint8_t blockBit, uint64_t *blocks);
 
 //run simulation
 void simulateCache(cache_t *cache, char *traceFileName);
 
+//accesses handed to the threads at a time
+#define BATCH (1 << 16)
+
+//one thread of a parallel simulation; it owns a range of sets, and counts
+//into its own copy of the cache that shares the sets with the others
+//the main thread fills one of the two queues while the workers run the
+//other, and the two sides meet at a barrier between batches
+//each worker has sets of its own, since making them isn't thread safe
+typedef struct {
+    uint64_t block;
+    int write;
+    int prefetch;
+} queue_entry_t;
+
+typedef struct {
+    pthread_t thread;
+    cache_t cache;
+    queue_entry_t *queue[2];
+    uint32_t count[2];
+    uint32_t capacity[2];
+    pthread_barrier_t *barrier;
+    const int *last;
+} worker_t;
+
+//run simulation on threads, each owning a range of sets
+void simulateCacheParallel(cache_t *cache, char *traceFileName, int threads);
+
+//worker thread
+void *workerRun(void *arg);
+
+//queue entry on buf of worker, growing the queue if full
+void workerPush(worker_t *worker, int buf, uint64_t block, int write, int prefetch);
+
+//worker owning the set of block, out of threads
+int workerOf(cache_t *cache, uint64_t block, int threads);
+
+//how a level holds the lines of the levels above it: nine (neither
+//inclusive nor exclusive) fills on every miss and evicts freely,
+//inclusive also invalidates above whatever it evicts, and exclusive
+//only takes lines evicted above and hands a line up when it hits
+enum inclusion {
+    nine, inclusive, exclusive
+};
+
+struct hierarchy;
+
+//one level of a hierarchy; lines go to memory below the last level
+typedef struct level {
+    const char *name;
+    cache_t cache;
+    int writeBack;
+    enum inclusion inclusion;
+    struct level *below;
+    struct level *above[2];
+    int aboveCount;
+    struct hierarchy *hierarchy;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;
+} level_t;
+
+//l1i and l1d feed l2, which feeds llc; absent levels are skipped
+enum {
+    L1I, L1D, L2, LLC, LEVELS
+};
+
+typedef struct hierarchy {
+    level_t levels[LEVELS];
+    int present[LEVELS];
+    uint64_t memoryReads;
+    uint64_t memoryWrites;
+} hierarchy_t;
+
+//set up a hierarchy from -H: comma separated levels, each
+//name=s:E:b[:wb|:wt][:nine|:inclusive|:exclusive], named l1i, l1d, l2 or
+//llc; return 0 with a message if it is malformed
+int hierarchyInit(hierarchy_t *hierarchy, char *spec, uint64_t seed);
+
+//hierarchy delete
+void hierarchyDelete(hierarchy_t *hierarchy);
+
+//run the trace through the hierarchy, print each level
+void simulateHierarchy(hierarchy_t *hierarchy, char *traceFileName);
+
+//set and tag of address in level
+set_slot_t *levelSet(level_t *level, uint64_t address, uint64_t *tag);
+
+//address of the block of tag in set of level
+uint64_t levelAddress(level_t *level, set_slot_t *setSlot, uint64_t tag);
+
+//read or write of address at level, from the cpu or for a miss above;
+//return the dirty bit of a line an exclusive level hands up
+int levelAccess(level_t *level, uint64_t address, int write, int fromAbove);
+
+//put tag in level, writing back or passing down whatever it evicts
+uint32_t levelFill(level_t *level, set_slot_t *setSlot, uint64_t tag, int dirty);
+
+//send the block at address from level down, as a victim leaving level
+//or written through while level keeps it
+void levelWriteDown(level_t *level, uint64_t address, int dirty, int victim);
+
+//whether a level right above level holds the block at address
+int levelHeldAbove(level_t *level, uint64_t address);
+
+//drop the block at address of level from every level above; return 1 if
+//a dropped copy was dirty
+int levelBackInvalidate(level_t *level, uint64_t address);
+
+//lru stack of one set, as far down as the limit: every block among the
+//limit most recently used is stamped with the time of its last use, and
+//a fenwick tree over the stamps counts how many blocks were used since
+//any given time, which is the stack distance of the block used then
+typedef struct {
+    uint32_t *tree;
+    uint64_t *blockAt;
+    uint32_t capacity;
+    uint32_t now;
+    uint32_t live;
+    uint64_t distinct;
+} stack_set_t;
+
+//stack distances of every set at once, for associativities 1..limit
+//stamps of live blocks are found by block address in an open addressing
+//table, where stamp 0 marks an empty slot
+typedef struct {
+    sparse_t sets;
+    uint8_t setIndexBit;
+    uint8_t blockBit;
+    uint64_t setMask;
+    uint64_t limit;
+    uint64_t accesses;
+    uint64_t *hitsAt;
+    uint64_t *keys;
+    uint32_t *stamps;
+    uint64_t hashCapacity;
+    uint64_t hashCount;
+} stack_sim_t;
+
+//stack distance init
+void stackInit(stack_sim_t *stack, uint8_t blockBit, uint8_t setIndexBit, uint64_t limit);
+
+//stack distance delete
+void stackDelete(stack_sim_t *stack);
+
+//record one access
+void stackVisitAddress(stack_sim_t *stack, uint64_t address);
+
+//run the trace through the stack, print one row per associativity
+void simulateStack(stack_sim_t *stack, char *traceFileName);
+
+//slot of block in the table, or the empty slot where it would go
+uint64_t stackSlot(stack_sim_t *stack, uint64_t block);
+
+//remove the entry in slot, shifting back the entries probed past it
+void stackUnhash(stack_sim_t *stack, uint64_t slot);
+
+//double the table
+void stackRehash(stack_sim_t *stack);
+
+//renumber the live stamps of a set from 1, growing it if half full
+void stackCompact(stack_sim_t *stack, stack_set_t *set);
+
+//fenwick tree over stamps 1..capacity
+void fenwickAdd(uint32_t *tree, uint32_t capacity, uint32_t i, int32_t delta);
+uint32_t fenwickSum(const uint32_t *tree, uint32_t i);
+
+//smallest stamp in use
+uint32_t fenwickFirst(const uint32_t *tree, uint32_t capacity);
+
 
 int main(int argc, char *const argv[]) {
   char *fileName = NULL;
-  int option = getopt(argc, argv, "sEbt");
+  int option = getopt(argc, argv, "sEbtdjprHaPm");
   uint64_t setIndexBit = 0;
   uint64_t blockBit = 0;
   uint64_t e = 0;
+  uint64_t limit = 0;
+  int threads = 0;
+  uint64_t seed = 1;
+  char *policyName = NULL;
+  char *hierarchySpec = NULL;
+  char *prefetchSpec = NULL;
   while (option != -1) {
     switch (option) {
       case 's':
@@ -71,151 +534,1606 @@ int main(int argc, char *const argv[]) {
         fileName = malloc(strlen(argv[optind]) + 1);
         strcpy(fileName, argv[optind]);
         break;
+      case 'd':
+        limit = strtoul(argv[optind], NULL, 10);
+        break;
+      case 'j':
+        threads = strtoul(argv[optind], NULL, 10);
+        break;
+      case 'p':
+        policyName = argv[optind];
+        break;
+      case 'r':
+        seed = strtoull(argv[optind], NULL, 10);
+        break;
+      case 'H':
+        hierarchySpec = argv[optind];
+        break;
+      case 'a':
+        accessSizes = 1;
+        break;
+      case 'P':
+        prefetchSpec = argv[optind];
+        break;
+      case 'm':
+        traceMarkers = 1;
+        break;
       default:
         break;
     }
 
-    option = getopt(argc, argv, "sEbt");
+    option = getopt(argc, argv, "sEbtdjprHaPm");
   }
   //check param validation
-  if (fileName == NULL || setIndexBit + blockBit > 64) {
+  if (fileName == NULL || (hierarchySpec == NULL && setIndexBit + blockBit > 64)) {
     exit(0);
   }
+  if (prefetchSpec != NULL && (limit > 0 || hierarchySpec != NULL)) {
+    fprintf(stderr, "-P can't be used with -d or -H\n");
+    exit(1);
+  }
+  //-d only models lru, on one thread
+  if (limit > 0 && (policyName != NULL || threads != 0 || hierarchySpec != NULL)) {
+    fprintf(stderr, "-d can't be used with -p, -j or -H\n");
+    exit(1);
+  }
+  if (prefetchSpec != NULL && !prefetchInit(prefetchSpec)) {
+    exit(1);
+  }
+  //-d limit: every associativity up to limit in one pass, instead of -E
+  if (limit > 0) {
+    stack_sim_t *stack = malloc(sizeof(stack_sim_t));
+    stackInit(stack, blockBit, setIndexBit, limit);
+    simulateStack(stack, fileName);
+    stackDelete(stack);
+    free(fileName);
+    return 0;
+  }
+  if (policyName == NULL) {
+    policyName = "lru";
+  }
+  policy = NULL;
+  for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); ++i) {
+    if (strcmp(policyName, policies[i].name) == 0) {
+      policy = &policies[i];
+    }
+  }
+  if (policy == NULL) {
+    fprintf(stderr, "unknown policy %s: lru, fifo, random, plru, lfu, srrip or brrip\n", policyName);
+    exit(1);
+  }
+  //-H spec: a hierarchy in place of -s, -E and -b
+  if (hierarchySpec != NULL) {
+    hierarchy_t *hierarchy = malloc(sizeof(hierarchy_t));
+    if (!hierarchyInit(hierarchy, hierarchySpec, seed)) {
+      exit(1);
+    }
+    simulateHierarchy(hierarchy, fileName);
+    hierarchyDelete(hierarchy);
+    free(fileName);
+    return 0;
+  }
+  if (policy->evict == plruEvict && (e & (e - 1)) != 0) {
+    fprintf(stderr, "plru needs E to be a power of two\n");
+    exit(1);
+  }
   cache_t *cache = malloc(sizeof(cache_t));
-  cacheInit(cache, blockBit, setIndexBit, e);
-  simulateCache(cache, fileName);
+  cacheInit(cache, blockBit, setIndexBit, e, seed);
+  //no more threads than sets
+  if (threads > 1 && setIndexBit < 31 && threads > 1 << setIndexBit) {
+    threads = 1 << setIndexBit;
+  }
+  if (threads > 1) {
+    simulateCacheParallel(cache, fileName, threads);
+  } else {
+    simulateCache(cache, fileName);
+  }
   printSummary((int) cache->hitTimes, (int) cache->missTimes, (int) cache->evictionTimes);
+  //every miss fills a block and every dirty victim writes one; lines
+  //still dirty at the end are not counted
+  uint64_t blockSize = (uint64_t) 1 << blockBit;
+  printf("writebacks:%llu dram bytes read:%llu written:%llu\n", (unsigned long long) cache->writebackTimes,
+         (unsigned long long) ((cache->missTimes + cache->prefetchTimes) * blockSize),
+         (unsigned long long) (cache->writebackTimes * blockSize));
+  //accuracy: prefetched lines used before eviction; coverage: misses
+  //that prefetches removed, of all the demand misses there would be
+  if (prefetcherCount > 0) {
+    uint64_t useful = cache->usefulPrefetchTimes;
+    printf("prefetches:%llu useful:%llu accuracy:%.3f coverage:%.3f prefetch evictions:%llu pollution misses:%llu\n",
+           (unsigned long long) cache->prefetchTimes, (unsigned long long) useful,
+           cache->prefetchTimes ? (double) useful / cache->prefetchTimes : 0.0,
+           useful + cache->missTimes ? (double) useful / (useful + cache->missTimes) : 0.0,
+           (unsigned long long) cache->prefetchEvictionTimes, (unsigned long long) cache->pollutionMissTimes);
+  }
+  prefetchDelete();
   cacheDelete(cache);
   free(fileName);
   return 0;
 }
 
-void cacheInit(cache_t *cache, uint8_t blockBit, uint8_t setIndexBit, uint64_t e) {
+void cacheInit(cache_t *cache, uint8_t blockBit, uint8_t setIndexBit, uint64_t e, uint64_t seed) {
   cache->setIndexBit = setIndexBit;
   cache->blockBit = blockBit;
+  cache->setMask = lowMask(setIndexBit);
+  cache->e = e;
+  cache->seed = seed;
 
 
   cache->evictionTimes = 0;
+  cache->writebackTimes = 0;
+  cache->prefetchTimes = 0;
+  cache->usefulPrefetchTimes = 0;
+  cache->prefetchEvictionTimes = 0;
+  cache->pollutionMissTimes = 0;
   cache->missTimes = 0;
   cache->hitTimes = 0;
 
-  cache->sets = malloc(sizeof(set_slot_t) * (1 << setIndexBit));
-  for (int i = 0; i < 1 << setIndexBit; ++i) {
-    setSlotInit(&cache->sets[i], e);
+#ifdef __x86_64__
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    tagFind = tagFindAvx2;
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    tagFind = tagFindSse;
+  }
+#endif
+
+  sparseInit(&cache->sets, setIndexBit, sizeof(set_slot_t));
+}
+
+uint64_t lowMask(uint8_t bits) {
+  return bits < 64 ? ((uint64_t) 1 << bits) - 1 : UINT64_MAX;
+}
+
+void sparseInit(sparse_t *sparse, uint8_t bits, size_t size) {
+  sparse->size = size;
+  sparse->count = 0;
+  sparse->keys = NULL;
+  sparse->capacity = (uint64_t) 1 << (bits <= DENSE_BITS ? bits : 10);
+  if (bits > DENSE_BITS) {
+    sparse->keys = malloc(sizeof(uint64_t) * sparse->capacity);
+  }
+  sparse->slots = calloc(sparse->capacity, sizeof(void *));
+}
+
+void *sparseGet(sparse_t *sparse, uint64_t index, int *created) {
+  uint64_t slot = index;
+  *created = 0;
+  if (sparse->keys != NULL) {
+    uint64_t mask = sparse->capacity - 1;
+    slot = (index * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+    while (sparse->slots[slot] != NULL && sparse->keys[slot] != index) {
+      slot = (slot + 1) & mask;
+    }
+  }
+  if (sparse->slots[slot] != NULL) {
+    return sparse->slots[slot];
+  }
+
+  void *element = calloc(1, sparse->size);
+  *created = 1;
+  ++sparse->count;
+  if (sparse->keys == NULL) {
+    return sparse->slots[slot] = element;
+  }
+  sparse->slots[slot] = element;
+  sparse->keys[slot] = index;
+  //grow at half full, putting every element back at its new slot
+  if (sparse->count * 2 > sparse->capacity) {
+    void **slots = sparse->slots;
+    uint64_t *keys = sparse->keys;
+    uint64_t capacity = sparse->capacity;
+    sparse->capacity *= 2;
+    sparse->slots = calloc(sparse->capacity, sizeof(void *));
+    sparse->keys = malloc(sizeof(uint64_t) * sparse->capacity);
+    uint64_t mask = sparse->capacity - 1;
+    for (uint64_t i = 0; i < capacity; ++i) {
+      if (slots[i] != NULL) {
+        uint64_t to = (keys[i] * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+        while (sparse->slots[to] != NULL) {
+          to = (to + 1) & mask;
+        }
+        sparse->slots[to] = slots[i];
+        sparse->keys[to] = keys[i];
+      }
+    }
+    free(slots);
+    free(keys);
+  }
+  return element;
+}
+
+void sparseDelete(sparse_t *sparse) {
+  for (uint64_t i = 0; i < sparse->capacity; ++i) {
+    free(sparse->slots[i]);
+  }
+  free(sparse->slots);
+  free(sparse->keys);
+}
+
+set_slot_t *cacheSet(cache_t *cache, uint64_t setIndex) {
+  int created;
+  set_slot_t *setSlot = sparseGet(&cache->sets, setIndex, &created);
+  if (created) {
+    setSlotInit(setSlot, cache->e, cache->seed + setIndex);
+    setSlot->index = setIndex;
   }
+  return setSlot;
+}
+
+set_slot_t *cacheSetOf(cache_t *cache, uint64_t address, uint64_t *tag) {
+  uint8_t bits = cache->blockBit + cache->setIndexBit;
+  *tag = bits < 64 ? address >> bits : 0;
+  return cacheSet(cache, (address >> cache->blockBit) & cache->setMask);
+}
 
+uint64_t *tagsAlloc(uint64_t e) {
+  uint64_t lines = (e + TAGS_PER_LINE - 1) / TAGS_PER_LINE;
+  void *tags = NULL;
+  if (posix_memalign(&tags, CACHE_LINE, lines * CACHE_LINE) != 0) {
+    exit(1);
+  }
+  return tags;
 }
 
-void setSlotInit(set_slot_t *setSlot, uint64_t e) {
+void setSlotInit(set_slot_t *setSlot, uint64_t e, uint64_t seed) {
   setSlot->e = e;
-  setSlot->lines = malloc(sizeof(line_t) * e);
-  for (int i = 0; i < e; ++i) {
-    setSlot->lines[i].lastVisitTime = 0;
-    setSlot->lines[i].tag = 0;
-    setSlot->lines[i].valid = 0;
+  setSlot->used = 0;
+  setSlot->holes = 0;
+  setSlot->head = NO_WAY;
+  setSlot->tail = NO_WAY;
+  setSlot->prev = NULL;
+  setSlot->next = NULL;
+  setSlot->bits = NULL;
+  setSlot->counts = NULL;
+  setSlot->tags = tagsAlloc(e);
+  setSlot->dirty = calloc(e, 1);
+  setSlot->prefetched = NULL;
+  setSlot->displaced = NULL;
+  setSlot->displacedNext = 0;
+  if (prefetcherCount > 0) {
+    setSlot->prefetched = calloc(e, 1);
+    setSlot->displaced = tagsAlloc(e);
+    for (uint64_t i = 0; i < e; ++i) {
+      setSlot->displaced[i] = INVALID_TAG;
+    }
   }
 
+  if (policy->evict == lruEvict) {
+    setSlot->prev = malloc(sizeof(uint32_t) * e);
+    setSlot->next = malloc(sizeof(uint32_t) * e);
+  } else if (policy->evict == plruEvict || policy->hit == rripHit) {
+    setSlot->bits = calloc(e, 1);
+  } else if (policy->evict == lfuEvict) {
+    setSlot->counts = malloc(sizeof(uint32_t) * e);
+  }
+  //splitmix64 of the seed, so neighbouring sets get unrelated sequences
+  seed += 0x9e3779b97f4a7c15ULL;
+  seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+  seed ^= seed >> 31;
+  setSlot->state = seed | 1;
 }
 
-void cacheVisitAddress(cache_t *cache, uint64_t address) {
-  uint64_t setIndex = (address >> cache->blockBit) & ((1 << cache->setIndexBit) - 1);
-  uint64_t tag = address >> (cache->blockBit + cache->setIndexBit);
+void cacheVisitAddress(cache_t *cache, uint64_t address, int write) {
+  uint64_t tag;
+  set_slot_t *setSlot = cacheSetOf(cache, address, &tag);
+  int victimDirty = 0;
+  enum set_visit_result result = setVisitAddress(setSlot, tag, write, &victimDirty);
 
-  switch (setVisitAddress(&cache->sets[setIndex], tag)) {
+  switch (result) {
+    case prefetchHit:
+      ++cache->usefulPrefetchTimes;
+      //fall through
     case hit:
       ++cache->hitTimes;
       break;
-    case miss:
-      ++cache->missTimes;
-      break;
     case eviction:
-      ++cache->missTimes;
       ++cache->evictionTimes;
+      cache->writebackTimes += victimDirty;
+      //fall through
+    case miss:
+      ++cache->missTimes;
       break;
   }
+  //a miss on a line a prefetch pushed out is pollution
+  if ((result == miss || result == eviction) && setSlot->displaced != NULL) {
+    uint64_t way = tagFind(setSlot->displaced, setSlot->e, tag);
+    if (way < setSlot->e) {
+      setSlot->displaced[way] = INVALID_TAG;
+      ++cache->pollutionMissTimes;
+    }
+  }
+}
 
+void cachePrefetch(cache_t *cache, uint64_t address) {
+  uint64_t tag;
+  set_slot_t *setSlot = cacheSetOf(cache, address, &tag);
+  uint32_t way;
+  uint64_t victim;
+  int victimDirty = 0;
+
+  if (setFind(setSlot, tag) < setSlot->used) {
+    return;
+  }
+  ++cache->prefetchTimes;
+  if (setFill(setSlot, tag, &way, &victim, &victimDirty) == eviction) {
+    ++cache->prefetchEvictionTimes;
+    cache->writebackTimes += victimDirty;
+    setSlot->displaced[setSlot->displacedNext++ % setSlot->e] = victim;
+  }
+  setSlot->prefetched[way] = 1;
 }
 
-enum set_visit_result setVisitAddress(set_slot_t *setSlot, uint64_t tag) {
-  line_t *line;
+enum set_visit_result setVisitAddress(set_slot_t *setSlot, uint64_t tag, int write, int *victimDirty) {
+  uint64_t way = setFind(setSlot, tag);
+  uint32_t filled;
+  uint64_t victim;
+  enum set_visit_result result = hit;
 
-  uint64_t latestVisitTime = 0;
-  for (int i = 0; i < setSlot->e; ++i) {
-    line = &setSlot->lines[i];
-    if (line->valid && line->lastVisitTime > latestVisitTime) {
-      latestVisitTime = line->lastVisitTime;
+  if (way < setSlot->used) {
+    policy->hit(setSlot, way);
+    if (setSlot->prefetched != NULL && setSlot->prefetched[way]) {
+      setSlot->prefetched[way] = 0;
+      result = prefetchHit;
     }
+  } else {
+    result = setFill(setSlot, tag, &filled, &victim, victimDirty);
+    way = filled;
+  }
+  setSlot->dirty[way] |= write;
+  return result;
+}
+
+uint64_t setFind(set_slot_t *setSlot, uint64_t tag) {
+  return tagFind(setSlot->tags, setSlot->used, tag);
+}
+
+enum set_visit_result setFill(set_slot_t *setSlot, uint64_t tag, uint32_t *way, uint64_t *victim, int *victimDirty) {
+  enum set_visit_result result = miss;
+
+  if (setSlot->used < setSlot->e) {
+    *way = setSlot->used++;
+    policy->insert(setSlot, *way);
+  } else if (setSlot->holes > 0) {
+    *way = setFind(setSlot, INVALID_TAG);
+    --setSlot->holes;
+    policy->insert(setSlot, *way);
+  } else {
+    *way = policy->evict(setSlot);
+    *victim = setSlot->tags[*way];
+    *victimDirty = setSlot->dirty[*way];
+    result = eviction;
   }
-  latestVisitTime += 1;
+  setSlot->tags[*way] = tag;
+  setSlot->dirty[*way] = 0;
+  if (setSlot->prefetched != NULL) {
+    setSlot->prefetched[*way] = 0;
+  }
+  return result;
+}
 
-  for (int i = 0; i < setSlot->e; ++i) {
-    line = &setSlot->lines[i];
-    if (line->valid && line->tag == tag) {
-      line->lastVisitTime = latestVisitTime;
-      return hit;
+void setInvalidate(set_slot_t *setSlot, uint32_t way) {
+  setSlot->tags[way] = INVALID_TAG;
+  setSlot->dirty[way] = 0;
+  ++setSlot->holes;
+  policy->invalidate(setSlot, way);
+}
+
+void setTouch(set_slot_t *setSlot, uint32_t way) {
+  if (way == setSlot->head) {
+    return;
+  }
+  //unlink, way is not the head so it has a prev
+  uint32_t prev = setSlot->prev[way];
+  if (way == setSlot->tail) {
+    setSlot->tail = prev;
+  } else {
+    setSlot->prev[setSlot->next[way]] = prev;
+  }
+  setSlot->next[prev] = setSlot->next[way];
+  //push front
+  setSlot->prev[setSlot->head] = way;
+  setSlot->next[way] = setSlot->head;
+  setSlot->head = way;
+}
+
+void lruInsert(set_slot_t *setSlot, uint32_t way) {
+  if (setSlot->head == NO_WAY) {
+    setSlot->tail = way;
+  } else {
+    setSlot->prev[setSlot->head] = way;
+  }
+  setSlot->next[way] = setSlot->head;
+  setSlot->head = way;
+}
+
+uint32_t lruEvict(set_slot_t *setSlot) {
+  uint32_t way = setSlot->tail;
+  setTouch(setSlot, way);
+  return way;
+}
+
+void lruInvalidate(set_slot_t *setSlot, uint32_t way) {
+  uint32_t prev = way == setSlot->head ? NO_WAY : setSlot->prev[way];
+  uint32_t next = way == setSlot->tail ? NO_WAY : setSlot->next[way];
+  if (prev == NO_WAY) {
+    setSlot->head = next;
+  } else {
+    setSlot->next[prev] = next;
+  }
+  if (next == NO_WAY) {
+    setSlot->tail = prev;
+  } else {
+    setSlot->prev[next] = prev;
+  }
+}
+
+void noUpdate(set_slot_t *setSlot, uint32_t way) {
+}
+
+uint64_t setRandom(set_slot_t *setSlot) {
+  setSlot->state ^= setSlot->state >> 12;
+  setSlot->state ^= setSlot->state << 25;
+  setSlot->state ^= setSlot->state >> 27;
+  return setSlot->state * 0x2545f4914f6cdd1dULL;
+}
+
+uint32_t randomEvict(set_slot_t *setSlot) {
+  return (setRandom(setSlot) >> 32) % setSlot->e;
+}
+
+//nodes 1..e-1 of a heap ordered tree over the ways, node i has children
+//2i and 2i+1 and the ways are the leaves e..2e-1; each node bit points
+//to the half that was used less recently
+void plruTouch(set_slot_t *setSlot, uint32_t way) {
+  for (uint64_t node = setSlot->e + way; node > 1; node >>= 1) {
+    setSlot->bits[node >> 1] = !(node & 1);
+  }
+}
+
+uint32_t plruEvict(set_slot_t *setSlot) {
+  uint64_t node = 1;
+  while (node < setSlot->e) {
+    node = node << 1 | setSlot->bits[node];
+  }
+  uint32_t way = node - setSlot->e;
+  plruTouch(setSlot, way);
+  return way;
+}
+
+void lfuHit(set_slot_t *setSlot, uint32_t way) {
+  ++setSlot->counts[way];
+}
+
+void lfuInsert(set_slot_t *setSlot, uint32_t way) {
+  setSlot->counts[way] = 1;
+}
+
+//least used way, the lowest of equals
+uint32_t lfuEvict(set_slot_t *setSlot) {
+  uint32_t way = 0;
+  for (uint32_t i = 1; i < setSlot->e; ++i) {
+    if (setSlot->counts[i] < setSlot->counts[way]) {
+      way = i;
     }
   }
+  setSlot->counts[way] = 1;
+  return way;
+}
 
-  for (int i = 0; i < setSlot->e; ++i) {
-    line = &setSlot->lines[i];
-    if (!line->valid) {
-      line->valid = 1;
-      line->tag = tag;
-      line->lastVisitTime = latestVisitTime;
-      return miss;
+void rripHit(set_slot_t *setSlot, uint32_t way) {
+  setSlot->bits[way] = 0;
+}
+
+void srripInsert(set_slot_t *setSlot, uint32_t way) {
+  setSlot->bits[way] = RRPV_LONG;
+}
+
+//first way predicted distant, aging every way until there is one
+uint32_t rripVictim(set_slot_t *setSlot) {
+  uint8_t *rrpv = setSlot->bits;
+  uint8_t oldest = 0;
+  for (uint32_t i = 0; i < setSlot->e; ++i) {
+    if (rrpv[i] == RRPV_DISTANT) {
+      return i;
+    }
+    if (rrpv[i] > oldest) {
+      oldest = rrpv[i];
+    }
+  }
+  //age all ways by what takes the oldest to distant
+  uint8_t age = RRPV_DISTANT - oldest;
+  uint32_t way = setSlot->e;
+  for (uint32_t i = 0; i < setSlot->e; ++i) {
+    rrpv[i] += age;
+    if (rrpv[i] == RRPV_DISTANT && way == setSlot->e) {
+      way = i;
+    }
+  }
+  return way;
+}
+
+uint32_t srripEvict(set_slot_t *setSlot) {
+  uint32_t way = rripVictim(setSlot);
+  srripInsert(setSlot, way);
+  return way;
+}
+
+void brripInsert(set_slot_t *setSlot, uint32_t way) {
+  setSlot->bits[way] = setRandom(setSlot) % BRRIP_LONG == 0 ? RRPV_LONG : RRPV_DISTANT;
+}
+
+uint32_t brripEvict(set_slot_t *setSlot) {
+  uint32_t way = rripVictim(setSlot);
+  brripInsert(setSlot, way);
+  return way;
+}
+
+uint64_t tagFindScalar(const uint64_t *tags, uint64_t n, uint64_t tag) {
+  for (uint64_t i = 0; i < n; ++i) {
+    if (tags[i] == tag) {
+      return i;
     }
   }
+  return n;
+}
 
-  uint64_t oldestVisitTime = latestVisitTime;
-  line_t *evictLine = NULL;
-  for (int i = 0; i < setSlot->e; ++i) {
-    line = &setSlot->lines[i];
-    if (line->valid && line->lastVisitTime < oldestVisitTime) {
-      oldestVisitTime = line->lastVisitTime;
-      evictLine = line;
+#ifdef __x86_64__
+//tags is line aligned, so every load at an even index is aligned
+__attribute__((target("sse4.1")))
+uint64_t tagFindSse(const uint64_t *tags, uint64_t n, uint64_t tag) {
+  __m128i key = _mm_set1_epi64x(tag);
+  uint64_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i eq = _mm_cmpeq_epi64(_mm_load_si128((const __m128i *) (tags + i)), key);
+    int mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+    if (mask) {
+      return i + __builtin_ctz(mask);
     }
   }
-  evictLine->tag = tag;
-  evictLine->lastVisitTime = latestVisitTime;
-  return eviction;
+  return i + tagFindScalar(tags + i, n - i, tag);
 }
 
-void simulateCache(cache_t *cache, char *traceFileName) {
-  FILE *traceFile = fopen(traceFileName, "r");
-  static char line[1024];
-  while (fgets(line, 1024, traceFile)) {
-    if (line[0] == 'I') {
+//one cache line of tags per iteration
+__attribute__((target("avx2")))
+uint64_t tagFindAvx2(const uint64_t *tags, uint64_t n, uint64_t tag) {
+  __m256i key = _mm256_set1_epi64x(tag);
+  uint64_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i lo = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *) (tags + i)), key);
+    __m256i hi = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *) (tags + i + 4)), key);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(lo))
+        | _mm256_movemask_pd(_mm256_castsi256_pd(hi)) << 4;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  if (i + 4 <= n) {
+    __m256i eq = _mm256_cmpeq_epi64(_mm256_load_si256((const __m256i *) (tags + i)), key);
+    int mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+    i += 4;
+  }
+  return i + tagFindScalar(tags + i, n - i, tag);
+}
+#endif
+
+int traceOpen(trace_reader_t *reader, const char *traceFileName) {
+  struct stat st;
+
+  reader->map = NULL;
+  reader->buf = NULL;
+  reader->eof = 0;
+  reader->binary = 0;
+  reader->left = 0;
+  reader->fetches = 0;
+  reader->markers = traceMarkers;
+  reader->markerStart = 0;
+  reader->markerEnd = 0;
+  reader->inside = 0;
+  reader->fd = strcmp(traceFileName, "-") == 0 ? STDIN_FILENO : open(traceFileName, O_RDONLY);
+  if (reader->fd < 0) {
+    return 0;
+  }
+
+  if (fstat(reader->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (map != MAP_FAILED) {
+      posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+      reader->map = map;
+      reader->mapLength = st.st_size;
+      reader->cur = reader->map;
+      reader->end = reader->map + st.st_size;
+      reader->eof = 1;
+    }
+  }
+
+  if (reader->map == NULL) {
+    //one spare byte so a line can always be found whole in the block
+    reader->buf = malloc(TRACE_BLOCK + 1);
+    reader->cur = reader->buf;
+    reader->end = reader->buf;
+  }
+
+  if (traceNeed(reader, TRACE_MAGIC_LEN) && memcmp(reader->cur, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+    reader->binary = 1;
+    reader->cur += TRACE_MAGIC_LEN;
+    //binary traces carry no markers line to cut at
+    if (reader->markers) {
+      fprintf(stderr, "%s: -m needs a text trace\n", traceFileName);
+      exit(1);
+    }
+  }
+  return 1;
+}
+
+int traceNeed(trace_reader_t *reader, size_t n) {
+  while ((size_t) (reader->end - reader->cur) < n) {
+    if (!traceFill(reader)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+int traceFill(trace_reader_t *reader) {
+  size_t left = reader->end - reader->cur;
+  ssize_t got;
+
+  if (reader->eof || left == TRACE_BLOCK) {
+    return 0;
+  }
+  memmove(reader->buf, reader->cur, left);
+  reader->cur = reader->buf;
+  reader->end = reader->buf + left;
+  do {
+    got = read(reader->fd, reader->buf + left, TRACE_BLOCK - left);
+  } while (got < 0 && errno == EINTR);
+  if (got <= 0) {
+    reader->eof = 1;
+    return 0;
+  }
+  reader->end += got;
+  return 1;
+}
+
+//value of a hex digit plus one, 0 for anything else
+static const uint8_t hexValue[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+int traceNext(trace_reader_t *reader, access_t *access) {
+  if (reader->binary) {
+    return traceNextBinary(reader, access);
+  }
+  for (;;) {
+    const char *line = reader->cur;
+    const char *end = memchr(line, '\n', reader->end - line);
+    if (end == NULL) {
+      if (traceFill(reader)) {
+        continue;
+      }
+      if (reader->cur == reader->end) {
+        return 0;
+      }
+      //last line without a newline
+      line = reader->cur;
+      end = reader->end;
+      reader->cur = end;
+    } else {
+      reader->cur = end + 1;
+    }
+
+    if (reader->markers && end - line > 8 && memcmp(line, "markers ", 8) == 0) {
+      unsigned long long start, stop;
+      if (sscanf(line + 8, "%llx %llx", &start, &stop) == 2) {
+        reader->markerStart = start;
+        reader->markerEnd = stop;
+      }
       continue;
     }
-    uint64_t address = strtoull(line + 2, NULL, 16);
-    switch (line[1]) {
-      case 'L':
-        cacheVisitAddress(cache, address);
-        break;
-      case 'S':
-        cacheVisitAddress(cache, address);
+    //" L 04f6b868,8" or "I  04f6b868,8": skip anything else, and
+    //instruction fetches unless asked for
+    if (end - line < 3) {
+      continue;
+    }
+    char op = line[0] == 'I' ? 'I' : line[1];
+    if ((op == 'I' ? !reader->fetches : line[0] != ' ')
+        || (op != 'L' && op != 'S' && op != 'M' && op != 'I')) {
+      continue;
+    }
+    const char *p = line + 2;
+    while (p < end && *p == ' ') {
+      ++p;
+    }
+    uint64_t address = 0;
+    while (p < end && hexValue[(uint8_t) *p]) {
+      address = address << 4 | (hexValue[(uint8_t) *p] - 1);
+      ++p;
+    }
+    uint32_t size = 0;
+    if (p < end && *p == ',') {
+      for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+        size = size * 10 + (*p - '0');
+      }
+    }
+    //the markers are data accesses; like test-trans, drop the stack
+    //and the rest of the upper address space
+    if (reader->markers) {
+      int inside = reader->inside || (op != 'I' && address == reader->markerStart);
+      reader->inside = inside && !(op != 'I' && address == reader->markerEnd);
+      if (!inside || address >= 0xffffffff) {
+        continue;
+      }
+    }
+    access->op = op;
+    access->address = address;
+    access->size = size;
+    return 1;
+  }
+}
+
+int traceNextBinary(trace_reader_t *reader, access_t *access) {
+  for (;;) {
+    //start the next block once it is all in the buffer
+    while (reader->left == 0) {
+      //the trace may only end between blocks; a cut block is corrupt
+      if (!traceNeed(reader, TRACE_BLOCK_HEADER)) {
+        if (reader->cur == reader->end) {
+          return 0;
+        }
+        fprintf(stderr, "corrupt binary trace\n");
+        exit(1);
+      }
+      const unsigned char *header = (const unsigned char *) reader->cur;
+      uint32_t count = traceGetWord(header);
+      uint32_t length = traceGetWord(header + 4);
+      if (length > TRACE_BLOCK_BYTES || !traceNeed(reader, TRACE_BLOCK_HEADER + length)) {
+        fprintf(stderr, "corrupt binary trace\n");
+        exit(1);
+      }
+      reader->cur += TRACE_BLOCK_HEADER;
+      reader->blockEnd = reader->cur + length;
+      reader->left = count;
+      reader->prev = 0;
+    }
+
+    char op;
+    unsigned int size;
+    const unsigned char *next = traceDecode((const unsigned char *) reader->cur,
+                                            (const unsigned char *) reader->blockEnd,
+                                            &op, &reader->prev, &size);
+    if (next == NULL) {
+      fprintf(stderr, "corrupt binary trace\n");
+      exit(1);
+    }
+    reader->cur = (const char *) next;
+    --reader->left;
+    if (op == 'I' && !reader->fetches) {
+      continue;
+    }
+    access->op = op;
+    access->address = reader->prev;
+    access->size = size;
+    return 1;
+  }
+}
+
+void traceClose(trace_reader_t *reader) {
+  if (reader->map != NULL) {
+    munmap(reader->map, reader->mapLength);
+  }
+  free(reader->buf);
+  if (reader->fd != STDIN_FILENO) {
+    close(reader->fd);
+  }
+}
+
+void accessBlocks(const access_t *access, uint8_t blockBit, uint64_t *first, uint64_t *last) {
+  *first = access->address >> blockBit;
+  *last = *first;
+  if (accessSizes && access->size > 1) {
+    *last = (access->address + access->size - 1) >> blockBit;
+  }
+}
+
+int prefetchInit(char *spec) {
+  static const char *names[PREFETCHERS] = {"next", "stride", "stream"};
+  char *copy = malloc(strlen(spec) + 1);
+  strcpy(copy, spec);
+
+  for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+    size_t length = strcspn(item, ":");
+    int kind = 0;
+    while (kind < PREFETCHERS && (strncmp(item, names[kind], length) != 0 || names[kind][length] != '\0')) {
+      ++kind;
+    }
+    char *end = item + length;
+    uint64_t degree = *end == ':' ? strtoul(end + 1, &end, 10) : 1;
+    uint64_t distance = *end == ':' ? strtoul(end + 1, &end, 10) : 1;
+    if (kind == PREFETCHERS || *end != '\0' || prefetcherCount == PREFETCHERS
+        || degree == 0 || degree > PREFETCH_DEGREE || distance == 0) {
+      fprintf(stderr, "%s: expected up to %d of next, stride or stream[:degree[:distance]], degree 1 to %d\n",
+              item, PREFETCHERS, PREFETCH_DEGREE);
+      free(copy);
+      return 0;
+    }
+    prefetcher_t *prefetcher = &prefetchers[prefetcherCount++];
+    prefetcher->kind = kind;
+    prefetcher->degree = degree;
+    prefetcher->distance = distance;
+    prefetcher->table = calloc(STRIDE_ENTRIES, sizeof(stride_entry_t));
+    prefetcher->streams = calloc(STREAMS, sizeof(stream_t));
+    prefetcher->now = 0;
+  }
+  free(copy);
+  return 1;
+}
+
+void prefetchDelete(void) {
+  for (int i = 0; i < prefetcherCount; ++i) {
+    free(prefetchers[i].table);
+    free(prefetchers[i].streams);
+  }
+  prefetcherCount = 0;
+}
+
+uint32_t prefetchBlocks(const access_t *access, uint64_t pc, uint8_t blockBit, uint64_t *blocks) {
+  uint64_t block = access->address >> blockBit;
+  uint32_t n = 0;
+
+  for (int i = 0; i < prefetcherCount; ++i) {
+    prefetcher_t *prefetcher = &prefetchers[i];
+    switch (prefetcher->kind) {
+      case nextLine:
+        for (uint32_t k = 0; k < prefetcher->degree; ++k) {
+          blocks[n++] = block + prefetcher->distance + k;
+        }
         break;
-      case 'M':
-        cacheVisitAddress(cache, address);
-        cacheVisitAddress(cache, address);
+      case strided: {
+        stride_entry_t *entry = &prefetcher->table[(pc ^ pc >> 8 ^ pc >> 16) % STRIDE_ENTRIES];
+        if (entry->pc != pc) {
+          entry->pc = pc;
+          entry->last = access->address;
+          entry->stride = 0;
+          entry->confidence = 0;
+          break;
+        }
+        //a new stride replaces the old one only once confidence is spent
+        uint64_t stride = access->address - entry->last;
+        if (stride == entry->stride) {
+          entry->confidence += entry->confidence < STRIDE_CONFIDENT + 1;
+        } else if (entry->confidence > 0) {
+          --entry->confidence;
+        } else {
+          entry->stride = stride;
+        }
+        entry->last = access->address;
+        if (entry->confidence < STRIDE_CONFIDENT || entry->stride == 0) {
+          break;
+        }
+        for (uint32_t k = 0; k < prefetcher->degree; ++k) {
+          uint64_t target = (access->address + entry->stride * (prefetcher->distance + k)) >> blockBit;
+          if (target != block) {
+            blocks[n++] = target;
+          }
+        }
         break;
-      default:
+      }
+      case stream: {
+        //block continues a stream whose last block is within the window
+        //of it, else the least recently used stream starts over there
+        stream_t *found = NULL;
+        stream_t *oldest = &prefetcher->streams[0];
+        for (int k = 0; k < STREAMS; ++k) {
+          stream_t *candidate = &prefetcher->streams[k];
+          if (candidate->stamp != 0 && block - candidate->last + STREAM_WINDOW <= 2 * STREAM_WINDOW) {
+            found = candidate;
+            break;
+          }
+          if (candidate->stamp < oldest->stamp) {
+            oldest = candidate;
+          }
+        }
+        if (found == NULL) {
+          found = oldest;
+          found->last = block;
+          found->direction = 0;
+        } else if (block != found->last) {
+          int direction = block > found->last ? 1 : -1;
+          if (direction == found->direction) {
+            for (uint32_t k = 0; k < prefetcher->degree; ++k) {
+              blocks[n++] = block + direction * (int64_t) (prefetcher->distance + k);
+            }
+          }
+          found->direction = direction;
+          found->last = block;
+        }
+        found->stamp = ++prefetcher->now;
         break;
+      }
     }
+  }
+  return n;
+}
 
+void simulateCache(cache_t *cache, char *traceFileName) {
+  trace_reader_t reader;
+  access_t access;
 
+  if (!traceOpen(&reader, traceFileName)) {
+    fprintf(stderr, "%s: %s\n", traceFileName, strerror(errno));
+    exit(1);
   }
-  fclose(traceFile);
+  //instruction addresses are only needed by the prefetchers
+  reader.fetches = prefetcherCount > 0;
+  uint64_t pc = 0;
+  uint64_t blocks[PREFETCHERS * PREFETCH_DEGREE];
+  while (traceNext(&reader, &access)) {
+    if (access.op == 'I') {
+      pc = access.address;
+      continue;
+    }
+    uint64_t first, last;
+    accessBlocks(&access, cache->blockBit, &first, &last);
+    //an M reads its blocks, then writes them
+    for (int write = access.op == 'S'; write <= (access.op != 'L'); ++write) {
+      for (uint64_t block = first; block <= last; ++block) {
+        cacheVisitAddress(cache, block << cache->blockBit, write);
+      }
+    }
+    uint32_t n = prefetcherCount > 0 ? prefetchBlocks(&access, pc, cache->blockBit, blocks) : 0;
+    for (uint32_t i = 0; i < n; ++i) {
+      cachePrefetch(cache, blocks[i] << cache->blockBit);
+    }
+  }
+  traceClose(&reader);
 }
 
-void cacheDelete(cache_t *cache) {
-  for (int i = 0; i < (1 << cache->setIndexBit); ++i) {
-    setSlotDelete(&cache->sets[i]);
+void *workerRun(void *arg) {
+  worker_t *worker = arg;
+  for (int buf = 0;; buf ^= 1) {
+    pthread_barrier_wait(worker->barrier);
+    for (uint32_t i = 0; i < worker->count[buf]; ++i) {
+      queue_entry_t *entry = &worker->queue[buf][i];
+      if (entry->prefetch) {
+        cachePrefetch(&worker->cache, entry->block << worker->cache.blockBit);
+      } else {
+        cacheVisitAddress(&worker->cache, entry->block << worker->cache.blockBit, entry->write);
+      }
+    }
+    if (worker->last[buf]) {
+      return NULL;
+    }
+  }
+}
+
+void workerPush(worker_t *worker, int buf, uint64_t block, int write, int prefetch) {
+  //the queue being filled is not in use by the worker
+  if (worker->count[buf] == worker->capacity[buf]) {
+    worker->capacity[buf] *= 2;
+    worker->queue[buf] = realloc(worker->queue[buf], sizeof(queue_entry_t) * worker->capacity[buf]);
+  }
+  queue_entry_t *entry = &worker->queue[buf][worker->count[buf]++];
+  entry->block = block;
+  entry->write = write;
+  entry->prefetch = prefetch;
+}
+
+int workerOf(cache_t *cache, uint64_t block, int threads) {
+  return (unsigned __int128) (block & cache->setMask) * threads >> cache->setIndexBit;
+}
+
+void simulateCacheParallel(cache_t *cache, char *traceFileName, int threads) {
+  trace_reader_t reader;
+  access_t access;
+  pthread_barrier_t barrier;
+  int last[2] = {0, 0};
+  worker_t *workers = malloc(sizeof(worker_t) * threads);
+
+  if (!traceOpen(&reader, traceFileName)) {
+    fprintf(stderr, "%s: %s\n", traceFileName, strerror(errno));
+    exit(1);
+  }
+  reader.fetches = prefetcherCount > 0;
+  pthread_barrier_init(&barrier, NULL, threads + 1);
+  for (int i = 0; i < threads; ++i) {
+    workers[i].cache = *cache;
+    sparseInit(&workers[i].cache.sets, cache->setIndexBit, sizeof(set_slot_t));
+    workers[i].queue[0] = malloc(sizeof(queue_entry_t) * BATCH);
+    workers[i].queue[1] = malloc(sizeof(queue_entry_t) * BATCH);
+    workers[i].count[0] = 0;
+    workers[i].count[1] = 0;
+    workers[i].capacity[0] = BATCH;
+    workers[i].capacity[1] = BATCH;
+    workers[i].barrier = &barrier;
+    workers[i].last = last;
+    pthread_create(&workers[i].thread, NULL, workerRun, &workers[i]);
+  }
+
+  uint64_t pc = 0;
+  uint64_t blocks[PREFETCHERS * PREFETCH_DEGREE];
+  for (int buf = 0; !last[buf ^ 1]; buf ^= 1) {
+    for (int i = 0; i < threads; ++i) {
+      workers[i].count[buf] = 0;
+    }
+    uint32_t n = 0;
+    int more = 1;
+    while (n < BATCH && (more = traceNext(&reader, &access))) {
+      if (access.op == 'I') {
+        pc = access.address;
+        continue;
+      }
+      uint64_t first, last;
+      accessBlocks(&access, cache->blockBit, &first, &last);
+      for (int write = access.op == 'S'; write <= (access.op != 'L'); ++write) {
+        for (uint64_t block = first; block <= last; ++block) {
+          workerPush(&workers[workerOf(cache, block, threads)], buf, block, write, 0);
+          ++n;
+        }
+      }
+      uint32_t count = prefetcherCount > 0 ? prefetchBlocks(&access, pc, cache->blockBit, blocks) : 0;
+      for (uint32_t i = 0; i < count; ++i) {
+        workerPush(&workers[workerOf(cache, blocks[i], threads)], buf, blocks[i], 0, 1);
+        ++n;
+      }
+    }
+    last[buf] = !more;
+    pthread_barrier_wait(&barrier);
+  }
+
+  for (int i = 0; i < threads; ++i) {
+    pthread_join(workers[i].thread, NULL);
+    cache->hitTimes += workers[i].cache.hitTimes;
+    cache->missTimes += workers[i].cache.missTimes;
+    cache->evictionTimes += workers[i].cache.evictionTimes;
+    cache->writebackTimes += workers[i].cache.writebackTimes;
+    cache->prefetchTimes += workers[i].cache.prefetchTimes;
+    cache->usefulPrefetchTimes += workers[i].cache.usefulPrefetchTimes;
+    cache->prefetchEvictionTimes += workers[i].cache.prefetchEvictionTimes;
+    cache->pollutionMissTimes += workers[i].cache.pollutionMissTimes;
+    cacheSetsDelete(&workers[i].cache);
+    free(workers[i].queue[0]);
+    free(workers[i].queue[1]);
   }
-  free(cache->sets);
+  pthread_barrier_destroy(&barrier);
+  free(workers);
+  traceClose(&reader);
+}
+
+void cacheDelete(cache_t *cache) {
+  cacheSetsDelete(cache);
   free(cache);
 }
 
+void cacheSetsDelete(cache_t *cache) {
+  for (uint64_t i = 0; i < cache->sets.capacity; ++i) {
+    if (cache->sets.slots[i] != NULL) {
+      setSlotDelete(cache->sets.slots[i]);
+    }
+  }
+  sparseDelete(&cache->sets);
+}
+
 void setSlotDelete(set_slot_t *setSlot) {
-  free(setSlot->lines);
+  free(setSlot->tags);
+  free(setSlot->dirty);
+  free(setSlot->prefetched);
+  free(setSlot->displaced);
+  free(setSlot->prev);
+  free(setSlot->next);
+  free(setSlot->bits);
+  free(setSlot->counts);
+}
+
+int hierarchyInit(hierarchy_t *hierarchy, char *spec, uint64_t seed) {
+  static const char *names[LEVELS] = {"l1i", "l1d", "l2", "llc"};
+  static const char *labels[LEVELS] = {"L1I", "L1D", "L2", "LLC"};
+  char *copy = malloc(strlen(spec) + 1);
+  strcpy(copy, spec);
+
+  memset(hierarchy, 0, sizeof(hierarchy_t));
+  for (char *item = strtok(copy, ","); item != NULL; item = strtok(NULL, ",")) {
+    char *value = strchr(item, '=');
+    int id = 0;
+    while (id < LEVELS && (value == NULL || strncmp(item, names[id], value - item) != 0
+                           || names[id][value - item] != '\0')) {
+      ++id;
+    }
+    if (id == LEVELS || hierarchy->present[id]) {
+      fprintf(stderr, "%s: expected one each of l1i=, l1d=, l2= and llc=\n", item);
+      free(copy);
+      return 0;
+    }
+
+    level_t *level = &hierarchy->levels[id];
+    char *end;
+    uint64_t s = strtoul(value + 1, &end, 10);
+    uint64_t e = *end == ':' ? strtoul(end + 1, &end, 10) : 0;
+    uint64_t b = *end == ':' ? strtoul(end + 1, &end, 10) : 0;
+    level->writeBack = 1;
+    level->inclusion = nine;
+    while (*end == ':') {
+      char *option = end + 1;
+      end = option + strcspn(option, ":");
+      size_t length = end - option;
+      if (length == 2 && strncmp(option, "wb", 2) == 0) {
+        level->writeBack = 1;
+      } else if (length == 2 && strncmp(option, "wt", 2) == 0) {
+        level->writeBack = 0;
+      } else if (length == 4 && strncmp(option, "nine", 4) == 0) {
+        level->inclusion = nine;
+      } else if (length == 9 && strncmp(option, "inclusive", 9) == 0) {
+        level->inclusion = inclusive;
+      } else if (length == 9 && strncmp(option, "exclusive", 9) == 0) {
+        level->inclusion = exclusive;
+      } else {
+        break;
+      }
+    }
+    if (*end != '\0' || e == 0 || s + b > 63 || (policy->evict == plruEvict && (e & (e - 1)) != 0)) {
+      fprintf(stderr, "%s: expected %s=s:E:b[:wb|:wt][:nine|:inclusive|:exclusive]\n", item, names[id]);
+      free(copy);
+      return 0;
+    }
+    level->name = labels[id];
+    level->hierarchy = hierarchy;
+    cacheInit(&level->cache, b, s, e, seed + ((uint64_t) id << 32));
+    hierarchy->present[id] = 1;
+  }
+  free(copy);
+  if (!hierarchy->present[L1D]) {
+    fprintf(stderr, "a hierarchy needs l1d=\n");
+    return 0;
+  }
+
+  //link each level to the next one present below it
+  for (int id = L1I; id < LEVELS; ++id) {
+    if (!hierarchy->present[id]) {
+      continue;
+    }
+    level_t *level = &hierarchy->levels[id];
+    for (int below = id < L2 ? L2 : id + 1; below < LEVELS; ++below) {
+      if (hierarchy->present[below]) {
+        level->below = &hierarchy->levels[below];
+        level->below->above[level->below->aboveCount++] = level;
+        break;
+      }
+    }
+    //lines move whole between a level and an exclusive one below it
+    if (level->below != NULL && (level->below->cache.blockBit < level->cache.blockBit
+                                 || (level->below->inclusion == exclusive
+                                     && level->below->cache.blockBit != level->cache.blockBit))) {
+      fprintf(stderr, "%s: blocks can't be smaller than those above, or differ if exclusive\n",
+              level->below->name);
+      return 0;
+    }
+  }
+  return 1;
+}
+
+void hierarchyDelete(hierarchy_t *hierarchy) {
+  for (int id = L1I; id < LEVELS; ++id) {
+    level_t *level = &hierarchy->levels[id];
+    if (hierarchy->present[id]) {
+      cacheSetsDelete(&level->cache);
+    }
+  }
+  free(hierarchy);
+}
+
+set_slot_t *levelSet(level_t *level, uint64_t address, uint64_t *tag) {
+  return cacheSetOf(&level->cache, address, tag);
+}
+
+uint64_t levelAddress(level_t *level, set_slot_t *setSlot, uint64_t tag) {
+  cache_t *cache = &level->cache;
+  return (tag << cache->setIndexBit | setSlot->index) << cache->blockBit;
+}
+
+int levelAccess(level_t *level, uint64_t address, int write, int fromAbove) {
+  uint64_t tag;
+  set_slot_t *setSlot = levelSet(level, address, &tag);
+  uint64_t way = setFind(setSlot, tag);
+  int dirty = 0;
+
+  if (way < setSlot->used) {
+    ++level->hits;
+    if (fromAbove && level->inclusion == exclusive) {
+      dirty = setSlot->dirty[way];
+      setInvalidate(setSlot, way);
+      return dirty;
+    }
+    policy->hit(setSlot, way);
+  } else {
+    ++level->misses;
+    if (level->below != NULL) {
+      dirty = levelAccess(level->below, address, 0, 1);
+    } else {
+      level->hierarchy->memoryReads += (uint64_t) 1 << level->cache.blockBit;
+    }
+    //an exclusive level only keeps what is evicted above
+    if (fromAbove && level->inclusion == exclusive) {
+      return dirty;
+    }
+    //a line handed up dirty stays dirty here, or is written through
+    if (dirty && !level->writeBack) {
+      levelWriteDown(level, address, 1, 0);
+    }
+    way = levelFill(level, setSlot, tag, dirty && level->writeBack);
+  }
+
+  if (write) {
+    if (level->writeBack) {
+      setSlot->dirty[way] = 1;
+    } else {
+      levelWriteDown(level, address, 1, 0);
+    }
+  }
+  return 0;
+}
+
+uint32_t levelFill(level_t *level, set_slot_t *setSlot, uint64_t tag, int dirty) {
+  uint32_t way;
+  uint64_t victimTag;
+  int victimDirty;
+
+  if (setFill(setSlot, tag, &way, &victimTag, &victimDirty) == eviction) {
+    setSlot->dirty[way] = dirty;
+    ++level->evictions;
+    uint64_t victim = levelAddress(level, setSlot, victimTag);
+    if (level->inclusion == inclusive && levelBackInvalidate(level, victim)) {
+      victimDirty = 1;
+    }
+    if (victimDirty) {
+      ++level->writebacks;
+    }
+    levelWriteDown(level, victim, victimDirty, 1);
+  } else {
+    setSlot->dirty[way] = dirty;
+  }
+  return way;
+}
+
+void levelWriteDown(level_t *level, uint64_t address, int dirty, int victim) {
+  level_t *below = level->below;
+
+  if (below == NULL) {
+    if (dirty) {
+      level->hierarchy->memoryWrites += (uint64_t) 1 << level->cache.blockBit;
+    }
+    return;
+  }
+  //clean victims only matter to an exclusive level, which takes them in
+  if (!dirty && !(victim && below->inclusion == exclusive)) {
+    return;
+  }
+
+  uint64_t tag;
+  set_slot_t *setSlot = levelSet(below, address, &tag);
+  uint64_t way = setFind(setSlot, tag);
+  if (dirty && !below->writeBack) {
+    levelWriteDown(below, address, 1, 0);
+  }
+  if (way < setSlot->used) {
+    setSlot->dirty[way] |= dirty && below->writeBack;
+    return;
+  }
+  //written through from above, where the line stays, or still held by
+  //the other level above: an exclusive level must not hold it as well
+  if (below->inclusion == exclusive && (!victim || levelHeldAbove(below, address))) {
+    if (dirty && below->writeBack) {
+      levelWriteDown(below, address, 1, 0);
+    }
+    return;
+  }
+  //the line moves up out of an exclusive level further below
+  level_t *lower = below->below;
+  if (lower != NULL && lower->inclusion == exclusive) {
+    uint64_t lowerTag;
+    set_slot_t *lowerSet = levelSet(lower, address, &lowerTag);
+    uint64_t lowerWay = setFind(lowerSet, lowerTag);
+    if (lowerWay < lowerSet->used) {
+      if (lowerSet->dirty[lowerWay] && !below->writeBack) {
+        levelWriteDown(below, address, 1, 0);
+      }
+      dirty |= lowerSet->dirty[lowerWay];
+      setInvalidate(lowerSet, lowerWay);
+    }
+  }
+  levelFill(below, setSlot, tag, dirty && below->writeBack);
+}
+
+int levelHeldAbove(level_t *level, uint64_t address) {
+  for (int i = 0; i < level->aboveCount; ++i) {
+    uint64_t tag;
+    set_slot_t *setSlot = levelSet(level->above[i], address, &tag);
+    if (setFind(setSlot, tag) < setSlot->used) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int levelBackInvalidate(level_t *level, uint64_t address) {
+  uint64_t size = (uint64_t) 1 << level->cache.blockBit;
+  int dirty = 0;
+
+  for (int i = 0; i < level->aboveCount; ++i) {
+    level_t *above = level->above[i];
+    for (uint64_t block = address; block < address + size; block += (uint64_t) 1 << above->cache.blockBit) {
+      dirty |= levelBackInvalidate(above, block);
+      uint64_t tag;
+      set_slot_t *setSlot = levelSet(above, block, &tag);
+      uint64_t way = setFind(setSlot, tag);
+      if (way < setSlot->used) {
+        dirty |= setSlot->dirty[way];
+        setInvalidate(setSlot, way);
+      }
+    }
+  }
+  return dirty;
+}
+
+void simulateHierarchy(hierarchy_t *hierarchy, char *traceFileName) {
+  trace_reader_t reader;
+  access_t access;
+  level_t *l1i = hierarchy->present[L1I] ? &hierarchy->levels[L1I] : NULL;
+  level_t *l1d = &hierarchy->levels[L1D];
+
+  if (!traceOpen(&reader, traceFileName)) {
+    fprintf(stderr, "%s: %s\n", traceFileName, strerror(errno));
+    exit(1);
+  }
+  reader.fetches = l1i != NULL;
+  while (traceNext(&reader, &access)) {
+    level_t *l1 = access.op == 'I' ? l1i : l1d;
+    uint64_t first, last;
+    accessBlocks(&access, l1->cache.blockBit, &first, &last);
+    for (int write = access.op == 'S'; write <= (access.op == 'S' || access.op == 'M'); ++write) {
+      for (uint64_t block = first; block <= last; ++block) {
+        levelAccess(l1, block << l1->cache.blockBit, write, 0);
+      }
+    }
+  }
+  traceClose(&reader);
+
+  for (int id = L1I; id < LEVELS; ++id) {
+    level_t *level = &hierarchy->levels[id];
+    if (hierarchy->present[id]) {
+      printf("%s hits:%llu misses:%llu evictions:%llu writebacks:%llu\n", level->name,
+             (unsigned long long) level->hits, (unsigned long long) level->misses,
+             (unsigned long long) level->evictions, (unsigned long long) level->writebacks);
+    }
+  }
+  printf("dram bytes read:%llu written:%llu\n", (unsigned long long) hierarchy->memoryReads,
+         (unsigned long long) hierarchy->memoryWrites);
+}
+
+void stackInit(stack_sim_t *stack, uint8_t blockBit, uint8_t setIndexBit, uint64_t limit) {
+  stack->setIndexBit = setIndexBit;
+  stack->blockBit = blockBit;
+  stack->setMask = lowMask(setIndexBit);
+  stack->limit = limit;
+  stack->accesses = 0;
+  stack->hitsAt = calloc(limit, sizeof(uint64_t));
+  //sets are made, and get their stamps, on first use
+  sparseInit(&stack->sets, setIndexBit, sizeof(stack_set_t));
+  stack->hashCapacity = 1024;
+  stack->hashCount = 0;
+  stack->keys = malloc(sizeof(uint64_t) * stack->hashCapacity);
+  stack->stamps = calloc(stack->hashCapacity, sizeof(uint32_t));
+}
+
+void stackDelete(stack_sim_t *stack) {
+  for (uint64_t i = 0; i < stack->sets.capacity; ++i) {
+    stack_set_t *set = stack->sets.slots[i];
+    if (set != NULL) {
+      free(set->tree);
+      free(set->blockAt);
+    }
+  }
+  sparseDelete(&stack->sets);
+  free(stack->hitsAt);
+  free(stack->keys);
+  free(stack->stamps);
+  free(stack);
+}
+
+uint64_t stackSlot(stack_sim_t *stack, uint64_t block) {
+  uint64_t mask = stack->hashCapacity - 1;
+  uint64_t slot = (block * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+  while (stack->stamps[slot] != 0 && stack->keys[slot] != block) {
+    slot = (slot + 1) & mask;
+  }
+  return slot;
+}
+
+void stackUnhash(stack_sim_t *stack, uint64_t slot) {
+  uint64_t mask = stack->hashCapacity - 1;
+  uint64_t next = slot;
+  for (;;) {
+    next = (next + 1) & mask;
+    if (stack->stamps[next] == 0) {
+      break;
+    }
+    //an entry may fill the hole if its home is not in (slot, next]
+    uint64_t home = (stack->keys[next] * 0x9e3779b97f4a7c15ULL) >> 32 & mask;
+    if (((next - home) & mask) >= ((next - slot) & mask)) {
+      stack->keys[slot] = stack->keys[next];
+      stack->stamps[slot] = stack->stamps[next];
+      slot = next;
+    }
+  }
+  stack->stamps[slot] = 0;
+  --stack->hashCount;
+}
+
+void stackRehash(stack_sim_t *stack) {
+  uint64_t *keys = stack->keys;
+  uint32_t *stamps = stack->stamps;
+  uint64_t capacity = stack->hashCapacity;
+
+  stack->hashCapacity *= 2;
+  stack->keys = malloc(sizeof(uint64_t) * stack->hashCapacity);
+  stack->stamps = calloc(stack->hashCapacity, sizeof(uint32_t));
+  for (uint64_t i = 0; i < capacity; ++i) {
+    if (stamps[i] != 0) {
+      uint64_t slot = stackSlot(stack, keys[i]);
+      stack->keys[slot] = keys[i];
+      stack->stamps[slot] = stamps[i];
+    }
+  }
+  free(keys);
+  free(stamps);
+}
+
+void fenwickAdd(uint32_t *tree, uint32_t capacity, uint32_t i, int32_t delta) {
+  for (; i <= capacity; i += i & -i) {
+    tree[i] += delta;
+  }
+}
+
+uint32_t fenwickSum(const uint32_t *tree, uint32_t i) {
+  uint32_t sum = 0;
+  for (; i > 0; i -= i & -i) {
+    sum += tree[i];
+  }
+  return sum;
+}
+
+uint32_t fenwickFirst(const uint32_t *tree, uint32_t capacity) {
+  //capacity is a power of two
+  uint32_t i = 0;
+  for (uint32_t step = capacity; step > 0; step >>= 1) {
+    if (i + step <= capacity && tree[i + step] == 0) {
+      i += step;
+    }
+  }
+  return i + 1;
+}
+
+void stackCompact(stack_sim_t *stack, stack_set_t *set) {
+  uint32_t capacity = set->capacity;
+  uint64_t *blockAt = set->blockAt;
+
+  if (capacity == 0) {
+    capacity = 16;
+  } else if (set->live * 2 > capacity) {
+    capacity *= 2;
+  }
+  set->blockAt = malloc(sizeof(uint64_t) * (capacity + 1));
+  uint32_t live = 0;
+  for (uint32_t i = 1; i <= set->now; ++i) {
+    uint64_t slot = stackSlot(stack, blockAt[i]);
+    if (stack->stamps[slot] == i) {
+      stack->stamps[slot] = ++live;
+      set->blockAt[live] = blockAt[i];
+    }
+  }
+  free(blockAt);
+
+  //every stamp up to live is in use; build the tree in linear time
+  free(set->tree);
+  set->tree = calloc(capacity + 1, sizeof(uint32_t));
+  for (uint32_t i = 1; i <= capacity; ++i) {
+    set->tree[i] += i <= live;
+    uint32_t parent = i + (i & -i);
+    if (parent <= capacity) {
+      set->tree[parent] += set->tree[i];
+    }
+  }
+  set->capacity = capacity;
+  set->now = live;
+}
+
+void stackVisitAddress(stack_sim_t *stack, uint64_t address) {
+  uint64_t block = address >> stack->blockBit;
+  int created;
+  stack_set_t *set = sparseGet(&stack->sets, block & stack->setMask, &created);
+  uint64_t slot = stackSlot(stack, block);
+  uint32_t stamp = stack->stamps[slot];
+
+  ++stack->accesses;
+  if (stamp != 0) {
+    //blocks used since, all live since there are fewer than limit
+    ++stack->hitsAt[fenwickSum(set->tree, set->now) - fenwickSum(set->tree, stamp)];
+    fenwickAdd(set->tree, set->capacity, stamp, -1);
+    --set->live;
+  } else {
+    ++set->distinct;
+    stack->keys[slot] = block;
+    ++stack->hashCount;
+  }
+  //no stamp yet, but keep the slot taken so probes go on past it
+  stack->stamps[slot] = UINT32_MAX;
+
+  if (set->now == set->capacity) {
+    stackCompact(stack, set);
+  }
+  ++set->now;
+  fenwickAdd(set->tree, set->capacity, set->now, 1);
+  set->blockAt[set->now] = block;
+  stack->stamps[slot] = set->now;
+  ++set->live;
+
+  //past the limit, the least recently used block can never hit again
+  if (set->live > stack->limit) {
+    uint32_t oldest = fenwickFirst(set->tree, set->capacity);
+    fenwickAdd(set->tree, set->capacity, oldest, -1);
+    stackUnhash(stack, stackSlot(stack, set->blockAt[oldest]));
+    --set->live;
+  }
+
+  if (stack->hashCount * 2 > stack->hashCapacity) {
+    stackRehash(stack);
+  }
+}
+
+void simulateStack(stack_sim_t *stack, char *traceFileName) {
+  trace_reader_t reader;
+  access_t access;
+
+  if (!traceOpen(&reader, traceFileName)) {
+    fprintf(stderr, "%s: %s\n", traceFileName, strerror(errno));
+    exit(1);
+  }
+  while (traceNext(&reader, &access)) {
+    uint64_t first, last;
+    accessBlocks(&access, stack->blockBit, &first, &last);
+    for (int write = access.op == 'S'; write <= (access.op != 'L'); ++write) {
+      for (uint64_t block = first; block <= last; ++block) {
+        stackVisitAddress(stack, block << stack->blockBit);
+      }
+    }
+  }
+  traceClose(&reader);
+
+  //a set fills one way per distinct block until it has E of them, and
+  //every later miss evicts; sets never touched fill nothing
+  uint64_t *setsWith = calloc(stack->limit + 1, sizeof(uint64_t));
+  for (uint64_t i = 0; i < stack->sets.capacity; ++i) {
+    stack_set_t *set = stack->sets.slots[i];
+    if (set != NULL) {
+      ++setsWith[set->distinct < stack->limit ? set->distinct : stack->limit];
+    }
+  }
+  uint64_t hits = 0;
+  uint64_t fills = 0;
+  uint64_t setsFull = stack->sets.count;
+  printf("E\thits\tmisses\tevictions\n");
+  for (uint64_t e = 1; e <= stack->limit; ++e) {
+    hits += stack->hitsAt[e - 1];
+    setsFull -= setsWith[e - 1];
+    fills += setsFull;
+    uint64_t misses = stack->accesses - hits;
+    printf("%llu\t%llu\t%llu\t%llu\n", (unsigned long long) e, (unsigned long long) hits,
+           (unsigned long long) misses, (unsigned long long) (misses - fills));
+  }
+  free(setsWith);
 }
@@ -3,6 +3,7 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _POSIX_C_SOURCE 200112L /* for popen */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -32,6 +33,9 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int binary = 0;
+static int live = 0;
+static int inprocess = 0;
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,22 +45,192 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * filter_trace - Copy the accesses of the lackey output in that lie
+ *     between the start and end markers to out, and to bin if it is
+ *     not NULL.  If markers is NULL, the marker addresses are taken
+ *     from the "markers" line of tracegen -l and in is read to its
+ *     end, so that the traced program never blocks writing to it.
+ */
+static void filter_trace(FILE *in, FILE *out, trace_writer_t *bin,
+                         unsigned long long *markers)
+{
+    unsigned int len;
+    unsigned long long marker_start = 0, marker_end = 0, addr;
+    char buf[1000];
+    int flag = 0, done = 0;
+
+    if (markers) {
+        marker_start = markers[0];
+        marker_end = markers[1];
+    }
+    while (fgets(buf, 1000, in) != NULL) {
+        if (!markers && strncmp(buf, "markers ", 8) == 0) {
+            sscanf(buf+8, "%llx %llx", &marker_start, &marker_end);
+            continue;
+        }
+
+        /* We are only interested in memory access instructions */
+        if (!done && buf[0]==' ' && buf[2]==' ' &&
+            (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
+            sscanf(buf+3, "%llx,%u", &addr, &len);
+        
+            /* If start marker found, set flag */
+            if (addr == marker_start)
+                flag = 1;
+
+            /* Valgrind creates many spurious accesses to the
+               stack that have nothing to do with the students
+               code. At the moment, we are ignoring all stack
+               accesses by using the simple filter of recording
+               accesses to only the low 32-bit portion of the
+               address space. At some point it would be nice to
+               try to do more informed filtering so that would
+               eliminate the valgrind stack references while
+               include the student stack references. */
+            if (flag && addr < 0xffffffff) {
+                fputs(buf, out);
+                if (bin)
+                    traceWrite(bin, buf[1], addr, len);
+            }
+
+            /* if end marker found, the trace is complete */
+            if (addr == marker_end) {
+                flag = 0;
+                done = 1;
+                if (markers)
+                    break;
+            }
+        }
+    }
+}
+
+/*
+ * trace_file - Trace function i into trace.tmp, filter it into
+ *     trace.f<i> and run the reference simulator on that.  Returns the
+ *     exit status of tracegen, nonzero if validation failed.
+ */
+static int trace_file(int i, unsigned int s, unsigned int E, unsigned int b,
+                      trace_writer_t *part_bin)
+{
+    int flag;
+    unsigned long long markers[2];
+    char cmd[255];
+    char filename[128];
+
+    printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
+    /* Use valgrind to generate the trace */
+
+    sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
+    flag=WEXITSTATUS(system(cmd));
+    if (0!=flag)
+        return flag;
+
+    /* Get the start and end marker addresses */
+    FILE* marker_fp = fopen(".marker", "r");
+    assert(marker_fp);
+    fscanf(marker_fp, "%llx %llx", &markers[0], &markers[1]);
+    fclose(marker_fp);
+
+    FILE* full_trace_fp = fopen("trace.tmp", "r");
+    assert(full_trace_fp);
+
+    /* Filtered trace for each transpose function goes in a separate file */
+    sprintf(filename, "trace.f%d", i);
+    FILE* part_trace_fp = fopen(filename, "w");
+    assert(part_trace_fp);
+
+    /* and with -b, in trace.f%d.bin as well */
+    if (binary) {
+        strcat(filename, ".bin");
+        flag = traceWriterOpen(part_bin, filename);
+        assert(flag);
+    }
+
+    /* Locate trace corresponding to the trans function */
+    filter_trace(full_trace_fp, part_trace_fp, binary ? part_bin : NULL, markers);
+    fclose(part_trace_fp);
+    if (binary && !traceWriterClose(part_bin))
+        printf("Error writing the binary trace of function %d\n", i);
+    fclose(full_trace_fp);
+
+    /* Run the reference simulator */
+    printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+    sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
+            s, E, b, i);
+    system(cmd);
+    return 0;
+}
+
+/*
+ * trace_live - With -l, pipe the trace of function i from valgrind
+ *     through the marker filter straight into the reference simulator,
+ *     so that tracing, filtering and simulation run at the same time
+ *     and nothing but the results reaches the disk.  Returns the exit
+ *     status of tracegen, nonzero if validation failed.
+ */
+static int trace_live(int i, unsigned int s, unsigned int E, unsigned int b,
+                      trace_writer_t *part_bin)
+{
+    int flag;
+    char cmd[255];
+    char filename[128];
+
+    printf("\nFunction %d (%d total)\nStep 1: Validating, tracing and evaluating performance (s=%d, E=%d, b=%d)\n",
+           i, func_counter, s, E, b);
+    sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d -l", M, N, i);
+    FILE* full_trace_fp = popen(cmd, "r");
+    assert(full_trace_fp);
+    sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t /dev/stdin > /dev/null", s, E, b);
+    FILE* sim_fp = popen(cmd, "w");
+    assert(sim_fp);
+
+    if (binary) {
+        sprintf(filename, "trace.f%d.bin", i);
+        flag = traceWriterOpen(part_bin, filename);
+        assert(flag);
+    }
+
+    filter_trace(full_trace_fp, sim_fp, binary ? part_bin : NULL, NULL);
+    flag = WEXITSTATUS(pclose(full_trace_fp));
+    /* The results are written once the simulator has read it all */
+    pclose(sim_fp);
+    if (binary && !traceWriterClose(part_bin))
+        printf("Error writing the binary trace of function %d\n", i);
+    /* As without -l, no trace is kept of a function that failed */
+    if (binary && flag != 0)
+        remove(filename);
+    return flag;
+}
+
+/*
+ * trace_inprocess - With -i, run function i in tracegen-inst, which
+ *     simulates its own accesses as it runs, without valgrind, and
+ *     leaves the results where the reference simulator would.  Returns
+ *     the exit status of tracegen-inst, nonzero if validation failed.
+ */
+static int trace_inprocess(int i, unsigned int s, unsigned int E, unsigned int b)
+{
+    char cmd[255];
+
+    printf("\nFunction %d (%d total)\nStep 1: Validating and evaluating performance in process (s=%d, E=%d, b=%d)\n",
+           i, func_counter, s, E, b);
+    sprintf(cmd, "./tracegen-inst -M %d -N %d -F %d -s %u -E %u -b %u > /dev/null", M, N, i, s, E, b);
+    return WEXITSTATUS(system(cmd));
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
     int i,flag;
-    unsigned int len, hits, misses, evictions;
-    unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
-    char filename[128];
+    unsigned int hits, misses, evictions;
 
     registerFunctions(); 
 
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
+    trace_writer_t* part_bin = malloc(sizeof(trace_writer_t));
+    assert(part_bin);
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -64,24 +238,15 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
         if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
             results.funcid = i; /* remember which function is the submission */
 
-
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
-
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
+        if (inprocess)
+            flag = trace_inprocess(i, s, E, b);
+        else
+            flag = live ? trace_live(i, s, E, b, part_bin) : trace_file(i, s, E, b, part_bin);
         if (0!=flag) {
             printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
             continue;
         }
 
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
-
         func_list[i].correct=1;
 
         /* Save the correctness of the transpose submission */
@@ -89,58 +254,6 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.correct = 1;
         }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
-
-
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-    
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
-        
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
-            }
-        }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
         /* Collect results from the reference simulator */
         FILE* in_fp = fopen(".csim_results","r");
         assert(in_fp);
@@ -157,6 +270,7 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.misses = misses;
         }
     }
+    free(part_bin);
   
 }
 
@@ -164,11 +278,14 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-hbli] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
+    printf("  -b          Also write each trace.f<n> as a binary trace.f<n>.bin\n");
+    printf("  -l          Simulate the traces as they are produced, without trace files\n");
+    printf("  -i          Trace and simulate in process with tracegen-inst, without valgrind\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
 }
 
@@ -199,7 +316,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:hbli")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +324,15 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'b':
+            binary = 1;
+            break;
+        case 'l':
+            live = 1;
+            break;
+        case 'i':
+            inprocess = 1;
+            break;
         case 'h':
             usage(argv);
             exit(0);
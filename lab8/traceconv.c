@@ -0,0 +1,155 @@
+/*
+ * traceconv.c - Converts valgrind lackey traces to the binary trace
+ * format of cachelab.h, or back with -d.
+ *
+ * Lines that are not accesses (such as valgrind's own messages) are
+ * dropped, so the output of "valgrind --tool=lackey --trace-mem=yes"
+ * can be converted as is.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "cachelab.h"
+
+/*
+ * usage - Print usage info
+ */
+void usage(char *argv[])
+{
+    printf("Usage: %s [-hd] <in> <out>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h   Print this help message.\n");
+    printf("  -d   Convert a binary trace back to text.\n");
+    printf("Use - for stdin or stdout.\n");
+    printf("Example: %s traces/yi.trace yi.bin\n", argv[0]);
+}
+
+/*
+ * toBinary - Convert a text trace, return the number of accesses
+ */
+long toBinary(FILE *in, trace_writer_t *w)
+{
+    char buf[1000];
+    unsigned long long addr;
+    unsigned int len;
+    long count = 0;
+
+    while (fgets(buf, sizeof(buf), in) != NULL) {
+        char op = buf[0] == 'I' ? 'I' : buf[1];
+        if (buf[0] != 'I' && buf[0] != ' ')
+            continue;
+        if (op != 'I' && op != 'L' && op != 'S' && op != 'M')
+            continue;
+        if (sscanf(buf + 2, " %llx,%u", &addr, &len) != 2)
+            continue;
+        traceWrite(w, op, addr, len);
+        count++;
+    }
+    return count;
+}
+
+/*
+ * toText - Convert a binary trace, return the number of accesses or
+ *     -1 if it is malformed
+ */
+long toText(FILE *in, FILE *out)
+{
+    static unsigned char buf[TRACE_BLOCK_BYTES];
+    unsigned char header[TRACE_BLOCK_HEADER];
+    const unsigned char *p, *end;
+    unsigned long long addr;
+    unsigned int n, len, size;
+    long count = 0;
+    char op;
+
+    if (fread(header, 1, TRACE_MAGIC_LEN, in) != TRACE_MAGIC_LEN
+        || memcmp(header, TRACE_MAGIC, TRACE_MAGIC_LEN) != 0)
+        return -1;
+    while (fread(header, 1, TRACE_BLOCK_HEADER, in) == TRACE_BLOCK_HEADER) {
+        n = traceGetWord(header);
+        len = traceGetWord(header + 4);
+        if (len > TRACE_BLOCK_BYTES || fread(buf, 1, len, in) != len)
+            return -1;
+        p = buf;
+        end = buf + len;
+        addr = 0;
+        for (; n > 0; n--) {
+            if (!(p = traceDecode(p, end, &op, &addr, &size)))
+                return -1;
+            if (op == 'I')
+                fprintf(out, "I  %08llx,%u\n", addr, size);
+            else
+                fprintf(out, " %c %08llx,%u\n", op, addr, size);
+            count++;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    int c, decode = 0;
+    long count;
+    FILE *in, *out;
+    trace_writer_t *w;
+
+    while ((c = getopt(argc, argv, "hd")) != -1) {
+        switch (c) {
+        case 'd':
+            decode = 1;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv);
+        exit(1);
+    }
+
+    in = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "rb");
+    if (!in) {
+        perror(argv[optind]);
+        exit(1);
+    }
+
+    if (decode) {
+        out = strcmp(argv[optind + 1], "-") == 0 ? stdout
+            : fopen(argv[optind + 1], "w");
+        if (!out) {
+            perror(argv[optind + 1]);
+            exit(1);
+        }
+        count = toText(in, out);
+        if (count < 0) {
+            fprintf(stderr, "%s: not a valid binary trace\n", argv[optind]);
+            exit(1);
+        }
+        if (fclose(out) != 0) {
+            perror(argv[optind + 1]);
+            exit(1);
+        }
+    } else {
+        w = malloc(sizeof(trace_writer_t));
+        if (!traceWriterOpen(w, argv[optind + 1])) {
+            perror(argv[optind + 1]);
+            exit(1);
+        }
+        count = toBinary(in, w);
+        if (!traceWriterClose(w)) {
+            perror(argv[optind + 1]);
+            exit(1);
+        }
+        free(w);
+    }
+    fclose(in);
+    fprintf(stderr, "%ld accesses\n", count);
+    return 0;
+}
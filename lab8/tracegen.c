@@ -4,7 +4,14 @@
  * 
  * The beginning and end of each registered transpose function's trace
  * is indicated by reading from "marker" addresses. These two marker
- * addresses are recorded in file for later use.
+ * addresses are recorded in file for later use, or with -l printed
+ * first on stdout as "markers <start> <end>", so that whoever reads
+ * the trace as it is produced can find them in it.
+ *
+ * Built as tracegen-inst (TRACE_INPROCESS), it traces itself instead,
+ * through the accesses instrumented at compile time (see tracer.c),
+ * and prints the summary of the cache given by -s, -E and -b for each
+ * transpose function, without valgrind.
  */
 
 #include <stdlib.h>
@@ -30,6 +37,24 @@ static int B[256][256];
 static int M;
 static int N;
 
+#ifdef TRACE_INPROCESS
+/* The cache simulated in process, as in test-trans */
+static unsigned int cache_s = 5, cache_E = 1, cache_b = 5;
+
+/*
+ * summarize - Print and record the counts of the function just traced
+ */
+static void summarize(void)
+{
+    int hits, misses, evictions;
+    tracerResults(&hits, &misses, &evictions);
+    printSummary(hits, misses, evictions);
+}
+#define OPTIONS "M:N:F:ls:E:b:"
+#else
+#define OPTIONS "M:N:F:l"
+#endif
+
 
 int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
     int C[M][N];
@@ -51,7 +76,8 @@ int main(int argc, char* argv[]){
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"M:N:F:")) != -1){
+    int live=0;
+    while( (c=getopt(argc,argv,OPTIONS)) != -1){
         switch(c){
         case 'M':
             M = atoi(optarg);
@@ -62,6 +88,20 @@ int main(int argc, char* argv[]){
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 'l':
+            live = 1;
+            break;
+#ifdef TRACE_INPROCESS
+        case 's':
+            cache_s = atoi(optarg);
+            break;
+        case 'E':
+            cache_E = atoi(optarg);
+            break;
+        case 'b':
+            cache_b = atoi(optarg);
+            break;
+#endif
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
@@ -72,17 +112,27 @@ int main(int argc, char* argv[]){
 
     /*  Register transpose functions */
     registerFunctions();
+#ifdef TRACE_INPROCESS
+    tracerInit(cache_s, cache_E, cache_b, &MARKER_START, &MARKER_END);
+#endif
 
     /* Fill A with data */
     initMatrix(M,N, A, B); 
 
-    /* Record marker addresses */
-    FILE* marker_fp = fopen(".marker","w");
-    assert(marker_fp);
-    fprintf(marker_fp, "%llx %llx", 
-            (unsigned long long int) &MARKER_START,
-            (unsigned long long int) &MARKER_END );
-    fclose(marker_fp);
+    /* Record marker addresses, ahead of the accesses to them */
+    if (live) {
+        printf("markers %llx %llx\n",
+               (unsigned long long int) &MARKER_START,
+               (unsigned long long int) &MARKER_END );
+        fflush(stdout);
+    } else {
+        FILE* marker_fp = fopen(".marker","w");
+        assert(marker_fp);
+        fprintf(marker_fp, "%llx %llx", 
+                (unsigned long long int) &MARKER_START,
+                (unsigned long long int) &MARKER_END );
+        fclose(marker_fp);
+    }
 
     if (-1==selectedFunc) {
         /* Invoke registered transpose functions */
@@ -92,6 +142,9 @@ int main(int argc, char* argv[]){
             MARKER_END = 34;
             if (!validate(i,M,N,A,B))
                 return i+1;
+#ifdef TRACE_INPROCESS
+            summarize();
+#endif
         }
     } else {
         MARKER_START = 33;
@@ -99,6 +152,9 @@ int main(int argc, char* argv[]){
         MARKER_END = 34;
         if (!validate(selectedFunc,M,N,A,B))
             return selectedFunc+1;
+#ifdef TRACE_INPROCESS
+        summarize();
+#endif
 
     }
     return 0;
@@ -0,0 +1,128 @@
+/*
+ * tracer.c - In-process memory tracer for tracegen-inst
+ *
+ * tracegen-inst is tracegen built with trans.c and tracegen.c compiled
+ * with -fsanitize=thread, which makes the compiler call __tsan_read<n>
+ * before every load and __tsan_write<n> before every store.  Instead
+ * of the thread sanitizer runtime, the hooks below are linked in.
+ * They keep the accesses that test-trans keeps from a lackey trace:
+ * from the one to the start marker to the one to the end marker, below
+ * 0xffffffff (tracegen-inst is not position independent, so that
+ * leaves out the stack just as under valgrind).  Those accesses go
+ * straight to an LRU cache like csim-ref's, in a small fraction of
+ * the time valgrind takes.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cachelab.h"
+
+static struct {
+    unsigned int s, E, b;
+    unsigned long long *tags;  /* E tags per set */
+    unsigned long long *used;  /* Time of last use of each line, 0 if empty */
+    unsigned long long now;
+    unsigned long long start, end;
+    int recording;
+    int hits, misses, evictions;
+} tracer;
+
+void tracerInit(unsigned int s, unsigned int E, unsigned int b,
+                const volatile void *start, const volatile void *end)
+{
+    tracer.s = s;
+    tracer.E = E;
+    tracer.b = b;
+    tracer.tags = malloc(sizeof(unsigned long long) * (E << s));
+    tracer.used = malloc(sizeof(unsigned long long) * (E << s));
+    tracer.start = (unsigned long long) start;
+    tracer.end = (unsigned long long) end;
+    tracer.recording = 0;
+}
+
+void tracerResults(int *hits, int *misses, int *evictions)
+{
+    *hits = tracer.hits;
+    *misses = tracer.misses;
+    *evictions = tracer.evictions;
+}
+
+/*
+ * tracerSimulate - One access to addr, as csim-ref does it
+ */
+static void tracerSimulate(unsigned long long addr)
+{
+    unsigned long long set = (addr >> tracer.b) & ((1ULL << tracer.s) - 1);
+    unsigned long long tag = addr >> (tracer.s + tracer.b);
+    unsigned long long *tags = tracer.tags + set * tracer.E;
+    unsigned long long *used = tracer.used + set * tracer.E;
+    unsigned int i, victim = 0;
+
+    tracer.now++;
+    for (i = 0; i < tracer.E; i++) {
+        if (used[i] && tags[i] == tag) {
+            used[i] = tracer.now;
+            tracer.hits++;
+            return;
+        }
+        if (used[i] < used[victim])
+            victim = i;
+    }
+    tracer.misses++;
+    if (used[victim])
+        tracer.evictions++;
+    tags[victim] = tag;
+    used[victim] = tracer.now;
+}
+
+/*
+ * tracerAccess - Filter an access as test-trans filters a lackey trace.
+ *     Each marked region starts from an empty cache.
+ */
+static void tracerAccess(const volatile void *p)
+{
+    unsigned long long addr = (unsigned long long) p;
+
+    if (tracer.tags == NULL)
+        return;
+    if (addr == tracer.start) {
+        memset(tracer.used, 0, sizeof(unsigned long long) * (tracer.E << tracer.s));
+        tracer.now = 0;
+        tracer.hits = tracer.misses = tracer.evictions = 0;
+        tracer.recording = 1;
+    }
+    if (tracer.recording && addr < 0xffffffff)
+        tracerSimulate(addr);
+    if (addr == tracer.end)
+        tracer.recording = 0;
+}
+
+/* The hooks called by -fsanitize=thread code */
+void __tsan_init(void) {}
+void __tsan_func_entry(void *pc) {}
+void __tsan_func_exit(void *pc) {}
+
+#define TSAN_HOOKS(n) \
+    void __tsan_read##n(void *p) { tracerAccess(p); } \
+    void __tsan_write##n(void *p) { tracerAccess(p); } \
+    void __tsan_unaligned_read##n(void *p) { tracerAccess(p); } \
+    void __tsan_unaligned_write##n(void *p) { tracerAccess(p); }
+
+void __tsan_read1(void *p) { tracerAccess(p); }
+void __tsan_write1(void *p) { tracerAccess(p); }
+TSAN_HOOKS(2)
+TSAN_HOOKS(4)
+TSAN_HOOKS(8)
+TSAN_HOOKS(16)
+
+/* Block copies, taken as a run of 8 byte accesses */
+void __tsan_read_range(void *p, unsigned long size)
+{
+    unsigned long i;
+    for (i = 0; i < size; i += 8)
+        tracerAccess((char *) p + i);
+}
+
+void __tsan_write_range(void *p, unsigned long size)
+{
+    __tsan_read_range(p, size);
+}